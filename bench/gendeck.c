@@ -0,0 +1,173 @@
+/*
+ * Generates synthetic decks for `make bench`.
+ *
+ * gendeck [-s slides] [-b boxes] [-w words] [-d depth] [-i images]
+ *         [-W width] [-H height] <outdir>
+ *
+ * Writes <outdir>/deck.slide and <outdir>/imageN.ppm. Every slide uses
+ * the deepest of a chain of depth templates, each template using the
+ * one before it, fills each of its boxes with a text of words words and
+ * shows one of the images round robin. Image paths in the deck include
+ * outdir, so run illuscribe from the directory gendeck was run in.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char* words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+        "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "et",
+        "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam", "quis"
+};
+
+void write_image(const char* path, unsigned int index, int width, int height);
+void write_text(FILE* file, unsigned int seed, unsigned int count);
+int read_option(char** argv, int* i, int min);
+
+
+void write_image(const char* path, unsigned int index, int width, int height)
+{
+        FILE* file = fopen(path, "wb");
+        int x;
+        int y;
+
+        if (!file) {
+                fprintf(stderr, "Error opening file: %s\n", path);
+                exit(1);
+        }
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        for (y = 0; y < height; y++) {
+                for (x = 0; x < width; x++) {
+                        putc((x * 255 / width + index * 40) & 0xFF, file);
+                        putc((y * 255 / height + index * 90) & 0xFF, file);
+                        putc(((x ^ y) + index * 20) & 0xFF, file);
+                }
+        }
+        fclose(file);
+}
+
+
+void write_text(FILE* file, unsigned int seed, unsigned int count)
+{
+        unsigned int i;
+
+        for (i = 0; i < count; i++) {
+                seed = seed * 1103515245u + 12345u;
+                fprintf(file, "%s%s", i ? " " : "", words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))]);
+        }
+}
+
+
+int read_option(char** argv, int* i, int min)
+{
+        int value;
+
+        if (!argv[*i + 1]) {
+                fprintf(stderr, "Missing value for %s\n", argv[*i]);
+                exit(1);
+        }
+        value = atoi(argv[*i + 1]);
+        if (value < min) {
+                fprintf(stderr, "%s must be at least %d\n", argv[*i], min);
+                exit(1);
+        }
+        *i += 1;
+        return value;
+}
+
+
+int main(int argc, char** argv)
+{
+        int slides = 20;
+        int boxes = 3;
+        int word_count = 40;
+        int depth = 1;
+        int images = 4;
+        int width = 640;
+        int height = 480;
+        char* outdir = NULL;
+        char path[4096];
+        FILE* file;
+        int i;
+        int j;
+
+        for (i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "-s") == 0)
+                        slides = read_option(argv, &i, 1);
+                else if (strcmp(argv[i], "-b") == 0)
+                        boxes = read_option(argv, &i, 1);
+                else if (strcmp(argv[i], "-w") == 0)
+                        word_count = read_option(argv, &i, 1);
+                else if (strcmp(argv[i], "-d") == 0)
+                        depth = read_option(argv, &i, 0);
+                else if (strcmp(argv[i], "-i") == 0)
+                        images = read_option(argv, &i, 0);
+                else if (strcmp(argv[i], "-W") == 0)
+                        width = read_option(argv, &i, 1);
+                else if (strcmp(argv[i], "-H") == 0)
+                        height = read_option(argv, &i, 1);
+                else if (argv[i][0] != '-' && !outdir)
+                        outdir = argv[i];
+                else {
+                        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                        exit(1);
+                }
+        }
+        if (!outdir) {
+                fprintf(stderr, "Usage: %s [-s slides] [-b boxes] [-w words] [-d depth] [-i images] [-W width] [-H height] <outdir>\n", argv[0]);
+                exit(1);
+        }
+        mkdir(outdir, 0755);
+
+        for (i = 0; i < images; i++) {
+                sprintf(path, "%.4000s/image%d.ppm", outdir, i);
+                write_image(path, i, width, height);
+        }
+
+        sprintf(path, "%.4000s/deck.slide", outdir);
+        file = fopen(path, "w");
+        if (!file) {
+                fprintf(stderr, "Error opening file: %s\n", path);
+                exit(1);
+        }
+
+        /* t0 declares the boxes, every later template adds a line to the first one */
+        for (i = 0; i < depth; i++) {
+                fprintf(file, "template: \"t%d\"\n", i);
+                if (i == 0) {
+                        fprintf(file, "    box: \"b0\", stack-vertical, align-center\n");
+                        for (j = 1; j < boxes; j++)
+                                fprintf(file, "    box: \"b%d\", stack-horizontal, align-left\n", j);
+                }
+                else {
+                        fprintf(file, "    uses: \"t%d\"\n", i - 1);
+                        fprintf(file, "    define: \"b0\"\n        text: small, \"level %d\"\n    end\n", i);
+                }
+                fprintf(file, "end\n\n");
+        }
+
+        for (i = 0; i < slides; i++) {
+                fprintf(file, "slide: \"s%d\"\n", i);
+                if (depth > 0) {
+                        fprintf(file, "    uses: \"t%d\"\n", depth - 1);
+                }
+                else {
+                        fprintf(file, "    box: \"b0\", stack-vertical, align-center\n");
+                        for (j = 1; j < boxes; j++)
+                                fprintf(file, "    box: \"b%d\", stack-horizontal, align-left\n", j);
+                }
+                fprintf(file, "    define: \"b0\"\n        text: title, \"Slide %d\"\n    end\n", i);
+                for (j = 1; j < boxes; j++) {
+                        fprintf(file, "    define: \"b%d\"\n        text: normal, \"", j);
+                        write_text(file, i * boxes + j, word_count);
+                        fprintf(file, "\"\n");
+                        if (j == boxes - 1 && images > 0)
+                                fprintf(file, "        image: \"%s/image%d.ppm\"\n", outdir, i % images);
+                        fprintf(file, "    end\n");
+                }
+                fprintf(file, "end\n\n");
+        }
+        fclose(file);
+        return 0;
+}
@@ -0,0 +1,121 @@
+#!/bin/sh
+# Compares the benchmark decks against bench/baseline.json.
+#
+# bench/regress.sh           fail if a stage got slower than the baseline
+# bench/regress.sh --update  record the current timings as the baseline
+#
+# Every deck is run BENCH_TRIALS times and the fastest median of each
+# stage is kept, which filters out most of the noise. The benchmark is
+# pinned to BENCH_CPU with taskset when it is available. A stage
+# regresses when it is more than BENCH_THRESHOLD percent and more than
+# BENCH_MIN_MS slower than its baseline. Baselines only mean something
+# on the machine they were recorded on.
+
+ILLUSCRIBE=${ILLUSCRIBE:-./illuscribe}
+BASELINE=${BASELINE:-bench/baseline.json}
+BENCH_DECKS=${BENCH_DECKS:-"bench/out/small/deck.slide bench/out/medium/deck.slide bench/out/large/deck.slide"}
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-10}
+BENCH_TRIALS=${BENCH_TRIALS:-3}
+BENCH_THRESHOLD=${BENCH_THRESHOLD:-10}
+BENCH_MIN_MS=${BENCH_MIN_MS:-0.5}
+BENCH_CPU=${BENCH_CPU:-$(($(nproc) - 1))}
+
+if command -v taskset > /dev/null; then
+        PIN="taskset -c $BENCH_CPU"
+fi
+
+trials=$(mktemp) || exit 1
+current=$(mktemp) || exit 1
+trap 'rm -f "$trials" "$current"' EXIT
+
+for deck in $BENCH_DECKS; do
+        i=0
+        while [ $i -lt "$BENCH_TRIALS" ]; do
+                $BENCH_RUN $PIN "$ILLUSCRIBE" --bench "$BENCH_ITERATIONS" "$deck" >> "$trials" || exit 1
+                i=$((i + 1))
+        done
+done
+
+# keeps the fastest median of each stage, one line per deck:
+# {"deck": "...", "median_ms": {"parse": 1.234, ...}}
+awk '
+{
+        match($0, /"deck": "[^"]*"/)
+        deck = substr($0, RSTART + 9, RLENGTH - 10)
+        if (!(deck in seen)) {
+                seen[deck] = 1
+                decks[++ndecks] = deck
+        }
+        rest = $0
+        while (match(rest, /"[a-z_]+": \{"median_ms": [0-9.]+/)) {
+                field = substr(rest, RSTART, RLENGTH)
+                rest = substr(rest, RSTART + RLENGTH)
+                stage = substr(field, 2, index(field, "\":") - 2)
+                value = substr(field, index(field, "median_ms\": ") + 12) + 0
+                if (!((deck, stage) in best)) {
+                        stages[deck] = stages[deck] " " stage
+                        best[deck, stage] = value
+                }
+                else if (value < best[deck, stage]) {
+                        best[deck, stage] = value
+                }
+        }
+}
+END {
+        for (d = 1; d <= ndecks; d++) {
+                deck = decks[d]
+                n = split(stages[deck], names, " ")
+                printf("{\"deck\": \"%s\", \"median_ms\": {", deck)
+                for (s = 1; s <= n; s++)
+                        printf("%s\"%s\": %.3f", s > 1 ? ", " : "", names[s], best[deck, names[s]])
+                printf("}}\n")
+        }
+}' "$trials" > "$current"
+
+if [ "$1" = "--update" ]; then
+        cp "$current" "$BASELINE"
+        echo "Wrote $BASELINE"
+        exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+        echo "No baseline at $BASELINE, record one with $0 --update" >&2
+        exit 1
+fi
+
+awk -v threshold="$BENCH_THRESHOLD" -v min_ms="$BENCH_MIN_MS" '
+# fills table[deck, stage] from one line, and keys with them in line order
+function parse(line, table, keys,    deck, rest, field, stage) {
+        match(line, /"deck": "[^"]*"/)
+        deck = substr(line, RSTART + 9, RLENGTH - 10)
+        rest = line
+        while (match(rest, /"[a-z_]+": [0-9.]+/)) {
+                field = substr(rest, RSTART, RLENGTH)
+                rest = substr(rest, RSTART + RLENGTH)
+                stage = substr(field, 2, index(field, "\":") - 2)
+                table[deck, stage] = substr(field, index(field, "\": ") + 3) + 0
+                keys[++keys[0]] = deck SUBSEP stage
+        }
+}
+NR == FNR { parse($0, base, base_keys); next }
+{ parse($0, cur, cur_keys) }
+END {
+        printf("%-32s %-13s %10s %10s %8s\n", "deck", "stage", "baseline", "current", "change")
+        for (i = 1; i <= cur_keys[0]; i++) {
+                key = cur_keys[i]
+                split(key, parts, SUBSEP)
+                if (!(key in base)) {
+                        printf("%-32s %-13s %10s %10.3f %8s\n", parts[1], parts[2], "-", cur[key], "new")
+                        continue
+                }
+                change = base[key] > 0 ? (cur[key] - base[key]) * 100 / base[key] : 0
+                slow = change > threshold && cur[key] - base[key] > min_ms
+                printf("%-32s %-13s %10.3f %10.3f %+7.1f%%%s\n", parts[1], parts[2], base[key], cur[key], change, slow ? "  REGRESSION" : "")
+                if (slow)
+                        failed++
+        }
+        if (failed) {
+                printf("%d stage(s) regressed by more than %s%%\n", failed, threshold)
+                exit 1
+        }
+}' "$BASELINE" "$current"
@@ -13,6 +13,7 @@
 #include <X11/Xatom.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/Xpresent.h>
 #include <X11/Xft/Xft.h>
 #include <X11/keysym.h>
 #include <stdio.h>
@@ -20,8 +21,83 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <setjmp.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+#define ISB_MAGIC "ISBD"
+#define ISB_VERSION 3
+#define ISB_FLAG_PIXELS 1
+#define ISB_NO_STRING 0xFFFFFFFFu
+#define ISB_ALIGN 16
+
+#define EVENT_MAX_SOURCES 16
+#define RELOAD_DELAY_MS 50
+
+#define THUMB_WIDTH 320
+#define THUMB_PROXY_SIZE 256
+#define THUMB_BUDGET_MS 8
+#define PROXY_MAX_WORKERS 8
+#define GRID_COLUMNS 4
+#define GRID_MARGIN 16
+
+#define PRESENTER_CACHE_SLOTS 3
+#define PRESENTER_MARGIN 16
+
+#define PRESENT_BUFFERS 2
+#define PRESENT_TIMEOUT_MS 1000
+
+#define TRANSITION_MS 400
+#define TRANSITION_FRAME_MS 16
+#define TRANSITION_BENCH_FRAMES 30
+
+#define GIF_MEMORY_BUDGET (32 * 1024 * 1024)
+#define GIF_RING_FRAMES 4
+#define GIF_MIN_DELAY_MS 20
+#define GIF_DEFAULT_DELAY_MS 100
+
+#define SEQUENCE_AHEAD 8
+#define SEQUENCE_MAX_WORKERS 4
+#define SEQUENCE_MAX_FPS 120
+
+#define DECODE_MAX_WORKERS 8
+#define STARTUP_EXPOSE_MS 500 /* how long the first frame waits for the window to be exposed */
+
+#define ZOOM_TILE_SIZE 256
+#define ZOOM_TILE_BYTES ((ZOOM_TILE_SIZE + 2) * (ZOOM_TILE_SIZE + 2) * 4)
+#define ZOOM_MAX_TILES 512
+#define ZOOM_MAX_LEVELS 16
+#define ZOOM_STEP 1.25
+#define ZOOM_MAX_PIXEL 8 /* screen pixels an image pixel can be zoomed to */
+
+#define TEXT_FONT_CACHE 32
+#define DIFF_MAX_RECTS 16
+#define STEP_ALL ((unsigned int)-1) /* every build step of a slide */
+
+#define CONTROL_MAX_CLIENTS 4
+#define CONTROL_LINE_MAX 256
 
 typedef struct Slide Slide;
+typedef struct Viewer Viewer;
 typedef struct Box Box;
 typedef struct Text Text;
 typedef struct Image Image;
@@ -51,8 +127,50 @@ typedef enum {
         STACK_VERTICAL
 } StackType;
 
+typedef enum {
+        PROXY_NONE,
+        PROXY_QUEUED,
+        PROXY_READY
+} ProxyState;
+
+typedef enum {
+        DECODE_DONE,
+        DECODE_QUEUED, /* data is NULL until a decode worker gets to it */
+        DECODE_RUNNING
+} DecodeState;
+
+/* open addressing hash table keyed by interned names */
+typedef struct {
+        char* key;
+        unsigned long hash;
+        void* value;
+} NameEntry;
+
+typedef struct {
+        NameEntry* entries;
+        unsigned int count;
+        unsigned int capacity;
+} NameTable;
+
+/*
+ * Where layout put a text line or image inside its box. Layout never
+ * touches Text or Image, so parsed content can be shared between
+ * slides while every box keeps its own geometry.
+ */
+typedef struct {
+        ElementType type;
+        FontSize font_size;
+        char* content;
+        Image* image;
+        unsigned int step; /* build step it shows up at, 0 from the start */
+
+        float x, y, size;
+        float rwidth, rheight;
+} LayoutItem;
+
 typedef struct {
         ElementType type;
+        unsigned int step; /* of text and images, the pauses before it in the deck */
         union {
                 Slide* slide;
                 Box* box;
@@ -61,12 +179,61 @@ typedef struct {
         } element;
 } SlideElement;
 
+typedef enum {
+        DRAW_CLEAR,
+        DRAW_IMAGE,
+        DRAW_GLYPHS
+} DrawOpType;
+
+typedef struct {
+        DrawOpType type;
+        XRectangle rect; /* pixels it covers on the target */
+        unsigned long hash; /* of everything it draws, rect included */
+        unsigned long color; /* DRAW_CLEAR */
+        LayoutItem* item; /* DRAW_IMAGE */
+        unsigned int first; /* DRAW_GLYPHS, its run of the list's glyphs */
+        unsigned int count;
+        unsigned int step; /* build step it is drawn from */
+} DrawOp;
+
+/*
+ * A slide compiled for one target size: a clear, the image composites,
+ * then a glyph run per box, all in absolute pixels. Drawing replays it
+ * without walking the slide tree, and every op is hashed so two lists
+ * can be compared. Layout gives each slide an empty list. It is
+ * compiled the first time the slide is drawn and again when the
+ * target's size or the open fonts change.
+ */
+typedef struct {
+        DrawOp* ops; /* malloced like glyphs, freed with the layout arena */
+        unsigned int op_count;
+        unsigned int op_capacity;
+        XftGlyphFontSpec* glyphs; /* the glyph runs back to back, in op order */
+        unsigned int glyph_count;
+        unsigned int glyph_capacity;
+        unsigned long hash; /* of all the ops */
+        unsigned int steps; /* highest build step of its ops */
+        int width; /* of the target it was compiled for, 0 before */
+        int height;
+        unsigned int fonts; /* text_fonts.generation it was compiled with */
+} DisplayList;
+
 struct Slide {
         ElementType type;
         char* name;
         bool visible;
         unsigned int element_count;
+        unsigned int element_capacity;
         SlideElement** elements;
+        /* every box and nested slide reachable from this slide by name */
+        NameTable element_index;
+        unsigned long hash; /* hash_slide of a top level slide */
+        unsigned int position; /* among the visible slides of its deck */
+        /* speaker notes, a run of the deck's notes text, see SlideList */
+        unsigned int notes_offset;
+        unsigned int notes_length;
+        unsigned int steps; /* build steps after the first, one per pause */
+        DisplayList* display; /* NULL before layout */
 };
 
 struct Box {
@@ -75,42 +242,667 @@ struct Box {
         StackType stack_type;
         char* name;
         unsigned int element_count;
+        unsigned int element_capacity;
         SlideElement** elements;
 
         float x, y, width, height;
+        unsigned int item_count;
+        unsigned int item_capacity;
+        LayoutItem* items;
 };
 
 struct Text {
         ElementType type;
         FontSize font_size;
         char* content;
-
-        float x, y, size;
 };
 
+/* one frame of an animated GIF and its server copy, None until it is needed */
+typedef struct {
+        unsigned char* data;
+        Pixmap pixmap;
+        Picture picture;
+        unsigned int delay_ms;
+} GifFrame;
+
+/*
+ * The frames of an animated GIF. Animations that fit GIF_MEMORY_BUDGET
+ * are decoded whole when loaded, their frames are BGRA like the image's
+ * data and the first one is drawn from the image itself. Longer ones keep
+ * the file and decode it while they play, a few frames ahead into a ring
+ * of GIF_RING_FRAMES that keeps RGBA frames, as decoding needs the one
+ * from two frames back, and reuses their server copies.
+ */
+typedef struct {
+        GifFrame* frames; /* the whole animation, or the ring */
+        unsigned int frame_count;
+        unsigned int shown; /* frame in the audience window */
+        double due_ms; /* when the frame after it is */
+        double stepped_ms; /* tick that last moved it on, see step_animations */
+        bool streaming;
+        bool stopped; /* the file broke while streaming, the frame on screen stays */
+        size_t bytes; /* counted in pixel_bytes */
+        /* for streaming */
+        unsigned char* file;
+        int file_size;
+        stbi__context ctx;
+        stbi__gif gif;
+        unsigned int queued; /* decoded frames after shown */
+        unsigned int loop_frames; /* decoded since the file was started over */
+        unsigned char* scratch; /* a frame swapped to BGRA for uploading */
+} GifAnimation;
+
+typedef enum {
+        SLOT_FREE,
+        SLOT_DECODING, /* a worker owns it */
+        SLOT_READY /* the main thread owns it */
+} SequenceSlotState;
+
+typedef struct {
+        SequenceSlotState state;
+        unsigned int frame;
+        unsigned char* data; /* BGRA, allocated once and reused */
+} SequenceSlot;
+
+/*
+ * A numbered image sequence from imageseq:, played at a fixed rate.
+ * Frames count up from the start of playback and wrap around the
+ * files. Workers decode the frames ahead of the one on screen into a
+ * fixed set of slots. Each tick uploads the newest frame that is due
+ * into one pixmap. Frames that weren't decoded in time are skipped, so
+ * playback never waits for a worker.
+ */
+typedef struct {
+        char* pattern; /* the filename up to the number, then suffix */
+        unsigned int prefix_len;
+        const char* suffix; /* in pattern */
+        unsigned int digits; /* the number is zero padded to at least this */
+        unsigned int first; /* number of the first file */
+        unsigned int file_count;
+        unsigned int fps;
+        int width; /* of the first frame, other frames must match it */
+        int height;
+        SequenceSlot* slots; /* sequence_ahead of them, made when it first plays */
+        unsigned int slot_count;
+        size_t bytes; /* counted in pixel_bytes */
+        /* guarded by the workers' lock */
+        unsigned int due; /* frame that should be on screen */
+        unsigned int next_decode;
+        /* main thread */
+        unsigned int shown;
+        bool uploaded; /* picture holds shown, otherwise the image itself is the first frame */
+        Pixmap pixmap;
+        Picture picture;
+        double start_ms;
+        double due_ms; /* when the frame after due is */
+        double stepped_ms; /* tick that last showed a frame, see step_animations */
+        /* for the stats */
+        unsigned int frames_shown;
+        unsigned int dropped;
+} ImageSequence;
+
+typedef struct {
+        unsigned char* data; /* BGRA */
+        int width;
+        int height;
+} ZoomLevel;
+
+typedef struct {
+        Pixmap pixmap;
+        Picture picture;
+        unsigned int level;
+        int x; /* in tiles */
+        int y;
+        unsigned long used; /* zoom draw it was last in */
+} ZoomTile;
+
+/*
+ * An image halved again and again down to one tile, for deep zoom.
+ * Level 0 is the image's own data, the others are built from the one
+ * before when zooming first needs them and kept with the image. Tiles
+ * are cut from a level with a border of the pixels around them, so
+ * filtering shows no seams, and uploaded as they come into view.
+ */
+typedef struct {
+        ZoomLevel levels[ZOOM_MAX_LEVELS];
+        unsigned int level_count; /* built so far */
+        ZoomTile* tiles; /* the least recently drawn is reused past ZOOM_MAX_TILES */
+        unsigned int tile_count;
+        size_t bytes; /* counted in pixel_bytes */
+} ZoomPyramid;
+
 struct Image {
         ElementType type;
-        XImage* ximage;
-        XRenderPictFormat* xrenderformat;
-        Picture src;
-        Picture dest;
+        Pixmap pixmap; /* server copy, None until first drawn */
+        Picture picture;
+        Image* prev_uploaded;
+        Image* next_uploaded;
+        /* downscaled copy thumbnails draw, NULL when the image is small enough */
+        ProxyState proxy_state;
+        unsigned char* proxy_data;
+        int proxy_width;
+        int proxy_height;
+        Pixmap proxy_pixmap;
+        Picture proxy_picture;
         char* filename;
         unsigned char* data;
         int width;
         int height;
         int channels;
-        float rheight;
-        float rwidth;
-        float x, y;
+        unsigned int refs;
+        bool mapped; /* data points into a compiled deck */
+        bool checked; /* mapped pixels matched checksum, guarded by pixel_check_lock */
+        uint32_t checksum;
+        DecodeState decode; /* guarded by decode_workers.lock while they run */
+        GifAnimation* anim; /* NULL unless it is an animated GIF */
+        ImageSequence* sequence; /* NULL unless it is an imageseq: */
+        ZoomPyramid* pyramid; /* NULL until the image is zoomed into */
+        time_t mtime;
+        off_t file_size;
+};
+
+typedef struct ArenaBlock ArenaBlock;
+typedef struct ArenaFinalizer ArenaFinalizer;
+
+struct ArenaBlock {
+        ArenaBlock* next;
+        size_t size;
+        size_t used;
+        unsigned char* data;
+};
+
+struct ArenaFinalizer {
+        ArenaFinalizer* next;
+        void (*fn)(void*);
+        void* ptr;
 };
 
+/* every parse-time object of a deck lives in its arena and is
+ * released all at once by arena_release */
 typedef struct {
+        ArenaBlock* head;
+        ArenaFinalizer* finalizers;
+        size_t total; /* bytes in blocks */
+        size_t used; /* bytes handed out */
+        size_t strings; /* part of used that went to arena_string */
+} Arena;
+
+typedef struct {
+        char* filename;
         Slide** slides;
         unsigned int count;
+        unsigned int capacity;
+        Arena arena;
+        Arena layout_arena;
+        NameTable names;
+        NameTable slide_index;
+        /* visible slides in presentation order, what navigation moves through */
+        unsigned int* visible;
+        unsigned int visible_count;
+        unsigned int visible_capacity;
+        NameTable position_index; /* name to visible slide */
+        Slide** by_name; /* visible slides sorted by name for prefix lookups */
+        unsigned int named_count;
+        /* every slide's speaker notes back to back, lines separated by '\n'.
+         * Kept apart from the boxes so layout and rendering never see them. */
+        char* notes;
+        unsigned int notes_size;
+        unsigned int notes_capacity;
 } SlideList;
 
+typedef enum {
+        EVENT_SOURCE_FD,
+        EVENT_SOURCE_TIMER,
+        EVENT_SOURCE_WAKEUP
+} EventSourceType;
+
+typedef void (*EventHandler)(void* data);
+
+typedef struct {
+        int fd; /* -1 for a free slot */
+        EventSourceType type;
+        EventHandler handler;
+        void* data;
+} EventSource;
+
+typedef struct {
+        int epoll_fd;
+        EventSource sources[EVENT_MAX_SOURCES];
+} EventLoop;
+
+/*
+ * Where render_slide draws. Windows can be resized under us and are
+ * measured before every frame, pixmaps keep the size they were made with.
+ * A window whose drawable is not the window itself draws into a back
+ * buffer, which grows with the window and is shown by present_window.
+ */
+typedef struct {
+        Window window; /* None when drawing into a pixmap */
+        Drawable drawable;
+        XftDraw* draw;
+        Picture picture;
+        int width;
+        int height;
+        bool use_proxies; /* draw images from their downscaled copies */
+        bool animate; /* draw animated images at the frame they are playing */
+        bool damaged; /* drawn since the back buffer was last shown */
+        unsigned long shown; /* shown_hash of the display list on it, 0 once anything else is drawn */
+        unsigned int step; /* last build step drawn, STEP_ALL draws whole slides */
+} RenderTarget;
+
+typedef struct {
+        Pixmap pixmap;
+        Picture picture;
+        unsigned long hash; /* of the slide when it was drawn */
+        bool valid;
+} Thumbnail;
+
+/*
+ * Threads downscaling images for thumbnails. Workers take jobs in
+ * order and append finished images to done, the main thread marks
+ * them ready when woken up through wakeup_fd.
+ */
+typedef struct {
+        pthread_t threads[PROXY_MAX_WORKERS];
+        unsigned int thread_count;
+        pthread_mutex_t lock;
+        Image** jobs;
+        Image** done;
+        unsigned int job_count;
+        unsigned int job_capacity;
+        unsigned int next_job;
+        unsigned int done_count;
+        unsigned int done_read; /* only touched by the main thread */
+        bool stop;
+        int wakeup_fd;
+} ProxyWorkers;
+
+/*
+ * Threads decoding the image sequences on the slide on screen. They run
+ * while the slide is up and wait on wake when every slot is taken. The
+ * playing images are held by a reference until the workers stop.
+ */
+typedef struct {
+        pthread_t threads[SEQUENCE_MAX_WORKERS];
+        unsigned int thread_count;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        bool stop;
+        Image** playing;
+        unsigned int playing_count;
+        unsigned int playing_capacity;
+        unsigned int turn; /* playing sequence the next job is looked for first */
+} SequenceWorkers;
+
+/*
+ * Threads decoding the still images of the deck loaded at startup while
+ * the window opens. Parsing only reads each image's size and queues it,
+ * so the slides can be laid out before any pixels are there. Whatever
+ * needs the pixels calls wait_for_pixels first, which decodes an image
+ * no worker took yet on the spot, so the first slide never waits behind
+ * the rest of the deck.
+ */
+typedef struct {
+        pthread_t threads[DECODE_MAX_WORKERS];
+        unsigned int thread_count; /* 0 when images are decoded as they are parsed */
+        pthread_mutex_t lock;
+        pthread_cond_t wake; /* a job was queued or queueing ended */
+        pthread_cond_t decoded;
+        Image** jobs;
+        unsigned int job_count;
+        unsigned int job_capacity;
+        unsigned int next_job;
+        bool queueing; /* the deck is still being parsed */
+        double decode_ms; /* added to bench_decode_ms when the workers stop */
+} DecodeWorkers;
+
+/* connecting to the X server and opening the fonts, which runs while the deck loads */
+typedef struct {
+        double start_ms; /* when main started */
+        pthread_t thread;
+        bool threaded;
+        Display* dpy;
+        double first_frame_ms; /* from start_ms to the first frame on screen, 0 before */
+} Startup;
+
+/* the thumbnail grid, one cell per visible slide, thumbnails stay cached while it is closed */
+typedef struct {
+        bool active;
+        unsigned int selected;
+        unsigned int first_row;
+        Thumbnail* thumbs; /* by slide index */
+        unsigned int thumb_count;
+        int thumb_width;
+        int thumb_height;
+        XftDraw* draw; /* moved between thumbnail pixmaps */
+        int timer;
+        ProxyWorkers workers;
+} Overview;
+
+/* a slide drawn into a pixmap, good for as long as the slide's hash is the same */
+typedef struct {
+        Pixmap pixmap;
+        Picture picture;
+        unsigned int slide_idx; /* the list's count for the end slide */
+        unsigned int step;
+        unsigned long hash;
+        unsigned long shown; /* the target's shown after drawing it */
+        bool valid;
+} CachedSlide;
+
+/*
+ * The speaker's window with the current slide, a preview of the next
+ * one and the elapsed time. Slides are cached as pixmaps the size of
+ * the current slide panel: the current, the next and the one after
+ * it, which is rendered ahead so moving on only costs composites.
+ */
+typedef struct {
+        bool open;
+        Window window;
+        RenderTarget target;
+        XftDraw* draw; /* moved between cached slides */
+        CachedSlide slides[PRESENTER_CACHE_SLOTS];
+        int slide_width;
+        int slide_height;
+        unsigned long shown_hash; /* of the slides on screen */
+        bool dirty;
+        bool prefetch;
+        int timer;
+        int clock_timer;
+        double start_ms;
+} Presenter;
+
+typedef enum {
+        TRANSITION_NONE,
+        TRANSITION_CROSSFADE,
+        TRANSITION_WIPE,
+        TRANSITION_PUSH
+} TransitionType;
+
+/*
+ * Slide transitions. The old and the new slide are drawn once into
+ * pixmaps the size of the window and every frame only composites
+ * them. Frames are placed by the clock: a late frame shows the
+ * transition where it should be by then, dropping the ones in between.
+ */
+typedef struct {
+        TransitionType type;
+        bool running;
+        int direction; /* 1 moving forward through the deck, -1 back */
+        CachedSlide from;
+        CachedSlide to; /* stays cached as the slide on screen for the next transition */
+        Pixmap mask_pixmap;
+        Picture mask; /* 1x1 repeating alpha for crossfades */
+        XftDraw* draw; /* moved between the two pixmaps */
+        int width;
+        int height;
+        double start_ms;
+        unsigned int last_frame; /* frame number of the last frame drawn */
+        int timer;
+        /* for the stats */
+        unsigned int frames;
+        unsigned int dropped;
+} Transition;
+
+/*
+ * Plays the animated images of the slide in the audience window. A tick
+ * only draws the images whose next frame is due, over their own
+ * rectangles, and sleeps until the next one is.
+ */
+typedef struct {
+        Slide* slide; /* NULL while nothing plays */
+        unsigned long hash; /* of the slide when it started */
+        int timer;
+        /* for the stats */
+        unsigned int frames;
+        unsigned int late; /* frames shown after the one behind them was due */
+} Animations;
+
+/*
+ * The image zoomed into in the audience window. It is drawn from the
+ * tiles of the pyramid level with the fewest pixels that still has one
+ * for each screen pixel, so the work follows the size of the window
+ * rather than the size of the image.
+ */
+typedef struct {
+        LayoutItem* item; /* NULL while nothing is zoomed */
+        Box* box;
+        double scale; /* 1 shows the whole image at its laid out size */
+        double center_x; /* image pixel in the middle of the view */
+        double center_y;
+        bool dirty; /* moved since it was last drawn */
+        bool dragging;
+        int drag_x;
+        int drag_y;
+        unsigned long draws;
+        unsigned char* scratch; /* a tile being uploaded */
+} ZoomView;
+
+typedef struct {
+        double size;
+        XftFont* font;
+        unsigned long used;
+} TextFont;
+
+/* fonts slide text is drawn with, one per size a target needs */
+typedef struct {
+        TextFont fonts[TEXT_FONT_CACHE];
+        unsigned int count;
+        unsigned long uses;
+        unsigned int generation; /* changes when a font is closed */
+} TextFonts;
+
+/* the go to slide prompt, typed into the window title */
+typedef struct {
+        bool active;
+        bool by_name; /* started with '/', otherwise a slide number */
+        char text[64];
+        unsigned int len;
+} JumpPrompt;
+
+typedef struct {
+        int fd; /* -1 for a free slot */
+        Viewer* viewer;
+        char line[CONTROL_LINE_MAX]; /* input up to the next newline */
+        unsigned int len;
+} ControlClient;
+
+/*
+ * The --control socket. Clients send one command per line and get one
+ * line back, and every client is told when the slide changes, however
+ * it was changed.
+ */
+typedef struct {
+        int fd; /* -1 when there is no socket */
+        const char* path;
+        ControlClient clients[CONTROL_MAX_CLIENTS];
+        unsigned int shown_idx; /* slide last announced */
+} ControlServer;
+
+/* state of the presentation window shared by the event handlers */
+struct Viewer {
+        Display* dpy;
+        Window window;
+        int screen;
+        SlideList* list;
+        unsigned int slide_idx;
+        int window_width;
+        int window_height;
+        int last_width;
+        int last_height;
+        bool is_fullscreen;
+        bool running;
+        EventLoop loop;
+        int watch_fd;
+        int reload_timer;
+        Overview overview;
+        JumpPrompt prompt;
+        Presenter presenter;
+        ControlServer control;
+};
+
+/*
+ * Shows the audience window's back buffer a whole frame at a time. With
+ * the Present extension a frame is copied into one of two present
+ * pixmaps and queued for the next vblank, so it never tears. One frame
+ * is in flight at a time and its completion event tells when it reached
+ * the screen. Without the extension the back buffer is copied straight
+ * to the window.
+ */
+typedef struct {
+        bool use_present;
+        int opcode; /* of the Present extension, its events carry it */
+        Pixmap buffers[PRESENT_BUFFERS];
+        bool idle[PRESENT_BUFFERS]; /* the server is done with it */
+        int buffer_width;
+        int buffer_height;
+        unsigned int next_buffer;
+        bool pending; /* a frame was submitted and hasn't completed */
+        double submitted_ms;
+        uint32_t serial;
+        double input_ms; /* when input the next frame answers came in, 0 for none */
+        double pending_input_ms;
+        uint64_t expected_msc; /* vblank the frame in flight should land on, 0 when unknown */
+        uint64_t last_msc;
+        uint64_t last_ust;
+        double refresh_us; /* estimated from completions */
+        /* for the stats */
+        unsigned int presented;
+        unsigned int missed; /* vblanks frames landed late by */
+        double latency_ms; /* input to photon of the last frame that answered input */
+        double max_latency_ms;
+} Presentation;
+
+/* decoded images by filename, shared across decks so reloads reuse them */
+typedef struct {
+        Arena arena;
+        NameTable images;
+} ImageCache;
+
+/* the X resources of the presentation window */
+typedef struct {
+        Display* dpy;
+        XRenderPictFormat* format;
+        Pixmap back; /* the audience window's back buffer */
+        Picture back_picture;
+        int back_width;
+        int back_height;
+        Image* uploaded; /* images with a server copy */
+        unsigned int live; /* Pixmaps and Pictures currently allocated */
+} XResources;
+
+typedef struct {
+        size_t tree;
+        size_t strings;
+        size_t layout;
+        size_t pixels;
+} MemUsage;
+
+
+typedef struct {
+        const void* key;
+        unsigned int value;
+} PtrEntry;
+
+typedef struct {
+        PtrEntry* entries;
+        unsigned int count;
+        unsigned int capacity;
+} PtrMap;
+
+/*
+ * Compiled deck (.isb) layout: header, slide, box, element and image
+ * tables, a string table, then decoded pixels. Every reference is an
+ * index or an offset, so the file is loaded with a single mmap.
+ */
+typedef struct {
+        char magic[4];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t header_size;
+        uint32_t file_size;
+        uint32_t top_slide_count;
+        uint32_t slide_count;
+        uint32_t box_count;
+        uint32_t element_count;
+        uint32_t image_count;
+        uint32_t string_size;
+        uint32_t notes; /* string holding the deck's notes text */
+        uint32_t slides_offset;
+        uint32_t boxes_offset;
+        uint32_t elements_offset;
+        uint32_t images_offset;
+        uint32_t strings_offset;
+        uint32_t pixels_offset;
+        uint32_t pixels_size;
+        uint32_t tables_checksum;
+        uint32_t header_checksum;
+} IsbHeader;
+
+typedef struct {
+        uint32_t name;
+        uint32_t visible;
+        uint32_t first_element;
+        uint32_t element_count;
+        uint32_t notes_offset;
+        uint32_t notes_length;
+        uint32_t steps;
+} IsbSlide;
+
+typedef struct {
+        uint32_t name;
+        uint32_t stack_type;
+        uint32_t text_align;
+        uint32_t first_element;
+        uint32_t element_count;
+} IsbBox;
+
+/* value is a slide, box or image index, or a string offset for text */
+typedef struct {
+        uint32_t type;
+        uint32_t value;
+        uint32_t font_size;
+        uint32_t step;
+} IsbElement;
+
+typedef struct {
+        uint32_t filename;
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t pixels;
+        uint32_t checksum; /* of the pixels, checked the first time they are used */
+} IsbImage;
+
+typedef struct {
+        Arena arena;
+        IsbSlide* slides;
+        unsigned int slide_count;
+        unsigned int slide_capacity;
+        IsbBox* boxes;
+        unsigned int box_count;
+        unsigned int box_capacity;
+        IsbElement* elements;
+        unsigned int element_count;
+        unsigned int element_capacity;
+        Image** images;
+        unsigned int image_count;
+        unsigned int image_capacity;
+        char* strings;
+        unsigned int string_size;
+        unsigned int string_capacity;
+        NameTable string_offsets;
+        PtrMap element_runs;
+        PtrMap image_indices;
+} IsbWriter;
+
+typedef struct {
+        void* addr;
+        size_t size;
+} IsbMapping;
+
 
-typedef void (*KeywordHandler)(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+typedef void (*KeywordHandler)(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
 
 typedef struct {
         const char* keyword;
@@ -119,73 +911,299 @@ typedef struct {
 
 
 void parse_slideshow(char* filename, SlideList* list);
-
-void render_endslide(Display* dpy, Window window, int screen);
-void render_slideshow(int width, int height, SlideList list);
+void load_deck(char* filename, SlideList* list);
+void append_notes(SlideList* list, Slide* slide, const char* line);
+void end_notes(SlideList* list, Slide* slide);
+void deck_error(void);
+bool reload_deck(SlideList* list, Display* dpy, Window window);
+unsigned long hash_slide(Slide* slide, unsigned long hash);
+void copy_layout(Arena* arena, Slide* dst, Slide* src);
+int watch_deck(const char* filename);
+bool reload_and_redraw(Viewer* viewer);
+bool deck_changed(int fd, const char* filename);
+
+void render_endslide(Display* dpy, RenderTarget* target, int screen);
+void start_opening_display(void);
+void* open_display(void* data);
+Display* finish_opening_display(void);
+void render_slideshow(Display* dpy, int width, int height, SlideList* list, bool presenter, const char* control_path);
+void show_first_frame(Display* dpy, Window window);
+void note_first_frame(double shown_ms);
+void open_fonts(Display* dpy, int screen);
+void open_drawing(Display* dpy, Window window, int screen);
+void close_drawing(Display* dpy, int screen);
+void open_x_resources(Display* dpy, Window window, int screen);
+void free_x_resources(void);
+void upload_image(Display* dpy, Drawable drawable, int screen, Image* image, bool proxy);
+Picture upload_pixels(Display* dpy, Drawable drawable, int screen, unsigned char* data, int width, int height, Pixmap* pixmap);
+void put_pixels(Display* dpy, Pixmap pixmap, int screen, unsigned char* data, int width, int height);
+void free_image_resources(Image* image);
+void measure_target(Display* dpy, RenderTarget* target);
+void resize_back_buffer(Display* dpy, RenderTarget* target);
+void open_presentation(Display* dpy, Window window);
+void close_presentation(Display* dpy);
+void present_window(Display* dpy);
+void handle_present_event(int type, void* data);
+void note_input(void);
+void clear_target(Display* dpy, RenderTarget* target, unsigned long pixel);
+void open_overview(Viewer* viewer);
+void close_overview(Viewer* viewer, bool jump);
+void draw_overview(Viewer* viewer);
+void scroll_overview(Viewer* viewer, int rows);
+void select_overview_cell(Viewer* viewer, int amount);
+int overview_cell_at(Viewer* viewer, int x, int y);
+void overview_cell_size(Viewer* viewer, int* cell_width, int* cell_height, unsigned int* rows);
+void overview_reloaded(Viewer* viewer);
+void free_overview(Viewer* viewer);
+void free_thumbnail(Overview* overview, Thumbnail* thumb);
+void render_thumbnail(Viewer* viewer, unsigned int slide_idx);
+bool slide_proxies_ready(Slide* slide);
+void queue_proxies(ProxyWorkers* workers, Slide* slide);
+void start_proxy_workers(Viewer* viewer);
+void stop_proxy_workers(ProxyWorkers* workers);
+void* proxy_worker(void* data);
+void downscale_image(Image* image);
+void handle_thumb_timer(void* data);
+void handle_proxies_done(void* data);
+void open_presenter(Viewer* viewer);
+void close_presenter(Viewer* viewer);
+void free_presenter_slides(Presenter* presenter);
+int find_presenter_monitor(Display* dpy, Window audience, int* x, int* y, int* width, int* height);
+unsigned int presenter_next_slide(Viewer* viewer);
+void sync_presenter(Viewer* viewer);
+void presenter_layout(Viewer* viewer, XRectangle* current, XRectangle* next, XRectangle* clock, XRectangle* notes);
+CachedSlide* presenter_slide(Viewer* viewer, unsigned int slide_idx);
+void render_cached_slide(Display* dpy, int screen, Drawable drawable, SlideList* list, unsigned int slide_idx,
+                         unsigned int step, CachedSlide* slot, int width, int height, XftDraw** draw);
+bool cached_slide_matches(CachedSlide* slot, SlideList* list, unsigned int slide_idx, unsigned int step);
+void free_cached_slide(CachedSlide* slot, int width, int height);
+void composite_scaled(Display* dpy, Picture src, int src_width, int src_height, Picture dst, XRectangle* rect);
+void draw_presenter(Viewer* viewer);
+void draw_presenter_clock(Viewer* viewer);
+void draw_presenter_notes(Viewer* viewer, XRectangle* rect);
+void handle_presenter_timer(void* data);
+void handle_presenter_clock(void* data);
+bool start_transition(Display* dpy, int screen, SlideList* list, unsigned int from_idx, unsigned int from_step,
+                      unsigned int to_idx, unsigned int to_step);
+void prepare_transition(Display* dpy, int screen, SlideList* list, unsigned int from_idx, unsigned int from_step,
+                        unsigned int to_idx, unsigned int to_step);
+void draw_transition_frame(Display* dpy, double progress);
+void stop_transition(void);
+void free_transition(void);
+void handle_transition_timer(void* data);
+Slide* animated_slide(Viewer* viewer);
+void sync_animations(Viewer* viewer);
+void step_animations(Display* dpy, int screen, Slide* slide, DisplayList* list, double now, bool restart,
+                     double* next_ms);
+void arm_animations(double next_ms, double now);
+void handle_animation_timer(void* data);
+Picture animation_picture(Display* dpy, Drawable drawable, int screen, Image* image);
+void free_animation_resources(Image* image);
+bool step_gif(Image* image, double now, bool restart, double* next_ms);
+bool step_sequence(Image* image, double now, bool restart, double* next_ms);
+void play_sequence(Image* image, double now);
+bool show_sequence_frame(Image* image, double now);
+void start_sequence_workers(void);
+void stop_sequence_workers(void);
+void* sequence_worker(void* data);
+bool claim_sequence_job(SequenceWorkers* workers, ImageSequence** seq_return, SequenceSlot** slot_return);
+void run_sequence_job(SequenceWorkers* workers, ImageSequence* seq, SequenceSlot* slot);
+bool item_rect(Box* box, LayoutItem* item, int width, int height, XRectangle* rect);
+LayoutItem* image_at(Slide* slide, int x, int y, Box** box_return);
+void zoom_at(Viewer* viewer, int x, int y, bool in);
+void clamp_zoom(Image* image);
+bool start_pan(int x, int y);
+void pan_zoom(int x, int y);
+void end_zoom(Display* dpy, int screen, bool redraw);
+void sync_zoom(Viewer* viewer);
+void render_zoomed_image(Display* dpy, RenderTarget* target, int screen, XRectangle* rect);
+Picture zoom_tile(Display* dpy, Drawable drawable, int screen, Image* image, unsigned int level, int x, int y);
+void free_zoom_tiles(Image* image);
+void open_control(Viewer* viewer, const char* path);
+void close_control(Viewer* viewer);
+void drop_control_client(Viewer* viewer, ControlClient* client);
+void send_control(Viewer* viewer, ControlClient* client, const char* line);
+void sync_control(Viewer* viewer);
+void format_position(Viewer* viewer, char* text);
+void run_control_command(Viewer* viewer, ControlClient* client, char* line);
+void handle_control_accept(void* data);
+void handle_control_client(void* data);
+void run_benchmark(char* filename, unsigned int iterations);
+void run_memory_report(char* filename);
+void measure_slide(Slide* slide, MemUsage* usage);
+void print_size(const char* label, size_t bytes);
+void print_stage(const char* name, double* samples, unsigned int count, bool last);
+int compare_doubles(const void* a, const void* b);
+double now_ms(void);
+void handle_x_events(void* data);
+void handle_deck_watch(void* data);
+void handle_reload_timer(void* data);
+void event_loop_init(EventLoop* loop);
+int event_loop_add(EventLoop* loop, int fd, EventSourceType type, EventHandler handler, void* data);
+void event_loop_remove(EventLoop* loop, int fd);
+int event_loop_add_timer(EventLoop* loop, EventHandler handler, void* data);
+void event_loop_arm_timer(int fd, unsigned int delay_ms, unsigned int interval_ms);
+int event_loop_add_wakeup(EventLoop* loop, EventHandler handler, void* data);
+void event_loop_wake(int fd);
+void event_loop_dispatch(EventLoop* loop, int timeout_ms);
+void event_loop_free(EventLoop* loop);
 int get_default_monitor_dimensions(Display* dpy, int* width, int* height);
 void change_slide(Display* dpy, Window window, SlideList list, unsigned int* slide_idx, int screen, int amount);
+void go_to_position(Display* dpy, Window window, SlideList list, unsigned int* slide_idx, int screen, unsigned int position, unsigned int step);
+unsigned int slide_step(SlideList* list, unsigned int slide_idx, unsigned int step);
+void open_prompt(Viewer* viewer, bool by_name, char first);
+void close_prompt(Viewer* viewer);
+void handle_prompt_key(Viewer* viewer, XKeyEvent* event);
+void update_prompt_title(Viewer* viewer);
+int find_jump_target(SlideList* list, JumpPrompt* prompt);
 void toggle_fullscreen(Display* dpy, Window window, int screen, XEvent e, bool fullscreen);
 void update_title(Display* dpy, Window window, SlideList list, unsigned int slide_idx);
 char* get_top_text(Slide slide);
-void render_slide(Slide slide, Display* dpy, Window window, int screen);
-void render_box(Box box, unsigned int window_width, unsigned int window_height, Display* dpy, Window window, int screen);
-void render_text(Text text, Display* dpy, int screen, int box_x, int box_y, int box_w, int box_h, int window_width);
-void render_image(Image image, Display* dpy, Window window, int screen, int box_x, int box_y, int box_w, int box_h);
+void render_slide(Slide slide, Display* dpy, RenderTarget* target, int screen);
+DisplayList* slide_display_list(Display* dpy, int screen, Slide* slide, RenderTarget* target, DisplayList* scratch);
+void compile_display_list(Display* dpy, int screen, Slide* slide, int width, int height, DisplayList* list);
+void add_image_ops(Slide* slide, int width, int height, DisplayList* list);
+void add_text_ops(Display* dpy, int screen, Slide* slide, int width, int height, DisplayList* list);
+DrawOp* add_draw_op(DisplayList* list, DrawOpType type);
+void union_rect(XRectangle* rect, int x, int y, int width, int height);
+void add_text_glyphs(Display* dpy, XftFont* font, const char* text, int x, int y, DisplayList* list, XRectangle* ink);
+void add_glyph_op(DisplayList* list, unsigned int first, unsigned int step, XRectangle* ink);
+void replay_display_list(DisplayList* list, Display* dpy, RenderTarget* target, int screen, unsigned int first_step,
+                         XRectangle* clip, int clip_count);
+bool replays_op(DrawOp* op, unsigned int first_step, unsigned int last_step, XRectangle* clip, int clip_count);
+unsigned long shown_hash(DisplayList* list, unsigned int step);
+void render_slide_change(Slide* from, unsigned int from_step, Slide* to, Display* dpy, RenderTarget* target, int screen);
+bool reveal_overlaps(DisplayList* list, unsigned int from_step, unsigned int to_step);
+int diff_display_lists(DisplayList* old, unsigned int old_step, DisplayList* list, unsigned int step, XRectangle* rects);
+void add_damage(XRectangle* rects, int* count, XRectangle* rect);
+bool rect_touches(XRectangle* rect, XRectangle* rects, int count);
+DisplayList* new_display_list(Arena* arena);
+void free_display_list(void* ptr);
+XftFont* text_font(Display* dpy, int screen, double size);
+void close_text_fonts(Display* dpy);
+FcChar32 utf8_char(const char* text, int len, int* char_len);
+int text_advance(Display* dpy, XftFont* font, const char* text, int len);
+void draw_utf8(XftDraw* draw, XftColor* text_color, XftFont* font, int x, int y, const char* text, int len);
+void render_image(Image* image, Display* dpy, RenderTarget* target, int screen, XRectangle* rect);
 
 void skip_templates(SlideList list, unsigned int* slide_idx);
-void apply_layout(Slide* slide, Display* dpy, Window window);
+void apply_layout(Arena* arena, Slide* slide, Display* dpy, Window window);
 void position_elements(Box* box, Display* dpy, Window window);
 float get_char_width(const char c, FontSize size, Display* dpy);
 float get_strtext_width(char* str, FontSize size, Display* dpy);
-float get_text_width(Text text, Display* dpy);
-float get_line_height(Text text, int box_height);
-float get_font_ascent(Text text, int box_height);
-void apply_word_wrap(Display* dpy, Window window, Box* box);
+float get_text_width(LayoutItem item, Display* dpy);
+float get_line_height(LayoutItem item, int box_height);
+float get_font_ascent(LayoutItem item, int box_height);
+void init_layout_items(Arena* arena, Box* box);
+void insert_layout_item(Arena* arena, Box* box, LayoutItem item, unsigned int index);
+void apply_word_wrap(Arena* arena, Display* dpy, Window window, Box* box);
 float calculate_hbox_width(Slide* slide, int* cur_count, int* row_count, unsigned int cur_index);
 float calculate_vbox_height(Display* dpy, Window window, Box* box);
-void create_slide(Slide** slide, char* name, bool visible);
-SlideElement* alloc_slide_element(ElementType type);
+void create_slide(Arena* arena, Slide** slide, char* name, bool visible);
+SlideElement* alloc_slide_element(Arena* arena, ElementType type);
 void slide_list_init(SlideList *slide_list);
 void slide_list_append(SlideList *slide_list, Slide *slide);
 
 void slide_list_free(SlideList *slide_list);
-void free_slide(Slide* slide);
-void free_box(Box* box);
-void free_text(Text* text);
-void free_image(Image* image);
-
-void add_element_to_slide(Slide* slide, SlideElement* element);
-void add_element_to_box(Box* box, SlideElement* element);
-void add_element_to_box_at_index(Box* box, SlideElement* element, unsigned int index);
-
-Slide* copy_slide(Slide* slide);
-Box* copy_box(Box* box);
-Text* copy_text(Text* text);
-Image* copy_image(Image* image);
+void retain_image(Image* image);
+void release_image(void* ptr);
+Image* find_cached_image(const char* filename, struct stat* st);
+void cache_image(Image* image);
+void prune_image_cache(void);
+
+void arena_init(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_grow(Arena* arena, void* array, size_t elem_size, unsigned int count, unsigned int* capacity);
+char* arena_string(Arena* arena, size_t len);
+char* arena_strdup(Arena* arena, const char* str);
+void arena_defer(Arena* arena, void (*fn)(void*), void* ptr);
+void arena_release(Arena* arena);
+
+void add_element_to_slide(Arena* arena, Slide* slide, SlideElement* element);
+void add_element_to_box(Arena* arena, Box* box, SlideElement* element);
+
+Slide* instantiate_slide(Arena* arena, Slide* slide);
+Box* instantiate_box(Arena* arena, Box* box);
 
 Slide* find_slide_by_name(char* name, SlideList list);
+int find_slide_position(SlideList* list, const char* name);
+void sort_slide_names(SlideList* list);
+int compare_slide_names(const void* a, const void* b);
 SlideElement* find_element_by_name(char* name, Slide* slide);
+void index_slide_element(Arena* arena, Slide* slide, SlideElement* element);
+
+unsigned long hash_bytes(unsigned long hash, const void* data, size_t len);
+unsigned long hash_name(const char* str, size_t len);
+void name_table_init(NameTable* table);
+NameEntry* name_table_slot(NameTable* table, const char* name, size_t len, unsigned long hash);
+void* name_table_get(NameTable* table, const char* name);
+bool name_table_put(Arena* arena, NameTable* table, char* name, void* value);
+char* intern(Arena* arena, NameTable* pool, const char* str, size_t len);
+
+unsigned int* ptr_map_get(PtrMap* map, const void* key);
+void ptr_map_put(Arena* arena, PtrMap* map, const void* key, unsigned int value);
+
+bool is_compiled_deck(const char* filename);
+void write_compiled_deck(const char* filename, SlideList* list);
+void load_compiled_deck(const char* filename, SlideList* list);
+uint32_t isb_checksum(uint32_t sum, const unsigned char* data, size_t len);
+uint32_t isb_string(IsbWriter* w, char* str);
+void isb_reserve_elements(IsbWriter* w, unsigned int count);
+void isb_write_slide(IsbWriter* w, Slide* slide, unsigned int index);
+unsigned int isb_write_box(IsbWriter* w, Box* box);
+void isb_error(const char* filename, const char* msg);
+void check_mapped_pixels(Image* image);
+const char* isb_get_string(const char* filename, const char* strings, const IsbHeader* header, uint32_t offset);
+void unmap_compiled_deck(void* ptr);
 
 void check_syntax(char** check_args, unsigned int check_len, char* expect, unsigned int line_num);
 bool is_number(char *str, bool* is_negative);
 bool is_string(char* str);
-char* remove_quotes(const char* str);
+char* remove_quotes(Arena* arena, const char* str);
+char* intern_quoted(SlideList* list, const char* str);
 void swap_rb_channels(unsigned char* img_data, int width, int height);
-void create_text(Text** text, char* content, FontSize font_size);
-void create_image(Image** image, char* filename);
-void create_box(Box** box, char* name, StackType stack, TextAlignmentType alignment);
-char** split_str(char* str, const char* delim, unsigned int* length_return);
+void create_text(Arena* arena, Text** text, char* content, FontSize font_size);
+void create_image(Arena* arena, Image** image, char* filename);
+Image* new_image(const char* filename, struct stat* st);
+Image* alloc_image(const char* filename, struct stat* st);
+void start_decode_workers(void);
+void end_decode_queue(void);
+void stop_decode_workers(void);
+void* decode_worker(void* data);
+Image* queue_image(const char* filename, struct stat* st);
+void wait_for_pixels(Image* image);
+void decode_queued_image(Image* image);
+unsigned char* load_pixels(const char* filename, int* width, int* height, int* channels);
+void create_image_sequence(Arena* arena, Image** image, char* pattern, unsigned int fps, unsigned int line_num);
+void sequence_filename(ImageSequence* seq, unsigned int frame, char* filename);
+void free_sequence(ImageSequence* seq);
+unsigned int zoom_level(Image* image, unsigned int level);
+void halve_level(ZoomLevel* level, ZoomLevel* next);
+void cut_zoom_tile(ZoomLevel* level, int x, int y, unsigned char* out);
+void free_zoom_pyramid(ZoomPyramid* pyramid);
+GifAnimation* load_animation(Image* image);
+void free_animation(GifAnimation* anim);
+void start_gif_decoder(GifAnimation* anim);
+void stop_gif_decoder(GifAnimation* anim);
+unsigned char* decode_gif_frame(GifAnimation* anim, unsigned char* two_back, unsigned int* delay_ms);
+bool queue_gif_frame(Image* image);
+bool rewind_animation(Image* image);
+bool advance_animation(Image* image);
+void create_box(Arena* arena, Box** box, char* name, StackType stack, TextAlignmentType alignment);
+char** split_str(Arena* arena, char* str, const char* delim, unsigned int* length_return);
 void free_split_str(char** split_str, unsigned int len);
 void trim_str(char* str);
 
 /* handler functions */
-void handle_slide(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_template(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_box(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_uses(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_text(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_image(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
-void handle_define(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_slide(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_template(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_box(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_uses(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_text(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_image(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_imageseq(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_define(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
+void handle_pause(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num);
 
 KeywordMapEntry keyword_map[] = {
         {"slide", handle_slide},
@@ -194,7 +1212,9 @@ KeywordMapEntry keyword_map[] = {
         {"uses", handle_uses},
         {"text", handle_text},
         {"image", handle_image},
+        {"imageseq", handle_imageseq},
         {"define", handle_define},
+        {"pause", handle_pause},
 };
 
 char global_font_name[] = "Serif";
@@ -204,506 +1224,5039 @@ double global_normal_font_size = 18.0f;
 double global_small_font_size = 15.0f;
 
 XftFont* global_fonts[4];
-XftDraw* draw;
+TextFonts text_fonts;
+RenderTarget window_target;
+Transition transition;
+Animations animations;
+ZoomView zoom;
+SequenceWorkers sequence_workers;
+DecodeWorkers decode_workers;
+Startup startup;
+unsigned int sequence_ahead = SEQUENCE_AHEAD;
+Presentation presentation;
 XftColor color;
 XftColor color_white;
 
+ImageCache image_cache;
+
+/* memory outside the deck arenas, see run_memory_report */
+size_t pixel_bytes;
+size_t x_resource_bytes;
+
+XResources x_resources;
+pthread_mutex_t pixel_check_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* time spent decoding images and wrapping text, read by run_benchmark */
+double bench_decode_ms;
+double bench_wrap_ms;
+jmp_buf* deck_error_jmp = NULL;
+
 
 int main(int argc, char** argv)
 {
         SlideList slide_list;
+        char* compile_path = NULL;
+        unsigned int bench_iterations = 0;
+        bool mem_report = false;
+        bool presenter = false;
+        const char* control_path = NULL;
+        Display* dpy;
+        int argi = 1;
+
+        startup.start_ms = now_ms();
+        while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+                if (strcmp(argv[argi], "--compile") == 0 && argi + 1 < argc) {
+                        compile_path = argv[argi + 1];
+                        argi += 2;
+                }
+                else if (strcmp(argv[argi], "--bench") == 0 && argi + 1 < argc && atoi(argv[argi + 1]) > 0) {
+                        bench_iterations = atoi(argv[argi + 1]);
+                        argi += 2;
+                }
+                else if (strcmp(argv[argi], "--mem-report") == 0) {
+                        mem_report = true;
+                        argi++;
+                }
+                else if (strcmp(argv[argi], "--presenter") == 0) {
+                        presenter = true;
+                        argi++;
+                }
+                else if (strcmp(argv[argi], "--transition") == 0 && argi + 1 < argc) {
+                        if (strcmp(argv[argi + 1], "crossfade") == 0)
+                                transition.type = TRANSITION_CROSSFADE;
+                        else if (strcmp(argv[argi + 1], "wipe") == 0)
+                                transition.type = TRANSITION_WIPE;
+                        else if (strcmp(argv[argi + 1], "push") == 0)
+                                transition.type = TRANSITION_PUSH;
+                        else {
+                                fprintf(stderr, "Unknown transition: %s, expected crossfade, wipe or push\n", argv[argi + 1]);
+                                exit(1);
+                        }
+                        argi += 2;
+                }
+                else if (strcmp(argv[argi], "--control") == 0 && argi + 1 < argc) {
+                        control_path = argv[argi + 1];
+                        argi += 2;
+                }
+                else if (strcmp(argv[argi], "--sequence-ahead") == 0 && argi + 1 < argc && atoi(argv[argi + 1]) > 0) {
+                        sequence_ahead = atoi(argv[argi + 1]);
+                        argi += 2;
+                }
+                else {
+                        fprintf(stderr, "Unknown option: %s\n", argv[argi]);
+                        exit(1);
+                }
+        }
 
-        if (argc < 2) {
-                fprintf(stderr, "Usage: %s <slideshow file>\n", argv[0]);
+        if (argc - argi < 1) {
+                fprintf(stderr, "Usage: %s [--compile <out.isb>] [--bench <iterations>] [--mem-report] [--presenter] [--transition <crossfade|wipe|push>] [--control <socket>] [--sequence-ahead <frames>] <slideshow file>\n", argv[0]);
                 exit(1);
         }
 
+        if (bench_iterations > 0 || mem_report) {
+                if (mem_report)
+                        run_memory_report(argv[argi]);
+                else
+                        run_benchmark(argv[argi], bench_iterations);
+                prune_image_cache();
+                arena_release(&image_cache.arena);
+                return 0;
+        }
+
         slide_list_init(&slide_list);
-        parse_slideshow(argv[1], &slide_list);
-        if (argc == 4) {
-                int width = atoi(argv[2]);
-                int height = atoi(argv[3]);
-                render_slideshow(width, height, slide_list);
+        /* the display and fonts open while the deck is parsed, and its images decode meanwhile */
+        if (!compile_path) {
+                start_opening_display();
+                start_decode_workers();
+        }
+        load_deck(argv[argi], &slide_list);
+        end_decode_queue();
+
+        if (compile_path) {
+                write_compiled_deck(compile_path, &slide_list);
+                slide_list_free(&slide_list);
+                prune_image_cache();
+                return 0;
+        }
+
+        dpy = finish_opening_display();
+        if (argc - argi == 3) {
+                int width = atoi(argv[argi + 1]);
+                int height = atoi(argv[argi + 2]);
+                render_slideshow(dpy, width, height, &slide_list, presenter, control_path);
         }
         else {
-                render_slideshow(0, 0, slide_list);
+                render_slideshow(dpy, 0, 0, &slide_list, presenter, control_path);
         }
+        stop_decode_workers();
         slide_list_free(&slide_list);
+        prune_image_cache();
+        arena_release(&image_cache.arena);
 
         return 0;
 }
 
 
-void parse_slideshow(char* filename, SlideList* list)
+double now_ms(void)
 {
-        Slide* current_slide = NULL;
-        Box* current_box = NULL;
-        FILE* file = fopen(filename, "r");
-        char line[1024];
-        int line_num = 1;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-        if (!file) {
-                fprintf(stderr, "Error opening file: %s\n", filename);
-                exit(1);
+
+int compare_doubles(const void* a, const void* b)
+{
+        double x = *(const double*)a;
+        double y = *(const double*)b;
+        return (x > y) - (x < y);
+}
+
+
+/* prints "name": {...} with nearest rank percentiles, or null if the stage didn't run */
+void print_stage(const char* name, double* samples, unsigned int count, bool last)
+{
+        double sum = 0;
+        unsigned int i;
+
+        printf("\"%s\": ", name);
+        if (!samples) {
+                printf("null%s", last ? "" : ", ");
+                return;
         }
+        qsort(samples, count, sizeof(double), compare_doubles);
+        for (i = 0; i < count; i++)
+                sum += samples[i];
+        printf("{\"median_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f, \"mean_ms\": %.3f}%s",
+               samples[count / 2], samples[(count * 90 + 99) / 100 - 1], samples[(count * 99 + 99) / 100 - 1],
+               samples[0], samples[count - 1], sum / count, last ? "" : ", ");
+}
 
-        while (fgets(line, sizeof(line), file)) {
-                unsigned int len;
-                unsigned int i;
-                char** split;
 
-                trim_str(line);
+/*
+ * Loads, lays out and renders the deck iterations times and prints the
+ * timings as one line of JSON. Parse excludes image decoding and layout
+ * excludes word wrapping, those are reported separately. Compile turns
+ * every visible slide into its display list, render is one pass
+ * replaying them and render_slide the average slide of that pass.
+ * transition_frame is one crossfade frame, composites only.
+ * Without an X display only parse and decode are measured.
+ */
+void run_benchmark(char* filename, unsigned int iterations)
+{
+        SlideList list;
+        Display* dpy;
+        double* parse_ms = malloc(iterations * sizeof(double));
+        double* decode_ms = malloc(iterations * sizeof(double));
+        double* layout_ms = NULL;
+        double* wrap_ms = NULL;
+        double* compile_ms = NULL;
+        double* render_ms = NULL;
+        double* slide_ms = NULL;
+        double* frame_ms = NULL;
+        double start;
+        unsigned int image_count = 0;
+        unsigned int visible = 0;
+        unsigned int i;
+        unsigned int j;
 
-                if (strlen(line) <= 1) {
-                        line_num ++;
-                        continue;
-                }
+        if (!parse_ms || !decode_ms) {
+                fprintf(stderr, "Error: Failed to allocate memory for benchmark.\n");
+                exit(1);
+        }
 
-                split = split_str(line, ":,", &len);
+        for (i = 0; i < iterations; i++) {
+                slide_list_init(&list);
+                bench_decode_ms = 0;
+                start = now_ms();
+                load_deck(filename, &list);
+                parse_ms[i] = now_ms() - start - bench_decode_ms;
+                decode_ms[i] = bench_decode_ms;
+                image_count = image_cache.images.count;
+                if (i + 1 < iterations) {
+                        /* empty the cache too so every pass decodes */
+                        slide_list_free(&list);
+                        prune_image_cache();
+                }
+        }
+        for (i = 0; i < list.count; i++) {
+                if (list.slides[i]->visible)
+                        visible++;
+        }
 
-                if (len < 1)
-                        goto continue_loop;
+        dpy = XOpenDisplay(NULL);
+        if (!dpy) {
+                fprintf(stderr, "No X display, only measuring parse and decode.\n");
+        }
+        else {
+                int screen = DefaultScreen(dpy);
+                Window window = XCreateSimpleWindow(dpy, RootWindow(dpy, screen), 0, 0, 960, 540, 0, 0x000000, 0xFFFFFF);
+
+                XMapWindow(dpy, window);
+                open_drawing(dpy, window, screen);
+                XSync(dpy, False);
+
+                layout_ms = malloc(iterations * sizeof(double));
+                wrap_ms = malloc(iterations * sizeof(double));
+                compile_ms = malloc(iterations * sizeof(double));
+                render_ms = malloc(iterations * sizeof(double));
+                slide_ms = malloc(iterations * sizeof(double));
+                frame_ms = malloc(iterations * sizeof(double));
+                if (!layout_ms || !wrap_ms || !compile_ms || !render_ms || !slide_ms || !frame_ms) {
+                        fprintf(stderr, "Error: Failed to allocate memory for benchmark.\n");
+                        exit(1);
+                }
 
+                for (i = 0; i < iterations; i++) {
+                        arena_release(&list.layout_arena);
+                        bench_wrap_ms = 0;
+                        start = now_ms();
+                        for (j = 0; j < list.count; j++)
+                                apply_layout(&list.layout_arena, list.slides[j], dpy, window);
+                        layout_ms[i] = now_ms() - start - bench_wrap_ms;
+                        wrap_ms[i] = bench_wrap_ms;
+                }
 
-                for (i = 0; i < sizeof(keyword_map) / sizeof(keyword_map[0]); i++) {
-                        if (strcmp(split[0], keyword_map[i].keyword) == 0) {
-                                keyword_map[i].handler(*list, &current_slide, &current_box, split, len, line_num);
-                                break;
+                measure_target(dpy, &window_target);
+                for (i = 0; i < iterations; i++) {
+                        start = now_ms();
+                        for (j = 0; j < list.count; j++) {
+                                if (list.slides[j]->visible)
+                                        compile_display_list(dpy, screen, list.slides[j], window_target.width,
+                                                             window_target.height, list.slides[j]->display);
                         }
+                        compile_ms[i] = now_ms() - start;
                 }
-                if (strstr(split[0], "end") != NULL) {
-                        if (current_box != NULL) {
-                                current_box = NULL;
-                        }
-                        else if (current_slide != NULL) {
-                                slide_list_append(list, current_slide);
-                                current_slide = NULL;
+
+                /* one pass draws every visible slide, XSync waits for the server to finish */
+                for (i = 0; i < iterations; i++) {
+                        start = now_ms();
+                        for (j = 0; j < list.count; j++) {
+                                if (list.slides[j]->visible)
+                                        render_slide(*list.slides[j], dpy, &window_target, screen);
                         }
-                        else {
-                                fprintf(stderr, "Syntax Error on line %d : Unmatched end keyword.", line_num);
-                                exit(1);
+                        XSync(dpy, False);
+                        render_ms[i] = now_ms() - start;
+                        slide_ms[i] = render_ms[i] / (visible ? visible : 1);
+                }
+
+                /* a crossfade from the first visible slide to the end slide, the costliest transition per frame */
+                transition.type = TRANSITION_CROSSFADE;
+                prepare_transition(dpy, screen, &list, list.visible_count > 0 ? list.visible[0] : list.count, STEP_ALL,
+                                   list.count, 0);
+                for (i = 0; i < iterations; i++) {
+                        start = now_ms();
+                        for (j = 0; j < TRANSITION_BENCH_FRAMES; j++) {
+                                draw_transition_frame(dpy, (double)j / (TRANSITION_BENCH_FRAMES - 1));
+                                XSync(dpy, False);
                         }
+                        frame_ms[i] = (now_ms() - start) / TRANSITION_BENCH_FRAMES;
                 }
+                free_transition();
 
-                continue_loop:
-                free_split_str(split, len);
-                line_num ++;
+                close_drawing(dpy, screen);
+                XDestroyWindow(dpy, window);
+                XCloseDisplay(dpy);
         }
 
-        fclose(file);
+        printf("{\"deck\": \"");
+        for (i = 0; filename[i]; i++) {
+                if (filename[i] == '"' || filename[i] == '\\')
+                        putchar('\\');
+                putchar(filename[i]);
+        }
+        printf("\", \"iterations\": %u, \"slides\": %u, \"visible_slides\": %u, \"images\": %u, \"stages\": {",
+               iterations, list.count, visible, image_count);
+        print_stage("parse", parse_ms, iterations, false);
+        print_stage("decode", decode_ms, iterations, false);
+        print_stage("layout", layout_ms, iterations, false);
+        print_stage("wrap", wrap_ms, iterations, false);
+        print_stage("compile", compile_ms, iterations, false);
+        print_stage("render", render_ms, iterations, false);
+        print_stage("render_slide", slide_ms, iterations, false);
+        print_stage("transition_frame", frame_ms, iterations, true);
+        printf("}}\n");
+
+        slide_list_free(&list);
+        free(parse_ms);
+        free(decode_ms);
+        free(layout_ms);
+        free(wrap_ms);
+        free(compile_ms);
+        free(render_ms);
+        free(slide_ms);
+        free(frame_ms);
 }
 
 
-void render_slideshow(int window_width, int window_height, SlideList list)
+/* adds up what a slide owns, borrowed template content belongs to the template */
+void measure_slide(Slide* slide, MemUsage* usage)
 {
-        Display* dpy;
-        Window window;
-        Atom del_window;
-        XRenderColor render_color = { 0x0000, 0x0000, 0x0000, 0xFFFF };
-        XRenderColor render_color_white = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
-        XEvent e;
-        int screen;
-        int last_width = window_width;
-        int last_height = window_height;
-        int dpy_width;
-        int dpy_height;
-        unsigned int slide_idx = 0;
         unsigned int i;
-        float scale_factor = 0.5f;
-        bool is_fullscreen = false;
-        bool running = true;
-
-        dpy = XOpenDisplay(NULL);
-        if (!dpy) {
-                fprintf(stderr, "Failed to open X display.\n");
-                exit(1);
-        }
+        unsigned int j;
 
-        screen = DefaultScreen(dpy);
+        usage->tree += sizeof(Slide) + slide->element_capacity * sizeof(SlideElement*)
+                + slide->element_index.capacity * sizeof(NameEntry);
+        for (i = 0; i < slide->element_count; i++) {
+                SlideElement* se = slide->elements[i];
+                Box* box;
 
-        /* calculate window dimensions */
-        if (window_width == 0 || window_height == 0) {
-                if (get_default_monitor_dimensions(dpy, &dpy_width, &dpy_height) != 0) {
-                        fprintf(stderr, "Couldn't find default monitor. Defaulting to 640x480.\n");
-                        dpy_width = 640;
-                        dpy_height = 480;
+                usage->tree += sizeof(SlideElement);
+                if (se->type == ELEMENT_TYPE_SLIDE) {
+                        measure_slide(se->element.slide, usage);
+                        continue;
+                }
+                box = se->element.box;
+                usage->tree += sizeof(Box);
+                usage->layout += box->item_capacity * sizeof(LayoutItem);
+                usage->tree += box->element_capacity * sizeof(SlideElement*);
+                for (j = 0; j < box->element_count; j++) {
+                        SlideElement* be = box->elements[j];
+                        if (be->type == ELEMENT_TYPE_IMAGE)
+                                usage->pixels += (size_t)be->element.image->width * be->element.image->height * 4;
+                        if (box->element_capacity == 0)
+                                continue;
+                        usage->tree += sizeof(SlideElement);
+                        if (be->type == ELEMENT_TYPE_TEXT) {
+                                usage->tree += sizeof(Text);
+                                usage->strings += strlen(be->element.text->content) + 1;
+                        }
                 }
-                window_width = dpy_width * scale_factor;
-                window_height = dpy_height * scale_factor;
         }
+}
 
-        window = XCreateSimpleWindow(dpy, RootWindow(dpy, screen),
-                                     10, 10, window_width, window_height,
-                                     1, 0x000000, 0xFFFFFF);
 
-        del_window = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
-        XSetWMProtocols(dpy, window, &del_window, 1);
+void print_size(const char* label, size_t bytes)
+{
+        printf("  %-24s %10.1f KB\n", label, bytes / 1024.0);
+}
 
-        XSelectInput(dpy, window, ExposureMask | KeyPressMask | StructureNotifyMask | ButtonPressMask);
-        XMapWindow(dpy, window);
 
-        global_fonts[FONT_TITLE] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
-                                               XFT_SIZE, XftTypeDouble, global_title_font_size, NULL);
+/*
+ * Loads, lays out and draws the deck like the viewer would and prints
+ * what it costs. Per slide numbers count what the slide owns, images are shared
+ * and show up under every slide using them but only once in the total.
+ */
+void run_memory_report(char* filename)
+{
+        SlideList list;
+        Display* dpy;
+        struct rusage usage;
+        size_t tree;
+        size_t total;
+        unsigned int i;
 
-        global_fonts[FONT_NORMAL] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
-                                                XFT_SIZE, XftTypeDouble, global_normal_font_size, NULL);
+        slide_list_init(&list);
+        load_deck(filename, &list);
 
-        global_fonts[FONT_SMALL] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
-                                               XFT_SIZE, XftTypeDouble, global_small_font_size, NULL);
+        dpy = XOpenDisplay(NULL);
+        if (!dpy) {
+                fprintf(stderr, "No X display, reporting the deck without layout.\n");
+        }
+        else {
+                int screen = DefaultScreen(dpy);
+                int width;
+                int height;
+                Window window;
+
+                if (get_default_monitor_dimensions(dpy, &width, &height) != 0) {
+                        width = 640;
+                        height = 480;
+                }
+                window = XCreateSimpleWindow(dpy, RootWindow(dpy, screen), 0, 0, width / 2, height / 2, 0, 0x000000, 0xFFFFFF);
+                open_drawing(dpy, window, screen);
+                for (i = 0; i < list.count; i++)
+                        apply_layout(&list.layout_arena, list.slides[i], dpy, window);
+                /* drawing uploads the images to the server */
+                for (i = 0; i < list.count; i++) {
+                        if (list.slides[i]->visible)
+                                render_slide(*list.slides[i], dpy, &window_target, screen);
+                }
+                XSync(dpy, False);
+        }
+        getrusage(RUSAGE_SELF, &usage);
 
-        global_fonts[FONT_HUGE] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
-                                               XFT_SIZE, XftTypeDouble, global_huge_font_size, NULL);
+        printf("%-32s %10s %10s %10s %10s\n", "slide", "tree KB", "strings KB", "layout KB", "pixels KB");
+        for (i = 0; i < list.count; i++) {
+                MemUsage slide_usage;
 
-        if (!global_fonts[FONT_NORMAL]) {
-                fprintf(stderr, "Failed to load font: %s\n", global_font_name);
-                exit(1);
+                memset(&slide_usage, 0, sizeof(slide_usage));
+                measure_slide(list.slides[i], &slide_usage);
+                printf("%-32.32s %10.1f %10.1f %10.1f %10.1f\n", list.slides[i]->name ? list.slides[i]->name : "(unnamed)",
+                       slide_usage.tree / 1024.0, slide_usage.strings / 1024.0,
+                       slide_usage.layout / 1024.0, slide_usage.pixels / 1024.0);
         }
 
-        draw = XftDrawCreate(dpy, window, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
-        XftColorAllocValue(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &render_color, &color);
-        XftColorAllocValue(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &render_color_white, &color_white);
+        tree = list.arena.used - list.arena.strings - list.notes_capacity;
+        total = list.arena.total + list.layout_arena.total + image_cache.arena.total + pixel_bytes + x_resource_bytes;
+        printf("\ntotal\n");
+        print_size("tree nodes", tree);
+        print_size("strings", list.arena.strings);
+        print_size("speaker notes", list.notes_capacity);
+        print_size("layout", list.layout_arena.used);
+        print_size("arena slack", list.arena.total + list.layout_arena.total - list.arena.used - list.layout_arena.used);
+        print_size("image cache", image_cache.arena.total);
+        print_size("pixel buffers", pixel_bytes);
+        print_size("X resources", x_resource_bytes);
+        printf("  %-24s %10u\n", "live X resources", x_resources.live);
+        print_size("all of the above", total);
+        printf("  %-24s %10.1f KB\n", dpy ? "peak RSS after layout" : "peak RSS", (double)usage.ru_maxrss);
+
+        if (dpy) {
+                close_drawing(dpy, DefaultScreen(dpy));
+                XCloseDisplay(dpy);
+        }
+        slide_list_free(&list);
+}
 
-        for (i = 0; i < list.count; i++)
-                apply_layout(list.slides[i], dpy, window);
 
-        skip_templates(list, &slide_idx);
-        update_title(dpy, window, list, slide_idx);
+void parse_slideshow(char* filename, SlideList* list)
+{
+        Slide* current_slide = NULL;
+        Box* current_box = NULL;
+        Slide* notes_slide = NULL;
+        FILE* file = fopen(filename, "r");
+        char* contents;
+        char* line;
+        long size;
+        int line_num = 1;
 
-        while (running) {
-                KeySym key;
-                XConfigureEvent xce;
+        /* read it all up front so a failed reload doesn't leave the file open */
+        if (!file || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+                fprintf(stderr, "Error opening file: %s\n", filename);
+                if (file)
+                        fclose(file);
+                deck_error();
+        }
+        rewind(file);
+        contents = arena_string(&list->arena, size);
+        size = fread(contents, 1, size, file);
+        contents[size] = '\0';
+        fclose(file);
 
-                XNextEvent(dpy, &e);
+        for (line = contents; line < contents + size; line_num++) {
+                char* next_line = strchr(line, '\n');
+                unsigned int len;
+                unsigned int i;
+                char** split;
 
-                switch (e.type) {
-                case Expose:
-                case ConfigureNotify:
-                        xce = e.xconfigure;
-                        if (xce.width == last_width && xce.height == last_height)
-                                break;
-                        last_width = xce.width;
-                        last_height = xce.height;
-                        if (slide_idx >= list.count) {
-                                render_endslide(dpy, window, screen);
-                                break;
-                        }
-                        render_slide(*list.slides[slide_idx], dpy, window, screen);
-                        break;
-                case ButtonPress:
-                        if (e.xbutton.button == Button1 || e.xbutton.button == Button4) {
-                                change_slide(dpy, window, list, &slide_idx, screen, 1);
+                if (next_line)
+                        *next_line++ = '\0';
+                else
+                        next_line = contents + size;
+
+                trim_str(line);
+
+                /* notes are kept as written up to a line holding only end */
+                if (notes_slide != NULL) {
+                        if (strcmp(line, "end") == 0) {
+                                end_notes(list, notes_slide);
+                                notes_slide = NULL;
                         }
-                        else if (e.xbutton.button == Button3 || e.xbutton.button == Button5) {
-                                change_slide(dpy, window, list, &slide_idx, screen, -1);
+                        else {
+                                append_notes(list, notes_slide, line);
                         }
-                        break;
-                case KeyPress:
-                        key = XLookupKeysym(&e.xkey, 0);
-                        if (key == XK_Right || key == XK_Return || key == XK_space) {
-                                change_slide(dpy, window, list, &slide_idx, screen, 1);
+                        line = next_line;
+                        continue;
+                }
+                if (strcmp(line, "notes:") == 0) {
+                        if (current_slide == NULL || current_box != NULL) {
+                                fprintf(stderr, "Syntax Error on line %d : notes must be inside a slide and outside define blocks.\n", line_num);
+                                deck_error();
                         }
-                        else if (key == XK_Left) {
-                                change_slide(dpy, window, list, &slide_idx, screen, -1);
+                        notes_slide = current_slide;
+                        line = next_line;
+                        continue;
+                }
+
+                if (strlen(line) <= 1) {
+                        line = next_line;
+                        continue;
+                }
+
+                split = split_str(&list->arena, line, ":,", &len);
+                line = next_line;
+
+                if (len < 1)
+                        continue;
+
+
+                for (i = 0; i < sizeof(keyword_map) / sizeof(keyword_map[0]); i++) {
+                        if (strcmp(split[0], keyword_map[i].keyword) == 0) {
+                                keyword_map[i].handler(list, &current_slide, &current_box, split, len, line_num);
+                                break;
                         }
-                        else if (key == XK_f) {
-                                is_fullscreen = !is_fullscreen;
-                                toggle_fullscreen(dpy, window, screen, e, is_fullscreen);
+                }
+                if (strstr(split[0], "end") != NULL) {
+                        if (current_box != NULL) {
+                                current_box = NULL;
                         }
-                        else if (key == XK_e) {
-                                XResizeWindow(dpy, window, window_width, window_height);
+                        else if (current_slide != NULL) {
+                                slide_list_append(list, current_slide);
+                                current_slide = NULL;
                         }
-                        else if (key == XK_Escape || key == XK_q) {
-                                running = false;
+                        else {
+                                fprintf(stderr, "Syntax Error on line %d : Unmatched end keyword.", line_num);
+                                deck_error();
                         }
-                        break;
-                case ClientMessage:
-                        running = false;
-                        break;
                 }
         }
-        XftColorFree(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &color);
-        XftColorFree(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &color_white);
-        XftDrawDestroy(draw);
+        if (notes_slide != NULL) {
+                fprintf(stderr, "Syntax Error on line %d : notes block is missing its end.\n", line_num);
+                deck_error();
+        }
+}
 
-        XftFontClose(dpy, global_fonts[FONT_TITLE]);
-        XftFontClose(dpy, global_fonts[FONT_NORMAL]);
-        XftFontClose(dpy, global_fonts[FONT_SMALL]);
-        XftFontClose(dpy, global_fonts[FONT_HUGE]);
 
-        XDestroyWindow(dpy, window);
-        XCloseDisplay(dpy);
+/* adds a line to the notes of the slide being parsed, which are always the last in the store */
+void append_notes(SlideList* list, Slide* slide, const char* line)
+{
+        unsigned int len = strlen(line);
+
+        if (slide->notes_length == 0) {
+                /* leading blank lines */
+                if (len == 0)
+                        return;
+                slide->notes_offset = list->notes_size;
+        }
+        while (list->notes_size + len + 2 > list->notes_capacity)
+                list->notes = arena_grow(&list->arena, list->notes, 1, list->notes_capacity, &list->notes_capacity);
+        if (slide->notes_length > 0) {
+                list->notes[list->notes_size++] = '\n';
+                slide->notes_length++;
+        }
+        memcpy(list->notes + list->notes_size, line, len + 1);
+        list->notes_size += len;
+        slide->notes_length += len;
 }
 
 
-int get_default_monitor_dimensions(Display* dpy, int* width, int* height)
+/* drops trailing blank lines, a later notes block in the same slide appends after them */
+void end_notes(SlideList* list, Slide* slide)
 {
-        XWindowAttributes attrs;
-        XRRScreenResources* screen_res;
-        XRROutputInfo* output_info;
-        XRRCrtcInfo* crtc_info;
-        Window root;
-        Window temp_window;
-        int i;
+        while (slide->notes_length > 0 && list->notes[list->notes_size - 1] == '\n') {
+                slide->notes_length--;
+                list->notes_size--;
+        }
+        if (list->notes)
+                list->notes[list->notes_size] = '\0';
+}
 
-        root = DefaultRootWindow(dpy);
 
-        /* create temporary window and map it.
-         * we will use the coordinates of this window to
-         * find out what monitor the window spawns on */
-        temp_window = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
-        XMapWindow(dpy, temp_window);
-        XSync(dpy, False);
+/*
+ * Errors in a deck end the program, unless a reload is in progress.
+ * Then the reload is abandoned and the previous deck stays up; the
+ * new deck's arenas are released by the caller.
+ */
+void deck_error(void)
+{
+        if (deck_error_jmp)
+                longjmp(*deck_error_jmp, 1);
+        exit(1);
+}
 
-        XGetWindowAttributes(dpy, temp_window, &attrs);
-        screen_res = XRRGetScreenResources(dpy, root);
 
-        for (i = 0; i < screen_res->noutput; i++) {
-                output_info = XRRGetOutputInfo(dpy, screen_res, screen_res->outputs[i]);
-                if (output_info->connection == RR_Connected) {
-                        crtc_info = XRRGetCrtcInfo(dpy, screen_res, output_info->crtc);
-                        if ((attrs.x >= (int)crtc_info->x
-                                && attrs.x < (int)(crtc_info->x + crtc_info->width))
-                                && (attrs.y >= (int)crtc_info->y
-                                && attrs.y < (int)(crtc_info->y + crtc_info->height))) {
+void load_deck(char* filename, SlideList* list)
+{
+        list->filename = filename;
+        if (is_compiled_deck(filename))
+                load_compiled_deck(filename, list);
+        else
+                parse_slideshow(filename, list);
+        sort_slide_names(list);
+}
 
-                                *width = crtc_info->width;
-                                *height = crtc_info->height;
-                                XRRFreeCrtcInfo(crtc_info);
-                                XRRFreeOutputInfo(output_info);
-                                XRRFreeScreenResources(screen_res);
-                                XUnmapWindow(dpy, temp_window);
-                                XDestroyWindow(dpy, temp_window);
-                                return 0;
+
+/* hashes everything that affects how a slide looks */
+unsigned long hash_slide(Slide* slide, unsigned long hash)
+{
+        unsigned int i;
+        unsigned int j;
+
+        hash = hash_bytes(hash, &slide->element_count, sizeof(slide->element_count));
+        for (i = 0; i < slide->element_count; i++) {
+                SlideElement* se = slide->elements[i];
+                Box* box;
+
+                hash = hash_bytes(hash, &se->type, sizeof(se->type));
+                if (se->type == ELEMENT_TYPE_SLIDE) {
+                        hash = hash_slide(se->element.slide, hash);
+                        continue;
+                }
+                box = se->element.box;
+                hash = hash_bytes(hash, &box->stack_type, sizeof(box->stack_type));
+                hash = hash_bytes(hash, &box->text_align, sizeof(box->text_align));
+                hash = hash_bytes(hash, &box->element_count, sizeof(box->element_count));
+                for (j = 0; j < box->element_count; j++) {
+                        SlideElement* be = box->elements[j];
+                        hash = hash_bytes(hash, &be->step, sizeof(be->step));
+                        if (be->type == ELEMENT_TYPE_TEXT) {
+                                Text* text = be->element.text;
+                                hash = hash_bytes(hash, &text->font_size, sizeof(text->font_size));
+                                hash = hash_bytes(hash, text->content, strlen(text->content) + 1);
+                        }
+                        else if (be->type == ELEMENT_TYPE_IMAGE) {
+                                /* the image cache hands out a new Image when the file changes */
+                                hash = hash_bytes(hash, &be->element.image, sizeof(Image*));
                         }
-                        XRRFreeCrtcInfo(crtc_info);
                 }
-                XRRFreeOutputInfo(output_info);
         }
-        XRRFreeScreenResources(screen_res);
-        XUnmapWindow(dpy, temp_window);
-        XDestroyWindow(dpy, temp_window);
+        return hash;
+}
 
-        return -1; /* Couldn't find a monitor */
+
+/* gives dst the layout of src, both must have the same hash_slide */
+void copy_layout(Arena* arena, Slide* dst, Slide* src)
+{
+        unsigned int i;
+        unsigned int j;
+
+        dst->display = new_display_list(arena);
+        for (i = 0; i < dst->element_count; i++) {
+                SlideElement* se = dst->elements[i];
+                Box* box;
+                Box* src_box;
+
+                if (se->type == ELEMENT_TYPE_SLIDE) {
+                        copy_layout(arena, se->element.slide, src->elements[i]->element.slide);
+                        continue;
+                }
+                box = se->element.box;
+                src_box = src->elements[i]->element.box;
+                box->x = src_box->x;
+                box->y = src_box->y;
+                box->width = src_box->width;
+                box->height = src_box->height;
+                box->item_count = src_box->item_count;
+                box->item_capacity = src_box->item_count;
+                box->items = arena_alloc(arena, (src_box->item_count + 1) * sizeof(LayoutItem));
+                memcpy(box->items, src_box->items, src_box->item_count * sizeof(LayoutItem));
+                for (j = 0; j < box->item_count; j++) {
+                        if (box->items[j].type == ELEMENT_TYPE_TEXT)
+                                box->items[j].content = arena_strdup(arena, box->items[j].content);
+                }
+        }
 }
 
-void change_slide(Display* dpy, Window window, SlideList list, unsigned int* slide_idx, int screen, int amount)
+
+/*
+ * Re-reads the deck after it changed on disk. Slides whose name and
+ * content hash match a slide of the current deck copy its layout
+ * instead of being laid out again, and images come out of the image
+ * cache unless their file changed. Returns false and keeps the current
+ * deck if the new version has errors.
+ */
+bool reload_deck(SlideList* list, Display* dpy, Window window)
 {
-        if (list.count == 0) return;
+        SlideList* new_list = malloc(sizeof(SlideList));
+        jmp_buf env;
+        volatile unsigned int relayout = 0; /* changed after setjmp */
+        unsigned int i;
 
-        if (amount < 0 && *slide_idx > 0 && list.slides[*slide_idx - 1]->visible) {
-                *slide_idx += amount;
+        if (!new_list) {
+                fprintf(stderr, "Error: Failed to allocate memory for reload.\n");
+                exit(1);
         }
-        else if (amount > 0) {
-                *slide_idx += amount;
-                if (*slide_idx >= list.count) {
-                        render_endslide(dpy, window, screen);
-                        update_title(dpy, window, list, *slide_idx);
-                        *slide_idx = list.count;
-                        return;
+        slide_list_init(new_list);
+
+        if (setjmp(env)) {
+                deck_error_jmp = NULL;
+                slide_list_free(new_list);
+                free(new_list);
+                prune_image_cache();
+                fprintf(stderr, "Reload failed, still showing the previous version of %s\n", list->filename);
+                return false;
+        }
+        deck_error_jmp = &env;
+
+        load_deck(list->filename, new_list);
+        for (i = 0; i < new_list->count; i++) {
+                Slide* slide = new_list->slides[i];
+                Slide* old_slide = find_slide_by_name(slide->name, *list);
+
+                slide->hash = hash_slide(slide, 2166136261UL);
+                if (old_slide && old_slide->hash == slide->hash) {
+                        copy_layout(&new_list->layout_arena, slide, old_slide);
+                }
+                else {
+                        apply_layout(&new_list->layout_arena, slide, dpy, window);
+                        relayout++;
                 }
         }
+        deck_error_jmp = NULL;
+
+        fprintf(stderr, "Reloaded %s: %u of %u slides changed\n", list->filename, relayout, new_list->count);
+        slide_list_free(list);
+        *list = *new_list;
+        free(new_list);
+        prune_image_cache();
+        return true;
+}
+
+
+/*
+ * Stays on the slide with the same name if the reloaded deck still has
+ * it, and only redraws when what is on screen actually changed.
+ */
+/* false when the new deck had an error and the old one stays up */
+bool reload_and_redraw(Viewer* viewer)
+{
+        Display* dpy = viewer->dpy;
+        Window window = viewer->window;
+        SlideList* list = viewer->list;
+        unsigned int* slide_idx = &viewer->slide_idx;
+        Slide* old_slide = *slide_idx < list->count ? list->slides[*slide_idx] : NULL;
+        char* name = NULL;
+        unsigned long old_hash = old_slide ? old_slide->hash : 0;
+        unsigned int old_idx = *slide_idx;
+        Slide* found;
+
+        if (old_slide && old_slide->name)
+                name = strdup(old_slide->name);
+        /* the zoomed item is in the layout about to go away */
+        end_zoom(dpy, viewer->screen, true);
+        /* workers may be reading pixels of the deck about to go away */
+        stop_proxy_workers(&viewer->overview.workers);
+        stop_decode_workers();
+        if (!reload_deck(list, dpy, window)) {
+                free(name);
+                start_proxy_workers(viewer);
+                return false;
+        }
+
+        found = name ? name_table_get(&list->position_index, name) : NULL;
+        if (found) {
+                *slide_idx = list->visible[found->position];
+        }
+        else if (*slide_idx < list->count) {
+                skip_templates(*list, slide_idx);
+        }
+        else {
+                *slide_idx = list->count;
+        }
+        free(name);
+        window_target.step = slide_step(list, *slide_idx, window_target.step);
+
+        overview_reloaded(viewer);
+        if (viewer->overview.active)
+                return true;
+        if (*slide_idx >= list->count) {
+                if (old_slide)
+                        render_endslide(dpy, &window_target, viewer->screen);
+        }
+        else if (*slide_idx != old_idx || list->slides[*slide_idx]->hash != old_hash) {
+                render_slide(*list->slides[*slide_idx], dpy, &window_target, viewer->screen);
+        }
+        update_title(dpy, window, *list, *slide_idx);
+        return true;
+}
+
+
+/* watches the deck's directory, editors often replace files by renaming */
+int watch_deck(const char* filename)
+{
+        char* dir = strdup(filename);
+        char* slash = strrchr(dir, '/');
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (slash)
+                *(slash == dir ? slash + 1 : slash) = '\0';
+        if (fd >= 0 && inotify_add_watch(fd, slash ? dir : ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+                close(fd);
+                fd = -1;
+        }
+        if (fd < 0)
+                fprintf(stderr, "Couldn't watch %s for changes, live reload is disabled.\n", filename);
+        free(dir);
+        return fd;
+}
+
+
+/* drains pending events, true if any of them were for the deck file */
+bool deck_changed(int fd, const char* filename)
+{
+        char buf[4096];
+        const char* slash = strrchr(filename, '/');
+        const char* base = slash ? slash + 1 : filename;
+        bool changed = false;
+        ssize_t len;
+
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+                char* p = buf;
+                while (p < buf + len) {
+                        struct inotify_event* event = (struct inotify_event*)p;
+                        if (event->len > 0 && strcmp(event->name, base) == 0)
+                                changed = true;
+                        p += sizeof(struct inotify_event) + event->len;
+                }
+        }
+        return changed;
+}
+
+
+/*
+ * A small epoll dispatcher. Everything the viewer waits on registers
+ * here with a handler, so timers, file watches and background work
+ * can run between input events without polling.
+ */
+void event_loop_init(EventLoop* loop)
+{
+        unsigned int i;
+
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd < 0) {
+                fprintf(stderr, "Error: Failed to create event loop.\n");
+                exit(1);
+        }
+        for (i = 0; i < EVENT_MAX_SOURCES; i++)
+                loop->sources[i].fd = -1;
+}
+
+
+/* returns fd, timers and wakeups are read by the loop before their handler runs */
+int event_loop_add(EventLoop* loop, int fd, EventSourceType type, EventHandler handler, void* data)
+{
+        struct epoll_event ev;
+        unsigned int i;
+
+        for (i = 0; i < EVENT_MAX_SOURCES; i++) {
+                if (loop->sources[i].fd < 0)
+                        break;
+        }
+        if (i == EVENT_MAX_SOURCES) {
+                fprintf(stderr, "Error: Too many event sources.\n");
+                exit(1);
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                fprintf(stderr, "Error: Failed to watch file descriptor %d.\n", fd);
+                exit(1);
+        }
+        loop->sources[i].fd = fd;
+        loop->sources[i].type = type;
+        loop->sources[i].handler = handler;
+        loop->sources[i].data = data;
+        return fd;
+}
+
+
+/* closes the fds the loop created itself, the others belong to the caller */
+void event_loop_remove(EventLoop* loop, int fd)
+{
+        unsigned int i;
+
+        for (i = 0; i < EVENT_MAX_SOURCES; i++) {
+                EventSource* source = &loop->sources[i];
+                if (source->fd != fd)
+                        continue;
+                epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                if (source->type != EVENT_SOURCE_FD)
+                        close(fd);
+                source->fd = -1;
+                return;
+        }
+}
+
+
+/* adds a disarmed timer, see event_loop_arm_timer */
+int event_loop_add_timer(EventLoop* loop, EventHandler handler, void* data)
+{
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (fd < 0) {
+                fprintf(stderr, "Error: Failed to create timer.\n");
+                exit(1);
+        }
+        return event_loop_add(loop, fd, EVENT_SOURCE_TIMER, handler, data);
+}
+
+
+/* fires after delay_ms, then every interval_ms unless it is 0. A delay of 0 disarms */
+void event_loop_arm_timer(int fd, unsigned int delay_ms, unsigned int interval_ms)
+{
+        struct itimerspec spec;
+
+        spec.it_value.tv_sec = delay_ms / 1000;
+        spec.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+        spec.it_interval.tv_sec = interval_ms / 1000;
+        spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+        timerfd_settime(fd, 0, &spec, NULL);
+}
+
+
+/* adds a source other threads can wake the loop with through event_loop_wake */
+int event_loop_add_wakeup(EventLoop* loop, EventHandler handler, void* data)
+{
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (fd < 0) {
+                fprintf(stderr, "Error: Failed to create wakeup event.\n");
+                exit(1);
+        }
+        return event_loop_add(loop, fd, EVENT_SOURCE_WAKEUP, handler, data);
+}
+
+
+void event_loop_wake(int fd)
+{
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void) written;
+}
+
+
+/* waits up to timeout_ms (-1 for ever) and runs the handlers of the ready sources */
+void event_loop_dispatch(EventLoop* loop, int timeout_ms)
+{
+        struct epoll_event events[EVENT_MAX_SOURCES];
+        int count;
+        int i;
+
+        count = epoll_wait(loop->epoll_fd, events, EVENT_MAX_SOURCES, timeout_ms);
+        for (i = 0; i < count; i++) {
+                EventSource* source = &loop->sources[events[i].data.u32];
+                uint64_t ticks;
+
+                /* an earlier handler may have removed it */
+                if (source->fd < 0)
+                        continue;
+                if (source->type != EVENT_SOURCE_FD
+                        && read(source->fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+                        continue;
+                source->handler(source->data);
+        }
+}
+
+
+void event_loop_free(EventLoop* loop)
+{
+        unsigned int i;
+
+        for (i = 0; i < EVENT_MAX_SOURCES; i++) {
+                if (loop->sources[i].fd >= 0)
+                        event_loop_remove(loop, loop->sources[i].fd);
+        }
+        close(loop->epoll_fd);
+}
+
+
+/* runs on a thread of its own when it can, see main */
+void start_opening_display(void)
+{
+        startup.threaded = pthread_create(&startup.thread, NULL, open_display, &startup) == 0;
+        if (!startup.threaded)
+                open_display(&startup);
+}
+
+
+/* fontconfig loads its caches on the first font opened, which is a good part of startup */
+void* open_display(void* data)
+{
+        Startup* start = data;
+
+        start->dpy = XOpenDisplay(NULL);
+        if (start->dpy)
+                open_fonts(start->dpy, DefaultScreen(start->dpy));
+        return NULL;
+}
+
+
+Display* finish_opening_display(void)
+{
+        if (startup.threaded)
+                pthread_join(startup.thread, NULL);
+        startup.threaded = false;
+        if (!startup.dpy) {
+                fprintf(stderr, "Failed to open X display.\n");
+                exit(1);
+        }
+        return startup.dpy;
+}
+
+
+void render_slideshow(Display* dpy, int window_width, int window_height, SlideList* list, bool presenter, const char* control_path)
+{
+        Viewer viewer;
+        Window window;
+        Atom del_window;
+        int screen;
+        int dpy_width;
+        int dpy_height;
+        unsigned int i;
+        float scale_factor = 0.5f;
+
+        screen = DefaultScreen(dpy);
+
+        /* calculate window dimensions */
+        if (window_width == 0 || window_height == 0) {
+                if (get_default_monitor_dimensions(dpy, &dpy_width, &dpy_height) != 0) {
+                        fprintf(stderr, "Couldn't find default monitor. Defaulting to 640x480.\n");
+                        dpy_width = 640;
+                        dpy_height = 480;
+                }
+                window_width = dpy_width * scale_factor;
+                window_height = dpy_height * scale_factor;
+        }
+
+        window = XCreateSimpleWindow(dpy, RootWindow(dpy, screen),
+                                     10, 10, window_width, window_height,
+                                     1, 0x000000, 0xFFFFFF);
+
+        del_window = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
+        XSetWMProtocols(dpy, window, &del_window, 1);
+
+        XSelectInput(dpy, window, ExposureMask | KeyPressMask | StructureNotifyMask | ButtonPressMask
+                     | ButtonReleaseMask | Button1MotionMask);
+        XMapWindow(dpy, window);
+
+        open_drawing(dpy, window, screen);
+        open_presentation(dpy, window);
+
+        viewer.dpy = dpy;
+        viewer.window = window;
+        viewer.screen = screen;
+        viewer.list = list;
+        viewer.slide_idx = 0;
+        viewer.window_width = window_width;
+        viewer.window_height = window_height;
+        viewer.last_width = window_width;
+        viewer.last_height = window_height;
+        viewer.is_fullscreen = false;
+        viewer.running = true;
+        viewer.reload_timer = -1;
+        memset(&viewer.overview, 0, sizeof(viewer.overview));
+        viewer.prompt.active = false;
+        viewer.presenter.open = false;
+
+        skip_templates(*list, &viewer.slide_idx);
+        window_target.step = 0;
+        update_title(dpy, window, *list, viewer.slide_idx);
+
+        /* the first slide is shown before the others are laid out, waiting only on its own images */
+        for (i = 0; i < list->count; i++)
+                list->slides[i]->hash = hash_slide(list->slides[i], 2166136261UL);
+        if (viewer.slide_idx < list->count) {
+                apply_layout(&list->layout_arena, list->slides[viewer.slide_idx], dpy, window);
+                render_slide(*list->slides[viewer.slide_idx], dpy, &window_target, screen);
+        }
+        else {
+                render_endslide(dpy, &window_target, screen);
+        }
+        show_first_frame(dpy, window);
+        for (i = 0; i < list->count; i++) {
+                if (i != viewer.slide_idx)
+                        apply_layout(&list->layout_arena, list->slides[i], dpy, window);
+        }
+
+        event_loop_init(&viewer.loop);
+        event_loop_add(&viewer.loop, ConnectionNumber(dpy), EVENT_SOURCE_FD, handle_x_events, &viewer);
+        viewer.watch_fd = watch_deck(list->filename);
+        if (viewer.watch_fd >= 0) {
+                event_loop_add(&viewer.loop, viewer.watch_fd, EVENT_SOURCE_FD, handle_deck_watch, &viewer);
+                viewer.reload_timer = event_loop_add_timer(&viewer.loop, handle_reload_timer, &viewer);
+        }
+        viewer.overview.timer = event_loop_add_timer(&viewer.loop, handle_thumb_timer, &viewer);
+        viewer.overview.workers.wakeup_fd = event_loop_add_wakeup(&viewer.loop, handle_proxies_done, &viewer);
+        pthread_mutex_init(&viewer.overview.workers.lock, NULL);
+        if (presenter)
+                open_presenter(&viewer);
+        viewer.control.fd = -1;
+        if (control_path)
+                open_control(&viewer, control_path);
+        if (transition.type != TRANSITION_NONE)
+                transition.timer = event_loop_add_timer(&viewer.loop, handle_transition_timer, &viewer);
+        animations.slide = NULL;
+        animations.timer = event_loop_add_timer(&viewer.loop, handle_animation_timer, &viewer);
+        pthread_mutex_init(&sequence_workers.lock, NULL);
+        pthread_cond_init(&sequence_workers.wake, NULL);
+
+        while (viewer.running) {
+                /* Xlib may already hold queued events the fd won't report again */
+                handle_x_events(&viewer);
+                sync_animations(&viewer);
+                sync_zoom(&viewer);
+                present_window(dpy);
+                sync_presenter(&viewer);
+                sync_control(&viewer);
+                if (viewer.running)
+                        event_loop_dispatch(&viewer.loop, -1);
+        }
+
+        end_zoom(dpy, screen, false);
+        stop_sequence_workers();
+        free(sequence_workers.playing);
+        pthread_cond_destroy(&sequence_workers.wake);
+        pthread_mutex_destroy(&sequence_workers.lock);
+        close_control(&viewer);
+        close_presenter(&viewer);
+        free_transition();
+        close_presentation(dpy);
+        free_overview(&viewer);
+        event_loop_free(&viewer.loop);
+        if (viewer.watch_fd >= 0)
+                close(viewer.watch_fd);
+
+        close_drawing(dpy, screen);
+
+        XDestroyWindow(dpy, window);
+        XCloseDisplay(dpy);
+}
+
+
+/*
+ * Presents the drawn first slide as soon as the window is exposed. Gives
+ * up after STARTUP_EXPOSE_MS, the Expose then reaches the event loop
+ * and shows it from there.
+ */
+void show_first_frame(Display* dpy, Window window)
+{
+        struct pollfd pfd;
+        double deadline = now_ms() + STARTUP_EXPOSE_MS;
+        double remaining;
+        XEvent e;
+
+        pfd.fd = ConnectionNumber(dpy);
+        pfd.events = POLLIN;
+        while (!XCheckTypedWindowEvent(dpy, window, Expose, &e)) {
+                remaining = deadline - now_ms();
+                if (remaining <= 0) {
+                        /* presenting to a window that isn't mapped yet would only hold up the next frame */
+                        window_target.damaged = false;
+                        return;
+                }
+                poll(&pfd, 1, (int)remaining + 1);
+        }
+        present_window(dpy);
+        XFlush(dpy);
+}
+
+
+/* time to first frame, counted once */
+void note_first_frame(double shown_ms)
+{
+        if (startup.first_frame_ms == 0)
+                startup.first_frame_ms = shown_ms - startup.start_ms;
+}
+
+
+void open_fonts(Display* dpy, int screen)
+{
+        global_fonts[FONT_TITLE] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
+                                               XFT_SIZE, XftTypeDouble, global_title_font_size, NULL);
+
+        global_fonts[FONT_NORMAL] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
+                                                XFT_SIZE, XftTypeDouble, global_normal_font_size, NULL);
+
+        global_fonts[FONT_SMALL] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
+                                               XFT_SIZE, XftTypeDouble, global_small_font_size, NULL);
+
+        global_fonts[FONT_HUGE] = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name,
+                                               XFT_SIZE, XftTypeDouble, global_huge_font_size, NULL);
+
+        if (!global_fonts[FONT_NORMAL]) {
+                fprintf(stderr, "Failed to load font: %s\n", global_font_name);
+                exit(1);
+        }
+}
+
+
+/* opens the fonts and colors every render function draws with */
+void open_drawing(Display* dpy, Window window, int screen)
+{
+        XRenderColor render_color = { 0x0000, 0x0000, 0x0000, 0xFFFF };
+        XRenderColor render_color_white = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
+
+        /* the slideshow opens them while the deck loads */
+        if (!global_fonts[FONT_NORMAL])
+                open_fonts(dpy, screen);
+
+        window_target.window = window;
+        window_target.use_proxies = false;
+        window_target.animate = true;
+        window_target.damaged = false;
+        window_target.step = STEP_ALL;
+        open_x_resources(dpy, window, screen);
+        window_target.draw = XftDrawCreate(dpy, window_target.drawable, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
+        XftColorAllocValue(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &render_color, &color);
+        XftColorAllocValue(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &render_color_white, &color_white);
+}
+
+
+void close_drawing(Display* dpy, int screen)
+{
+        XftDrawDestroy(window_target.draw);
+        free_x_resources();
+        XftColorFree(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &color);
+        XftColorFree(dpy, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen), &color_white);
+
+        XftFontClose(dpy, global_fonts[FONT_TITLE]);
+        XftFontClose(dpy, global_fonts[FONT_NORMAL]);
+        XftFontClose(dpy, global_fonts[FONT_SMALL]);
+        XftFontClose(dpy, global_fonts[FONT_HUGE]);
+        memset(global_fonts, 0, sizeof(global_fonts));
+        close_text_fonts(dpy);
+}
+
+
+/*
+ * Server side copies of images. Every image is uploaded once into a
+ * Pixmap with a Picture on it and scaled by XRender when drawn, the
+ * downscaled copy thumbnails use gets one of its own. They are freed
+ * with the image or by free_x_resources when the display closes,
+ * whichever comes first.
+ */
+void upload_image(Display* dpy, Drawable drawable, int screen, Image* image, bool proxy)
+{
+        bool listed = image->picture != None || image->proxy_picture != None;
+
+        if (proxy) {
+                image->proxy_picture = upload_pixels(dpy, drawable, screen, image->proxy_data,
+                                                     image->proxy_width, image->proxy_height, &image->proxy_pixmap);
+                x_resource_bytes += (size_t)image->proxy_width * image->proxy_height * 4;
+        }
+        else {
+                wait_for_pixels(image);
+                image->picture = upload_pixels(dpy, drawable, screen, image->data, image->width, image->height, &image->pixmap);
+                x_resource_bytes += (size_t)image->width * image->height * 4;
+        }
+        if (listed)
+                return;
+
+        image->prev_uploaded = NULL;
+        image->next_uploaded = x_resources.uploaded;
+        if (x_resources.uploaded)
+                x_resources.uploaded->prev_uploaded = image;
+        x_resources.uploaded = image;
+}
+
+
+Picture upload_pixels(Display* dpy, Drawable drawable, int screen, unsigned char* data, int width, int height, Pixmap* pixmap)
+{
+        Picture picture;
+
+        *pixmap = XCreatePixmap(dpy, drawable, width, height, DefaultDepth(dpy, screen));
+        put_pixels(dpy, *pixmap, screen, data, width, height);
+
+        picture = XRenderCreatePicture(dpy, *pixmap, x_resources.format, 0, NULL);
+        XRenderSetPictureFilter(dpy, picture, FilterBilinear, NULL, 0);
+        x_resources.live += 2;
+        return picture;
+}
+
+
+/* replaces the contents of a pixmap of the same size */
+void put_pixels(Display* dpy, Pixmap pixmap, int screen, unsigned char* data, int width, int height)
+{
+        XImage* ximage;
+
+        ximage = XCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen), ZPixmap, 0,
+                              (char*)data, width, height, 32, 0);
+        XPutImage(dpy, pixmap, DefaultGC(dpy, screen), ximage, 0, 0, 0, 0, width, height);
+        ximage->data = NULL;
+        XDestroyImage(ximage);
+}
+
+
+void free_image_resources(Image* image)
+{
+        if (image->picture == None && image->proxy_picture == None)
+                return;
+        if (image->picture != None) {
+                XRenderFreePicture(x_resources.dpy, image->picture);
+                XFreePixmap(x_resources.dpy, image->pixmap);
+                image->picture = None;
+                image->pixmap = None;
+                x_resources.live -= 2;
+                x_resource_bytes -= (size_t)image->width * image->height * 4;
+                /* frames and tiles are only uploaded after the image itself */
+                if (image->anim || image->sequence)
+                        free_animation_resources(image);
+                if (image->pyramid)
+                        free_zoom_tiles(image);
+        }
+        if (image->proxy_picture != None) {
+                XRenderFreePicture(x_resources.dpy, image->proxy_picture);
+                XFreePixmap(x_resources.dpy, image->proxy_pixmap);
+                image->proxy_picture = None;
+                image->proxy_pixmap = None;
+                x_resources.live -= 2;
+                x_resource_bytes -= (size_t)image->proxy_width * image->proxy_height * 4;
+        }
+
+        if (image->prev_uploaded)
+                image->prev_uploaded->next_uploaded = image->next_uploaded;
+        else
+                x_resources.uploaded = image->next_uploaded;
+        if (image->next_uploaded)
+                image->next_uploaded->prev_uploaded = image->prev_uploaded;
+}
+
+
+void open_x_resources(Display* dpy, Window window, int screen)
+{
+        x_resources.dpy = dpy;
+        x_resources.format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen));
+        x_resources.uploaded = NULL;
+        x_resources.back = None;
+        x_resources.back_picture = None;
+        x_resources.back_width = 0;
+        x_resources.back_height = 0;
+        window_target.window = window;
+        resize_back_buffer(dpy, &window_target);
+}
+
+
+void free_x_resources(void)
+{
+        while (x_resources.uploaded)
+                free_image_resources(x_resources.uploaded);
+        XRenderFreePicture(x_resources.dpy, x_resources.back_picture);
+        XFreePixmap(x_resources.dpy, x_resources.back);
+        x_resources.live -= 2;
+        x_resource_bytes -= (size_t)x_resources.back_width * x_resources.back_height * 4;
+        if (x_resources.live != 0)
+                fprintf(stderr, "Warning: %u X resources were not freed.\n", x_resources.live);
+        x_resources.dpy = NULL;
+}
+
+
+void open_presentation(Display* dpy, Window window)
+{
+        int event_base;
+        int error_base;
+        unsigned int i;
+
+        memset(&presentation, 0, sizeof(presentation));
+        presentation.use_present = XPresentQueryExtension(dpy, &presentation.opcode, &event_base, &error_base);
+        if (presentation.use_present)
+                XPresentSelectInput(dpy, window, PresentCompleteNotifyMask | PresentIdleNotifyMask);
+        else
+                fprintf(stderr, "No Present extension, frames are copied to the window without vsync.\n");
+        for (i = 0; i < PRESENT_BUFFERS; i++) {
+                presentation.buffers[i] = None;
+                presentation.idle[i] = true;
+        }
+        /* the back buffer covers the whole window, a background would only flicker */
+        XSetWindowBackgroundPixmap(dpy, window, None);
+}
+
+
+void close_presentation(Display* dpy)
+{
+        unsigned int i;
+
+        for (i = 0; i < PRESENT_BUFFERS; i++) {
+                if (presentation.buffers[i] == None)
+                        continue;
+                XFreePixmap(dpy, presentation.buffers[i]);
+                presentation.buffers[i] = None;
+                x_resources.live--;
+                x_resource_bytes -= (size_t)presentation.buffer_width * presentation.buffer_height * 4;
+        }
+}
+
+
+/* shows the back buffer if anything was drawn, called once per turn of the loop */
+void present_window(Display* dpy)
+{
+        int screen = DefaultScreen(dpy);
+        int width = x_resources.back_width;
+        int height = x_resources.back_height;
+        Pixmap buffer;
+        unsigned int i;
+
+        if (!window_target.damaged) {
+                /* the input didn't change what is on screen */
+                presentation.input_ms = 0;
+                return;
+        }
+        if (!presentation.use_present) {
+                XCopyArea(dpy, window_target.drawable, window_target.window, DefaultGC(dpy, screen), 0, 0, width, height, 0, 0);
+                window_target.damaged = false;
+                /* there is no completion event, a round trip stands in for it */
+                XSync(dpy, False);
+                presentation.presented++;
+                note_first_frame(now_ms());
+                if (presentation.input_ms > 0) {
+                        presentation.latency_ms = now_ms() - presentation.input_ms;
+                        if (presentation.latency_ms > presentation.max_latency_ms)
+                                presentation.max_latency_ms = presentation.latency_ms;
+                        presentation.input_ms = 0;
+                }
+                return;
+        }
+
+        /* a completion that never came, the window may have been unmapped */
+        if (presentation.pending && now_ms() - presentation.submitted_ms > PRESENT_TIMEOUT_MS) {
+                presentation.pending = false;
+                presentation.missed++;
+                for (i = 0; i < PRESENT_BUFFERS; i++)
+                        presentation.idle[i] = true;
+        }
+        /* shown when the frame in flight completes */
+        if (presentation.pending || !presentation.idle[presentation.next_buffer])
+                return;
+        if (width != presentation.buffer_width || height != presentation.buffer_height) {
+                close_presentation(dpy);
+                presentation.buffer_width = width;
+                presentation.buffer_height = height;
+        }
+        for (i = 0; i < PRESENT_BUFFERS; i++) {
+                if (presentation.buffers[i] != None)
+                        continue;
+                presentation.buffers[i] = XCreatePixmap(dpy, window_target.window, width, height, DefaultDepth(dpy, screen));
+                presentation.idle[i] = true;
+                x_resources.live++;
+                x_resource_bytes += (size_t)width * height * 4;
+        }
+
+        buffer = presentation.buffers[presentation.next_buffer];
+        XCopyArea(dpy, window_target.drawable, buffer, DefaultGC(dpy, screen), 0, 0, width, height, 0, 0);
+        XPresentPixmap(dpy, window_target.window, buffer, ++presentation.serial, None, None, 0, 0, None, None, None,
+                       PresentOptionNone, 0, 0, 0, NULL, 0);
+        presentation.idle[presentation.next_buffer] = false;
+        presentation.next_buffer = (presentation.next_buffer + 1) % PRESENT_BUFFERS;
+        presentation.pending = true;
+        presentation.submitted_ms = now_ms();
+        window_target.damaged = false;
+        presentation.pending_input_ms = presentation.input_ms;
+        presentation.input_ms = 0;
+
+        /* the first vblank after now, counted on from the last completion */
+        presentation.expected_msc = 0;
+        if (presentation.last_ust > 0 && presentation.refresh_us > 0) {
+                double since_us = now_ms() * 1000.0 - (double)presentation.last_ust;
+                presentation.expected_msc = presentation.last_msc + 1 + (since_us > 0 ? (uint64_t)(since_us / presentation.refresh_us) : 0);
+        }
+}
+
+
+/* ust is CLOCK_MONOTONIC in microseconds, the same clock as now_ms */
+void handle_present_event(int type, void* data)
+{
+        unsigned int i;
+
+        if (type == PresentIdleNotify) {
+                XPresentIdleNotifyEvent* idle = data;
+
+                for (i = 0; i < PRESENT_BUFFERS; i++) {
+                        if (presentation.buffers[i] == idle->pixmap)
+                                presentation.idle[i] = true;
+                }
+        }
+        else if (type == PresentCompleteNotify) {
+                XPresentCompleteNotifyEvent* complete = data;
+
+                if (complete->kind != PresentCompleteKindPixmap || complete->serial_number != presentation.serial)
+                        return;
+                presentation.pending = false;
+                presentation.presented++;
+                note_first_frame(complete->ust / 1000.0);
+                if (complete->mode == PresentCompleteModeSkip)
+                        presentation.missed++;
+                else if (presentation.expected_msc > 0 && complete->msc > presentation.expected_msc)
+                        presentation.missed += complete->msc - presentation.expected_msc;
+                if (presentation.last_ust > 0 && complete->msc > presentation.last_msc)
+                        presentation.refresh_us = (double)(complete->ust - presentation.last_ust) / (complete->msc - presentation.last_msc);
+                presentation.last_msc = complete->msc;
+                presentation.last_ust = complete->ust;
+                if (presentation.pending_input_ms > 0) {
+                        presentation.latency_ms = complete->ust / 1000.0 - presentation.pending_input_ms;
+                        if (presentation.latency_ms > presentation.max_latency_ms)
+                                presentation.max_latency_ms = presentation.latency_ms;
+                }
+        }
+}
+
+
+/* the first input since the last frame, what input to photon latency is measured from */
+void note_input(void)
+{
+        if (presentation.input_ms == 0)
+                presentation.input_ms = now_ms();
+}
+
+
+/* handles everything the X connection has for us without blocking */
+void handle_x_events(void* data)
+{
+        Viewer* viewer = data;
+        Display* dpy = viewer->dpy;
+        Window window = viewer->window;
+        int screen = viewer->screen;
+        SlideList* list = viewer->list;
+        XEvent e;
+
+        while (viewer->running && XPending(dpy)) {
+                KeySym key;
+                XConfigureEvent xce;
+
+                XNextEvent(dpy, &e);
+
+                /* keys and clicks work in either window */
+                if (e.xany.window != window && (e.type == Expose || e.type == ConfigureNotify || e.type == ClientMessage)) {
+                        if (viewer->presenter.open && e.xany.window == viewer->presenter.window) {
+                                if (e.type == ClientMessage)
+                                        close_presenter(viewer);
+                                else
+                                        viewer->presenter.dirty = true;
+                        }
+                        continue;
+                }
+
+                switch (e.type) {
+                case GenericEvent:
+                        if (presentation.use_present && e.xcookie.extension == presentation.opcode && XGetEventData(dpy, &e.xcookie)) {
+                                handle_present_event(e.xcookie.evtype, e.xcookie.data);
+                                XFreeEventData(dpy, &e.xcookie);
+                        }
+                        break;
+                case Expose:
+                case ConfigureNotify:
+                        /* the back buffer still holds the frame */
+                        if (e.type == Expose)
+                                window_target.damaged = true;
+                        xce = e.xconfigure;
+                        if (xce.width == viewer->last_width && xce.height == viewer->last_height)
+                                break;
+                        viewer->last_width = xce.width;
+                        viewer->last_height = xce.height;
+                        if (viewer->overview.active) {
+                                draw_overview(viewer);
+                                break;
+                        }
+                        if (viewer->slide_idx >= list->count) {
+                                render_endslide(dpy, &window_target, screen);
+                                break;
+                        }
+                        render_slide(*list->slides[viewer->slide_idx], dpy, &window_target, screen);
+                        break;
+                case ButtonPress:
+                        note_input();
+                        if (viewer->overview.active) {
+                                int cell = e.xbutton.window == window ? overview_cell_at(viewer, e.xbutton.x, e.xbutton.y) : -1;
+
+                                if (e.xbutton.button == Button1 && cell >= 0) {
+                                        viewer->overview.selected = cell;
+                                        close_overview(viewer, true);
+                                }
+                                else if (e.xbutton.button == Button4) {
+                                        scroll_overview(viewer, -1);
+                                }
+                                else if (e.xbutton.button == Button5) {
+                                        scroll_overview(viewer, 1);
+                                }
+                                break;
+                        }
+                        if (e.xbutton.window == window && (e.xbutton.state & ControlMask)
+                            && (e.xbutton.button == Button4 || e.xbutton.button == Button5)) {
+                                zoom_at(viewer, e.xbutton.x, e.xbutton.y, e.xbutton.button == Button4);
+                        }
+                        else if (e.xbutton.button == Button1 && e.xbutton.window == window && start_pan(e.xbutton.x, e.xbutton.y)) {
+                                break;
+                        }
+                        else if (e.xbutton.button == Button1 || e.xbutton.button == Button4) {
+                                change_slide(dpy, window, *list, &viewer->slide_idx, screen, 1);
+                        }
+                        else if (e.xbutton.button == Button3 || e.xbutton.button == Button5) {
+                                change_slide(dpy, window, *list, &viewer->slide_idx, screen, -1);
+                        }
+                        break;
+                case ButtonRelease:
+                        if (e.xbutton.button == Button1)
+                                zoom.dragging = false;
+                        break;
+                case MotionNotify:
+                        if (zoom.dragging) {
+                                note_input();
+                                pan_zoom(e.xmotion.x, e.xmotion.y);
+                        }
+                        break;
+                case KeyPress:
+                        note_input();
+                        key = XLookupKeysym(&e.xkey, 0);
+                        if (viewer->prompt.active) {
+                                handle_prompt_key(viewer, &e.xkey);
+                                break;
+                        }
+                        if (viewer->overview.active && key != XK_f && key != XK_e && key != XK_q) {
+                                if (key == XK_Right)
+                                        select_overview_cell(viewer, 1);
+                                else if (key == XK_Left)
+                                        select_overview_cell(viewer, -1);
+                                else if (key == XK_Down)
+                                        select_overview_cell(viewer, GRID_COLUMNS);
+                                else if (key == XK_Up)
+                                        select_overview_cell(viewer, -GRID_COLUMNS);
+                                else if (key == XK_Home)
+                                        select_overview_cell(viewer, -(int)viewer->overview.selected);
+                                else if (key == XK_End)
+                                        select_overview_cell(viewer, list->visible_count);
+                                else if (key == XK_Return || key == XK_space)
+                                        close_overview(viewer, true);
+                                else if (key == XK_g || key == XK_Escape)
+                                        close_overview(viewer, false);
+                                break;
+                        }
+                        if (key == XK_Right || key == XK_Return || key == XK_space) {
+                                change_slide(dpy, window, *list, &viewer->slide_idx, screen, 1);
+                        }
+                        else if (key == XK_Left) {
+                                change_slide(dpy, window, *list, &viewer->slide_idx, screen, -1);
+                        }
+                        else if (key == XK_f) {
+                                viewer->is_fullscreen = !viewer->is_fullscreen;
+                                toggle_fullscreen(dpy, window, screen, e, viewer->is_fullscreen);
+                        }
+                        else if (key == XK_e) {
+                                XResizeWindow(dpy, window, viewer->window_width, viewer->window_height);
+                        }
+                        else if (key == XK_g) {
+                                open_overview(viewer);
+                        }
+                        else if (key == XK_z) {
+                                end_zoom(dpy, screen, true);
+                        }
+                        else if (key == XK_p) {
+                                if (viewer->presenter.open)
+                                        close_presenter(viewer);
+                                else
+                                        open_presenter(viewer);
+                        }
+                        else if (key == XK_t && viewer->presenter.open) {
+                                viewer->presenter.start_ms = now_ms();
+                                draw_presenter_clock(viewer);
+                        }
+                        else if (key == XK_Home && list->visible_count > 0) {
+                                go_to_position(dpy, window, *list, &viewer->slide_idx, screen, 0, 0);
+                        }
+                        else if (key == XK_End && list->visible_count > 0) {
+                                go_to_position(dpy, window, *list, &viewer->slide_idx, screen, list->visible_count - 1, 0);
+                        }
+                        else if (key >= XK_0 && key <= XK_9) {
+                                open_prompt(viewer, false, '0' + (key - XK_0));
+                        }
+                        else if (key == XK_slash) {
+                                open_prompt(viewer, true, 0);
+                        }
+                        else if (key == XK_Escape || key == XK_q) {
+                                viewer->running = false;
+                        }
+                        break;
+                case ClientMessage:
+                        viewer->running = false;
+                        break;
+                }
+        }
+        XFlush(dpy);
+}
+
+
+/* editors save in several steps, so wait for them to settle before reloading */
+void handle_deck_watch(void* data)
+{
+        Viewer* viewer = data;
+
+        if (deck_changed(viewer->watch_fd, viewer->list->filename))
+                event_loop_arm_timer(viewer->reload_timer, RELOAD_DELAY_MS, 0);
+}
+
+
+void handle_reload_timer(void* data)
+{
+        Viewer* viewer = data;
+
+        reload_and_redraw(viewer);
+}
+
+
+/* false when there is no transition to show, the caller draws the slide itself */
+bool start_transition(Display* dpy, int screen, SlideList* list, unsigned int from_idx, unsigned int from_step,
+                      unsigned int to_idx, unsigned int to_step)
+{
+        if (transition.type == TRANSITION_NONE || from_idx == to_idx)
+                return false;
+        prepare_transition(dpy, screen, list, from_idx, from_step, to_idx, to_step);
+        transition.direction = to_idx > from_idx ? 1 : -1;
+        transition.start_ms = now_ms();
+        transition.last_frame = 0;
+        transition.running = true;
+        event_loop_arm_timer(transition.timer, TRANSITION_FRAME_MS, TRANSITION_FRAME_MS);
+        return true;
+}
+
+
+/* draws the old and new slide, the old one usually is the last transition's new one */
+void prepare_transition(Display* dpy, int screen, SlideList* list, unsigned int from_idx, unsigned int from_step,
+                        unsigned int to_idx, unsigned int to_step)
+{
+        measure_target(dpy, &window_target);
+        if (window_target.width != transition.width || window_target.height != transition.height) {
+                free_cached_slide(&transition.from, transition.width, transition.height);
+                free_cached_slide(&transition.to, transition.width, transition.height);
+                transition.width = window_target.width;
+                transition.height = window_target.height;
+        }
+        if (transition.mask == None) {
+                XRenderPictureAttributes attributes;
+
+                attributes.repeat = RepeatNormal;
+                transition.mask_pixmap = XCreatePixmap(dpy, window_target.drawable, 1, 1, 8);
+                transition.mask = XRenderCreatePicture(dpy, transition.mask_pixmap, XRenderFindStandardFormat(dpy, PictStandardA8),
+                                                       CPRepeat, &attributes);
+                x_resources.live += 2;
+        }
+
+        if (cached_slide_matches(&transition.to, list, from_idx, from_step)) {
+                CachedSlide swap = transition.from;
+                transition.from = transition.to;
+                transition.to = swap;
+        }
+        if (!cached_slide_matches(&transition.from, list, from_idx, from_step))
+                render_cached_slide(dpy, screen, window_target.drawable, list, from_idx, from_step, &transition.from,
+                                    transition.width, transition.height, &transition.draw);
+        if (!cached_slide_matches(&transition.to, list, to_idx, to_step))
+                render_cached_slide(dpy, screen, window_target.drawable, list, to_idx, to_step, &transition.to,
+                                    transition.width, transition.height, &transition.draw);
+}
+
+
+/* progress runs from 0, the old slide, to 1, the new one */
+void draw_transition_frame(Display* dpy, double progress)
+{
+        Picture dst = window_target.picture;
+        Picture from = transition.from.picture;
+        Picture to = transition.to.picture;
+        int width = transition.width;
+        int height = transition.height;
+        XRenderColor alpha = { 0, 0, 0, 0 };
+        int offset;
+
+        window_target.damaged = true;
+        window_target.shown = 0;
+        switch (transition.type) {
+        case TRANSITION_CROSSFADE:
+                alpha.alpha = progress * 0xFFFF;
+                XRenderFillRectangle(dpy, PictOpSrc, transition.mask, &alpha, 0, 0, 1, 1);
+                XRenderComposite(dpy, PictOpSrc, from, None, dst, 0, 0, 0, 0, 0, 0, width, height);
+                XRenderComposite(dpy, PictOpOver, to, transition.mask, dst, 0, 0, 0, 0, 0, 0, width, height);
+                break;
+        case TRANSITION_WIPE:
+                /* the new slide is uncovered from the side the deck is moving towards */
+                offset = progress * width;
+                if (transition.direction > 0) {
+                        XRenderComposite(dpy, PictOpSrc, to, None, dst, 0, 0, 0, 0, 0, 0, offset, height);
+                        XRenderComposite(dpy, PictOpSrc, from, None, dst, offset, 0, 0, 0, offset, 0, width - offset, height);
+                }
+                else {
+                        XRenderComposite(dpy, PictOpSrc, from, None, dst, 0, 0, 0, 0, 0, 0, width - offset, height);
+                        XRenderComposite(dpy, PictOpSrc, to, None, dst, width - offset, 0, 0, 0, width - offset, 0, offset, height);
+                }
+                break;
+        case TRANSITION_PUSH:
+                offset = progress * width * transition.direction;
+                XRenderComposite(dpy, PictOpSrc, from, None, dst, 0, 0, 0, 0, -offset, 0, width, height);
+                XRenderComposite(dpy, PictOpSrc, to, None, dst, 0, 0, 0, 0, transition.direction * width - offset, 0, width, height);
+                break;
+        case TRANSITION_NONE:
+                XRenderComposite(dpy, PictOpSrc, to, None, dst, 0, 0, 0, 0, 0, 0, width, height);
+                break;
+        }
+}
+
+
+void stop_transition(void)
+{
+        transition.running = false;
+        event_loop_arm_timer(transition.timer, 0, 0);
+}
+
+
+void free_transition(void)
+{
+        free_cached_slide(&transition.from, transition.width, transition.height);
+        free_cached_slide(&transition.to, transition.width, transition.height);
+        if (transition.mask != None) {
+                XRenderFreePicture(x_resources.dpy, transition.mask);
+                XFreePixmap(x_resources.dpy, transition.mask_pixmap);
+                transition.mask = None;
+                x_resources.live -= 2;
+        }
+        if (transition.draw)
+                XftDrawDestroy(transition.draw);
+        transition.draw = NULL;
+}
+
+
+void handle_transition_timer(void* data)
+{
+        Viewer* viewer = data;
+        Display* dpy = viewer->dpy;
+        double elapsed = now_ms() - transition.start_ms;
+        unsigned int frame = elapsed / TRANSITION_FRAME_MS;
+        double progress;
+
+        if (!transition.running)
+                return;
+        /* the grid, a reload or another jump took over the window */
+        if (viewer->overview.active || !cached_slide_matches(&transition.to, viewer->list, viewer->slide_idx, window_target.step)) {
+                stop_transition();
+                return;
+        }
+        if (elapsed >= TRANSITION_MS) {
+                draw_transition_frame(dpy, 1.0);
+                /* the last frame is the new slide just as drawing it leaves the window */
+                window_target.shown = transition.to.shown;
+                stop_transition();
+                XFlush(dpy);
+                return;
+        }
+
+        /* the last frame hasn't reached the screen, this one would only queue up behind it */
+        if (presentation.pending)
+                return;
+        if (frame > transition.last_frame + 1)
+                transition.dropped += frame - transition.last_frame - 1;
+        transition.last_frame = frame;
+        transition.frames++;
+
+        progress = elapsed / TRANSITION_MS;
+        draw_transition_frame(dpy, progress * progress * (3 - 2 * progress));
+}
+
+
+/* the slide whose animations play, NULL while the window shows something else */
+Slide* animated_slide(Viewer* viewer)
+{
+        if (viewer->slide_idx >= viewer->list->count || viewer->overview.active || transition.running)
+                return NULL;
+        return viewer->list->slides[viewer->slide_idx];
+}
+
+
+/* starts the animations of a slide that just came up, which stops the ones before it */
+void sync_animations(Viewer* viewer)
+{
+        Slide* slide = animated_slide(viewer);
+        double now = now_ms();
+        double next_ms = 0;
+
+        if (slide == animations.slide && (!slide || slide->hash == animations.hash))
+                return;
+        stop_sequence_workers();
+        animations.slide = slide;
+        animations.hash = slide ? slide->hash : 0;
+        if (slide)
+                step_animations(viewer->dpy, viewer->screen, slide, slide->display, now, true, &next_ms);
+        start_sequence_workers();
+        arm_animations(next_ms, now);
+}
+
+
+/*
+ * Moves the animated images on slide whose next frame is due on to it
+ * and redraws their rectangles in the audience window from list, the
+ * display list of the slide shown there, so whatever lies over an image
+ * stays on top of it. With restart they all start over from their first
+ * frame. next_ms is lowered to when the next frame is due.
+ */
+void step_animations(Display* dpy, int screen, Slide* slide, DisplayList* list, double now, bool restart,
+                     double* next_ms)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        step_animations(dpy, screen, slide->elements[i]->element.slide, list, now, restart, next_ms);
+                        continue;
+                }
+                if (slide->elements[i]->type != ELEMENT_TYPE_BOX)
+                        continue;
+                box = slide->elements[i]->element.box;
+
+                for (j = 0; j < box->item_count; j++) {
+                        LayoutItem* item = &box->items[j];
+                        Image* image = item->image;
+                        XRectangle rect;
+                        bool moved;
+
+                        if (item->type != ELEMENT_TYPE_IMAGE)
+                                continue;
+                        if (image->anim)
+                                moved = step_gif(image, now, restart, next_ms);
+                        else if (image->sequence)
+                                moved = step_sequence(image, now, restart, next_ms);
+                        else
+                                continue;
+
+                        if (moved && item->step <= window_target.step
+                            && item_rect(box, item, window_target.width, window_target.height, &rect)) {
+                                /* before the first draw at this size there is no list to replay */
+                                if (list && list->width == window_target.width && list->height == window_target.height
+                                    && list->fonts == text_fonts.generation) {
+                                        replay_display_list(list, dpy, &window_target, screen, 0, &rect, 1);
+                                        continue;
+                                }
+                                composite_scaled(dpy, animation_picture(dpy, window_target.drawable, screen, image),
+                                                 image->width, image->height, window_target.picture, &rect);
+                                window_target.damaged = true;
+                        }
+                }
+        }
+}
+
+
+/* true when the GIF moved on this tick, an image on the slide twice moves on once */
+bool step_gif(Image* image, double now, bool restart, double* next_ms)
+{
+        GifAnimation* anim = image->anim;
+        unsigned int delay_ms;
+
+        if (anim->stepped_ms != now && (restart || (!anim->stopped && anim->due_ms <= now))) {
+                anim->stepped_ms = now;
+                if (restart)
+                        rewind_animation(image);
+                else if (advance_animation(image))
+                        animations.frames++;
+                delay_ms = anim->frames[anim->shown].delay_ms;
+                if (restart || anim->due_ms + delay_ms <= now) {
+                        if (!restart)
+                                animations.late++;
+                        anim->due_ms = now + delay_ms;
+                }
+                else {
+                        anim->due_ms += delay_ms;
+                }
+                /* decode ahead while there is time before the next frame */
+                if (anim->streaming && !anim->stopped && anim->queued < GIF_RING_FRAMES - 1)
+                        queue_gif_frame(image);
+        }
+        if (!anim->stopped && (*next_ms == 0 || anim->due_ms < *next_ms))
+                *next_ms = anim->due_ms;
+        return anim->stepped_ms == now;
+}
+
+
+/* true when a new frame of the sequence came up this tick */
+bool step_sequence(Image* image, double now, bool restart, double* next_ms)
+{
+        ImageSequence* seq = image->sequence;
+
+        if (restart ? seq->stepped_ms != now : seq->due_ms <= now) {
+                if (restart)
+                        play_sequence(image, now);
+                else if (show_sequence_frame(image, now))
+                        seq->stepped_ms = now;
+        }
+        if (*next_ms == 0 || seq->due_ms < *next_ms)
+                *next_ms = seq->due_ms;
+        return seq->stepped_ms == now;
+}
+
+
+/* starts a sequence from its first frame, the workers decode ahead of it once they are started */
+void play_sequence(Image* image, double now)
+{
+        ImageSequence* seq = image->sequence;
+        SequenceWorkers* workers = &sequence_workers;
+        size_t frame_bytes = (size_t)image->width * image->height * 4;
+        unsigned int i;
+
+        if (!seq->slots) {
+                seq->slots = malloc(sequence_ahead * sizeof(SequenceSlot));
+                if (!seq->slots) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image sequence.\n");
+                        exit(1);
+                }
+                for (i = 0; i < sequence_ahead; i++) {
+                        seq->slots[i].data = malloc(frame_bytes);
+                        if (!seq->slots[i].data) {
+                                fprintf(stderr, "Error: Failed to allocate memory for image sequence.\n");
+                                exit(1);
+                        }
+                }
+                seq->slot_count = sequence_ahead;
+                seq->bytes = sequence_ahead * frame_bytes;
+                pixel_bytes += seq->bytes;
+        }
+        for (i = 0; i < seq->slot_count; i++)
+                seq->slots[i].state = SLOT_FREE;
+        seq->due = 0;
+        seq->next_decode = 1;
+        seq->shown = 0;
+        seq->uploaded = false;
+        seq->start_ms = now;
+        seq->due_ms = now + 1000.0 / seq->fps;
+        seq->stepped_ms = now;
+        seq->frames_shown = 1;
+        seq->dropped = 0;
+
+        if (workers->playing_count == workers->playing_capacity) {
+                workers->playing_capacity = workers->playing_capacity ? workers->playing_capacity * 2 : 4;
+                workers->playing = realloc(workers->playing, workers->playing_capacity * sizeof(Image*));
+                if (!workers->playing) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image sequence.\n");
+                        exit(1);
+                }
+        }
+        retain_image(image);
+        workers->playing[workers->playing_count++] = image;
+}
+
+
+/*
+ * Uploads the newest decoded frame that is due, skipping the ones
+ * before it, and frees the slots behind it for the workers. False
+ * when no newer frame was ready.
+ */
+bool show_sequence_frame(Image* image, double now)
+{
+        ImageSequence* seq = image->sequence;
+        SequenceWorkers* workers = &sequence_workers;
+        SequenceSlot* newest = NULL;
+        unsigned int due = (now - seq->start_ms) * seq->fps / 1000;
+        ImageSequence* job_seq;
+        SequenceSlot* job_slot;
+        unsigned int i;
+
+        /* without threads a frame is decoded right here on every tick */
+        if (workers->thread_count == 0) {
+                pthread_mutex_lock(&workers->lock);
+                seq->due = due;
+                /* the frame due now is shown right away */
+                if (seq->next_decode <= due)
+                        seq->next_decode = due;
+                if (claim_sequence_job(workers, &job_seq, &job_slot))
+                        run_sequence_job(workers, job_seq, job_slot);
+                pthread_mutex_unlock(&workers->lock);
+        }
+
+        pthread_mutex_lock(&workers->lock);
+        for (i = 0; i < seq->slot_count; i++) {
+                SequenceSlot* slot = &seq->slots[i];
+                if (slot->state == SLOT_READY && slot->frame > seq->shown && slot->frame <= due
+                        && (!newest || slot->frame > newest->frame))
+                        newest = slot;
+        }
+        pthread_mutex_unlock(&workers->lock);
+
+        /* ready slots belong to this thread, the upload doesn't hold up the workers */
+        if (newest) {
+                if (seq->picture == None) {
+                        seq->picture = upload_pixels(x_resources.dpy, window_target.drawable, DefaultScreen(x_resources.dpy),
+                                                     newest->data, image->width, image->height, &seq->pixmap);
+                        x_resource_bytes += (size_t)image->width * image->height * 4;
+                }
+                else {
+                        put_pixels(x_resources.dpy, seq->pixmap, DefaultScreen(x_resources.dpy),
+                                   newest->data, image->width, image->height);
+                }
+                seq->dropped += newest->frame - seq->shown - 1;
+                seq->shown = newest->frame;
+                seq->uploaded = true;
+                seq->frames_shown++;
+        }
+
+        pthread_mutex_lock(&workers->lock);
+        for (i = 0; i < seq->slot_count; i++) {
+                if (seq->slots[i].state == SLOT_READY && seq->slots[i].frame <= seq->shown)
+                        seq->slots[i].state = SLOT_FREE;
+        }
+        /* frames that can't be decoded in time anymore are not started */
+        seq->due = due;
+        if (seq->next_decode <= due)
+                seq->next_decode = due + 1;
+        pthread_cond_broadcast(&workers->wake);
+        pthread_mutex_unlock(&workers->lock);
+
+        seq->due_ms = seq->start_ms + (due + 1) * 1000.0 / seq->fps;
+        return newest != NULL;
+}
+
+
+/* decodes ahead for the sequences play_sequence started */
+void start_sequence_workers(void)
+{
+        SequenceWorkers* workers = &sequence_workers;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int slots = 0;
+        unsigned int i;
+
+        for (i = 0; i < workers->playing_count; i++)
+                slots += workers->playing[i]->sequence->slot_count;
+        workers->stop = false;
+        workers->turn = 0;
+        workers->thread_count = 0;
+        while (workers->thread_count < SEQUENCE_MAX_WORKERS && (long)workers->thread_count < cpus
+                && workers->thread_count < slots) {
+                if (pthread_create(&workers->threads[workers->thread_count], NULL, sequence_worker, workers) != 0)
+                        break;
+                workers->thread_count++;
+        }
+}
+
+
+/* waits for the frames being decoded and lets go of the sequences */
+void stop_sequence_workers(void)
+{
+        SequenceWorkers* workers = &sequence_workers;
+        unsigned int i;
+
+        pthread_mutex_lock(&workers->lock);
+        workers->stop = true;
+        pthread_cond_broadcast(&workers->wake);
+        pthread_mutex_unlock(&workers->lock);
+        for (i = 0; i < workers->thread_count; i++)
+                pthread_join(workers->threads[i], NULL);
+        workers->thread_count = 0;
+
+        for (i = 0; i < workers->playing_count; i++)
+                release_image(workers->playing[i]);
+        workers->playing_count = 0;
+}
+
+
+void* sequence_worker(void* data)
+{
+        SequenceWorkers* workers = data;
+        ImageSequence* seq;
+        SequenceSlot* slot;
+
+        pthread_mutex_lock(&workers->lock);
+        while (!workers->stop) {
+                if (claim_sequence_job(workers, &seq, &slot))
+                        run_sequence_job(workers, seq, slot);
+                else
+                        pthread_cond_wait(&workers->wake, &workers->lock);
+        }
+        pthread_mutex_unlock(&workers->lock);
+        return NULL;
+}
+
+
+/* takes a free slot for the next frame a sequence needs, called with the lock held */
+bool claim_sequence_job(SequenceWorkers* workers, ImageSequence** seq_return, SequenceSlot** slot_return)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < workers->playing_count; i++) {
+                ImageSequence* seq = workers->playing[(workers->turn + i) % workers->playing_count]->sequence;
+
+                /* no further ahead than the slots reach */
+                if (seq->next_decode > seq->due + seq->slot_count)
+                        continue;
+                for (j = 0; j < seq->slot_count; j++) {
+                        if (seq->slots[j].state != SLOT_FREE)
+                                continue;
+                        seq->slots[j].state = SLOT_DECODING;
+                        seq->slots[j].frame = seq->next_decode++;
+                        workers->turn = (workers->turn + i + 1) % workers->playing_count;
+                        *seq_return = seq;
+                        *slot_return = &seq->slots[j];
+                        return true;
+                }
+        }
+        return false;
+}
+
+
+/* decodes a claimed frame, called with the lock held and releasing it meanwhile. A file that can't be used is skipped */
+void run_sequence_job(SequenceWorkers* workers, ImageSequence* seq, SequenceSlot* slot)
+{
+        char filename[PATH_MAX];
+        unsigned char* data;
+        int width;
+        int height;
+        int channels;
+        bool usable;
+
+        sequence_filename(seq, seq->first + slot->frame % seq->file_count, filename);
+        pthread_mutex_unlock(&workers->lock);
+
+        data = load_pixels(filename, &width, &height, &channels);
+        /* every slot has the size of the first frame */
+        usable = data && width == seq->width && height == seq->height;
+        if (usable)
+                memcpy(slot->data, data, (size_t)width * height * 4);
+        stbi_image_free(data);
+
+        pthread_mutex_lock(&workers->lock);
+        slot->state = usable ? SLOT_READY : SLOT_FREE;
+}
+
+
+void arm_animations(double next_ms, double now)
+{
+        unsigned int delay_ms = 0;
+
+        /* rounded up so the frame is due when the timer fires, a delay of 0 would disarm it */
+        if (next_ms > 0)
+                delay_ms = next_ms > now ? (unsigned int)(next_ms - now) + 1 : 1;
+        event_loop_arm_timer(animations.timer, delay_ms, 0);
+}
+
+
+void handle_animation_timer(void* data)
+{
+        Viewer* viewer = data;
+        Slide* slide = animated_slide(viewer);
+        double now = now_ms();
+        double next_ms = 0;
+
+        /* the slide changed since the timer was armed, sync_animations starts the new one */
+        if (!slide || slide != animations.slide || slide->hash != animations.hash)
+                return;
+        step_animations(viewer->dpy, viewer->screen, slide, slide->display, now, false, &next_ms);
+        arm_animations(next_ms, now);
+}
+
+
+/* decodes the frame after the queued ones into the ring and uploads it, going back to the start after the last */
+bool queue_gif_frame(Image* image)
+{
+        GifAnimation* anim = image->anim;
+        Display* dpy = x_resources.dpy;
+        int screen = DefaultScreen(dpy);
+        size_t frame_bytes = (size_t)image->width * image->height * 4;
+        GifFrame* frame = &anim->frames[(anim->shown + anim->queued + 1) % GIF_RING_FRAMES];
+        unsigned char* two_back = NULL;
+        unsigned char* pixels;
+        unsigned int delay_ms;
+
+        if (anim->loop_frames >= 2)
+                two_back = anim->frames[(anim->shown + anim->queued + GIF_RING_FRAMES - 1) % GIF_RING_FRAMES].data;
+        pixels = decode_gif_frame(anim, two_back, &delay_ms);
+        if (!pixels && anim->loop_frames > 0) {
+                start_gif_decoder(anim);
+                pixels = decode_gif_frame(anim, NULL, &delay_ms);
+        }
+        if (!pixels) {
+                fprintf(stderr, "Failed to decode animation: %s\n", image->filename);
+                anim->stopped = true;
+                return false;
+        }
+        memcpy(frame->data, pixels, frame_bytes);
+        memcpy(anim->scratch, pixels, frame_bytes);
+        swap_rb_channels(anim->scratch, image->width, image->height);
+        frame->delay_ms = delay_ms;
+
+        if (image->picture == None)
+                upload_image(dpy, window_target.drawable, screen, image, false);
+        if (frame->picture == None) {
+                frame->picture = upload_pixels(dpy, window_target.drawable, screen, anim->scratch,
+                                               image->width, image->height, &frame->pixmap);
+                x_resource_bytes += frame_bytes;
+        }
+        else {
+                put_pixels(dpy, frame->pixmap, screen, anim->scratch, image->width, image->height);
+        }
+        anim->queued++;
+        return true;
+}
+
+
+bool rewind_animation(Image* image)
+{
+        GifAnimation* anim = image->anim;
+
+        if (!anim->streaming) {
+                anim->shown = 0;
+                return true;
+        }
+        start_gif_decoder(anim);
+        anim->stopped = false;
+        anim->shown = GIF_RING_FRAMES - 1;
+        anim->queued = 0;
+        return advance_animation(image);
+}
+
+
+bool advance_animation(Image* image)
+{
+        GifAnimation* anim = image->anim;
+
+        if (!anim->streaming) {
+                anim->shown = (anim->shown + 1) % anim->frame_count;
+                return true;
+        }
+        if (anim->queued == 0 && !queue_gif_frame(image))
+                return false;
+        anim->shown = (anim->shown + 1) % GIF_RING_FRAMES;
+        anim->queued--;
+        return true;
+}
+
+
+/* listens on a unix socket at path, replacing a socket left behind by an earlier run */
+void open_control(Viewer* viewer, const char* path)
+{
+        ControlServer* control = &viewer->control;
+        struct sockaddr_un addr;
+        struct stat st;
+        unsigned int i;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+                fprintf(stderr, "Error: Control socket path is too long: %s\n", path);
+                exit(1);
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+                unlink(path);
+
+        control->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (control->fd < 0 || bind(control->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+                || listen(control->fd, CONTROL_MAX_CLIENTS) != 0) {
+                fprintf(stderr, "Error: Couldn't listen on control socket %s: %s\n", path, strerror(errno));
+                exit(1);
+        }
+        control->path = path;
+        control->shown_idx = viewer->slide_idx;
+        for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+                control->clients[i].fd = -1;
+                control->clients[i].viewer = viewer;
+        }
+        event_loop_add(&viewer->loop, control->fd, EVENT_SOURCE_FD, handle_control_accept, viewer);
+}
+
+
+void close_control(Viewer* viewer)
+{
+        ControlServer* control = &viewer->control;
+        unsigned int i;
+
+        if (control->fd < 0)
+                return;
+        for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+                if (control->clients[i].fd >= 0)
+                        drop_control_client(viewer, &control->clients[i]);
+        }
+        event_loop_remove(&viewer->loop, control->fd);
+        close(control->fd);
+        unlink(control->path);
+        control->fd = -1;
+}
+
+
+void drop_control_client(Viewer* viewer, ControlClient* client)
+{
+        event_loop_remove(&viewer->loop, client->fd);
+        close(client->fd);
+        client->fd = -1;
+}
+
+
+/* replies are short, a client too slow to take one is dropped rather than waited for */
+void send_control(Viewer* viewer, ControlClient* client, const char* line)
+{
+        size_t len = strlen(line);
+
+        if (send(client->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len)
+                drop_control_client(viewer, client);
+}
+
+
+/* tells every client about a slide change, called once per turn of the loop */
+void sync_control(Viewer* viewer)
+{
+        ControlServer* control = &viewer->control;
+        char line[64];
+        unsigned int i;
+
+        if (control->fd < 0 || control->shown_idx == viewer->slide_idx)
+                return;
+        control->shown_idx = viewer->slide_idx;
+        strcpy(line, "slide ");
+        format_position(viewer, line + strlen(line));
+        strcat(line, "\n");
+        for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+                if (control->clients[i].fd >= 0)
+                        send_control(viewer, &control->clients[i], line);
+        }
+}
+
+
+/* the slide number as shown to the audience, or end */
+void format_position(Viewer* viewer, char* text)
+{
+        if (viewer->slide_idx < viewer->list->count)
+                sprintf(text, "%u", viewer->list->slides[viewer->slide_idx]->position + 1);
+        else
+                strcpy(text, "end");
+}
+
+
+void run_control_command(Viewer* viewer, ControlClient* client, char* line)
+{
+        SlideList* list = viewer->list;
+        char reply[768];
+
+        strcpy(reply, "ok\n");
+        note_input();
+        /* commands take over from the grid and the prompt like keys would */
+        if (strcmp(line, "next") == 0 || strcmp(line, "prev") == 0 || strncmp(line, "goto ", 5) == 0) {
+                int position = 0;
+
+                if (line[0] == 'g') {
+                        JumpPrompt target;
+                        char* arg = line + 5;
+                        char* c;
+
+                        target.by_name = false;
+                        for (c = arg; *c; c++) {
+                                if (!isdigit((unsigned char)*c))
+                                        target.by_name = true;
+                        }
+                        strncpy(target.text, arg, sizeof(target.text) - 1);
+                        target.text[sizeof(target.text) - 1] = '\0';
+                        target.len = strlen(target.text);
+                        position = find_jump_target(list, &target);
+                        if (position < 0) {
+                                send_control(viewer, client, "error no such slide\n");
+                                return;
+                        }
+                }
+                if (viewer->overview.active)
+                        close_overview(viewer, false);
+                if (viewer->prompt.active)
+                        close_prompt(viewer);
+                if (strcmp(line, "next") == 0)
+                        change_slide(viewer->dpy, viewer->window, *list, &viewer->slide_idx, viewer->screen, 1);
+                else if (strcmp(line, "prev") == 0)
+                        change_slide(viewer->dpy, viewer->window, *list, &viewer->slide_idx, viewer->screen, -1);
+                else
+                        go_to_position(viewer->dpy, viewer->window, *list, &viewer->slide_idx, viewer->screen, position, 0);
+                /* the slide is on its way to the server before the client hears back */
+                XFlush(viewer->dpy);
+        }
+        else if (strcmp(line, "reload") == 0) {
+                if (!reload_and_redraw(viewer))
+                        strcpy(reply, "error reload failed, the previous deck stays up\n");
+                XFlush(viewer->dpy);
+        }
+        else if (strcmp(line, "stats") == 0) {
+                SequenceWorkers* workers = &sequence_workers;
+                char position[16];
+                double now = now_ms();
+                double sequence_ms = 0;
+                unsigned int sequence_frames = 0;
+                unsigned int sequence_dropped = 0;
+                unsigned int i;
+
+                /* per sequence on average, over the sequences on screen */
+                for (i = 0; i < workers->playing_count; i++) {
+                        ImageSequence* seq = workers->playing[i]->sequence;
+                        sequence_frames += seq->frames_shown;
+                        sequence_dropped += seq->dropped;
+                        sequence_ms += now - seq->start_ms;
+                }
+                format_position(viewer, position);
+                sprintf(reply, "stats slide=%s slides=%u decode_ms=%.3f wrap_ms=%.3f deck_bytes=%lu layout_bytes=%lu"
+                        " pixel_bytes=%lu x_resource_bytes=%lu x_resources=%u transition_frames=%u transition_dropped=%u"
+                        " present=%s frames_presented=%u frames_missed=%u latency_ms=%.3f max_latency_ms=%.3f"
+                        " animation_frames=%u animation_late=%u sequence_fps=%.2f sequence_dropped=%u first_frame_ms=%.3f\n",
+                        position, list->visible_count, bench_decode_ms, bench_wrap_ms,
+                        (unsigned long)list->arena.total, (unsigned long)list->layout_arena.total,
+                        (unsigned long)pixel_bytes, (unsigned long)x_resource_bytes, x_resources.live,
+                        transition.frames, transition.dropped,
+                        presentation.use_present ? "vsync" : "copy", presentation.presented, presentation.missed,
+                        presentation.latency_ms, presentation.max_latency_ms,
+                        animations.frames, animations.late,
+                        sequence_ms > 0 ? sequence_frames * 1000.0 / sequence_ms : 0.0, sequence_dropped,
+                        startup.first_frame_ms);
+        }
+        else {
+                strcpy(reply, "error unknown command\n");
+        }
+        send_control(viewer, client, reply);
+}
+
+
+void handle_control_accept(void* data)
+{
+        Viewer* viewer = data;
+        ControlServer* control = &viewer->control;
+        int fd;
+
+        while ((fd = accept4(control->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                ControlClient* client = NULL;
+                unsigned int i;
+
+                for (i = 0; i < CONTROL_MAX_CLIENTS && !client; i++) {
+                        if (control->clients[i].fd < 0)
+                                client = &control->clients[i];
+                }
+                if (!client) {
+                        static const char busy[] = "error too many clients\n";
+                        ssize_t sent = send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                        (void) sent;
+                        close(fd);
+                        continue;
+                }
+                client->fd = fd;
+                client->len = 0;
+                event_loop_add(&viewer->loop, fd, EVENT_SOURCE_FD, handle_control_client, client);
+        }
+}
+
+
+/* runs every complete line the client has sent, a partial one waits for the rest */
+void handle_control_client(void* data)
+{
+        ControlClient* client = data;
+        Viewer* viewer = client->viewer;
+        char* start;
+        char* newline;
+        ssize_t len;
+
+        len = read(client->fd, client->line + client->len, sizeof(client->line) - client->len);
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+                return;
+        if (len <= 0) {
+                drop_control_client(viewer, client);
+                return;
+        }
+        client->len += len;
+
+        start = client->line;
+        while ((newline = memchr(start, '\n', client->line + client->len - start)) != NULL) {
+                *newline = '\0';
+                if (newline > start && newline[-1] == '\r')
+                        newline[-1] = '\0';
+                if (*start)
+                        run_control_command(viewer, client, start);
+                if (client->fd < 0)
+                        return;
+                start = newline + 1;
+        }
+        client->len -= start - client->line;
+        memmove(client->line, start, client->len);
+        if (client->len == sizeof(client->line)) {
+                send_control(viewer, client, "error line too long\n");
+                if (client->fd >= 0)
+                        drop_control_client(viewer, client);
+        }
+}
+
+
+/* shows every visible slide as a thumbnail, they stream in as they are drawn */
+void open_overview(Viewer* viewer)
+{
+        Overview* overview = &viewer->overview;
+
+        if (!overview->thumbs) {
+                overview->thumb_count = viewer->list->count;
+                overview->thumbs = calloc(overview->thumb_count ? overview->thumb_count : 1, sizeof(Thumbnail));
+                if (!overview->thumbs) {
+                        fprintf(stderr, "Error: Failed to allocate memory for thumbnails.\n");
+                        exit(1);
+                }
+        }
+        if (overview->thumb_width == 0) {
+                measure_target(viewer->dpy, &window_target);
+                overview->thumb_width = THUMB_WIDTH;
+                overview->thumb_height = THUMB_WIDTH * window_target.height / (window_target.width > 0 ? window_target.width : 1);
+                if (overview->thumb_height < 1)
+                        overview->thumb_height = 1;
+        }
+
+        if (viewer->slide_idx < viewer->list->count)
+                overview->selected = viewer->list->slides[viewer->slide_idx]->position;
+        else
+                overview->selected = viewer->list->visible_count > 0 ? viewer->list->visible_count - 1 : 0;
+        overview->active = true;
+        start_proxy_workers(viewer);
+        select_overview_cell(viewer, 0);
+        XStoreName(viewer->dpy, viewer->window, "Overview");
+}
+
+
+void close_overview(Viewer* viewer, bool jump)
+{
+        SlideList* list = viewer->list;
+        Overview* overview = &viewer->overview;
+
+        overview->active = false;
+        if (jump && list->visible_count > 0) {
+                viewer->slide_idx = list->visible[overview->selected];
+                window_target.step = 0;
+        }
+        if (viewer->slide_idx >= list->count)
+                render_endslide(viewer->dpy, &window_target, viewer->screen);
+        else
+                render_slide(*list->slides[viewer->slide_idx], viewer->dpy, &window_target, viewer->screen);
+        update_title(viewer->dpy, viewer->window, *list, viewer->slide_idx);
+}
+
+
+/* cells are as wide as the window allows and keep the thumbnails' aspect ratio */
+void overview_cell_size(Viewer* viewer, int* cell_width, int* cell_height, unsigned int* rows)
+{
+        Overview* overview = &viewer->overview;
+        int thumb_width;
+
+        measure_target(viewer->dpy, &window_target);
+        *cell_width = window_target.width / GRID_COLUMNS;
+        thumb_width = *cell_width - 2 * GRID_MARGIN;
+        if (thumb_width < 1)
+                thumb_width = 1;
+        *cell_height = thumb_width * overview->thumb_height / overview->thumb_width
+                + 2 * GRID_MARGIN + global_fonts[FONT_SMALL]->height;
+        *rows = window_target.height / *cell_height;
+        if (*rows < 1)
+                *rows = 1;
+}
+
+
+void draw_overview(Viewer* viewer)
+{
+        Display* dpy = viewer->dpy;
+        SlideList* list = viewer->list;
+        Overview* overview = &viewer->overview;
+        XftFont* font = global_fonts[FONT_SMALL];
+        XRenderColor placeholder = { 0x8080, 0x8080, 0x8080, 0xFFFF };
+        XRenderColor highlight = { 0xFFFF, 0xC000, 0x0000, 0xFFFF };
+        int cell_width;
+        int cell_height;
+        int width;
+        int height;
+        unsigned int rows;
+        unsigned int i;
+
+        overview_cell_size(viewer, &cell_width, &cell_height, &rows);
+        width = cell_width - 2 * GRID_MARGIN;
+        height = cell_height - 2 * GRID_MARGIN - font->height;
+        clear_target(dpy, &window_target, 0x303030);
+        if (width < 1 || height < 1)
+                return;
+
+        /* the row cut off at the bottom is drawn as well */
+        for (i = overview->first_row * GRID_COLUMNS; i < list->visible_count && i < (overview->first_row + rows + 1) * GRID_COLUMNS; i++) {
+                Thumbnail* thumb = &overview->thumbs[list->visible[i]];
+                int x = (i % GRID_COLUMNS) * cell_width + GRID_MARGIN;
+                int y = (i / GRID_COLUMNS - overview->first_row) * cell_height + GRID_MARGIN;
+                char label[16];
+
+                if (i == overview->selected)
+                        XRenderFillRectangle(dpy, PictOpSrc, window_target.picture, &highlight, x - 4, y - 4, width + 8, height + 8);
+                if (thumb->valid) {
+                        XTransform scale;
+
+                        memset(&scale, 0, sizeof(scale));
+                        scale.matrix[0][0] = XDoubleToFixed((double)overview->thumb_width / width);
+                        scale.matrix[1][1] = XDoubleToFixed((double)overview->thumb_height / height);
+                        scale.matrix[2][2] = XDoubleToFixed(1.0);
+                        XRenderSetPictureTransform(dpy, thumb->picture, &scale);
+                        XRenderComposite(dpy, PictOpSrc, thumb->picture, None, window_target.picture,
+                                         0, 0, 0, 0, x, y, width, height);
+                }
+                else {
+                        XRenderFillRectangle(dpy, PictOpSrc, window_target.picture, &placeholder, x, y, width, height);
+                }
+                sprintf(label, "%u", i + 1);
+                XftDrawString8(window_target.draw, &color_white, font, x, y + height + 4 + font->ascent,
+                               (XftChar8 *)label, strlen(label));
+        }
+}
+
+
+void scroll_overview(Viewer* viewer, int rows)
+{
+        Overview* overview = &viewer->overview;
+        unsigned int total_rows = (viewer->list->visible_count + GRID_COLUMNS - 1) / GRID_COLUMNS;
+        unsigned int visible_rows;
+        int cell_width;
+        int cell_height;
+        int first_row = (int)overview->first_row + rows;
+
+        overview_cell_size(viewer, &cell_width, &cell_height, &visible_rows);
+        if (first_row > (int)total_rows - (int)visible_rows)
+                first_row = (int)total_rows - (int)visible_rows;
+        if (first_row < 0)
+                first_row = 0;
+        overview->first_row = first_row;
+        draw_overview(viewer);
+        event_loop_arm_timer(overview->timer, 1, 0);
+}
+
+
+/* moves the selection by amount cells and scrolls it into view */
+void select_overview_cell(Viewer* viewer, int amount)
+{
+        Overview* overview = &viewer->overview;
+        int cell = (int)overview->selected + amount;
+        int cell_width;
+        int cell_height;
+        unsigned int rows;
+        unsigned int row;
+
+        if (cell >= (int)viewer->list->visible_count)
+                cell = (int)viewer->list->visible_count - 1;
+        if (cell < 0)
+                cell = 0;
+        overview->selected = cell;
+
+        overview_cell_size(viewer, &cell_width, &cell_height, &rows);
+        row = overview->selected / GRID_COLUMNS;
+        if (row < overview->first_row)
+                overview->first_row = row;
+        else if (row >= overview->first_row + rows)
+                overview->first_row = row - rows + 1;
+        draw_overview(viewer);
+        event_loop_arm_timer(overview->timer, 1, 0);
+}
+
+
+/* the cell under a window position or -1 */
+int overview_cell_at(Viewer* viewer, int x, int y)
+{
+        Overview* overview = &viewer->overview;
+        int cell_width;
+        int cell_height;
+        unsigned int rows;
+        unsigned int cell;
+
+        overview_cell_size(viewer, &cell_width, &cell_height, &rows);
+        if (x < 0 || y < 0 || cell_width <= 0 || x / cell_width >= GRID_COLUMNS)
+                return -1;
+        cell = (overview->first_row + y / cell_height) * GRID_COLUMNS + x / cell_width;
+        return cell < viewer->list->visible_count ? (int)cell : -1;
+}
+
+
+/*
+ * Thumbnails follow their slide by hash across a reload, unchanged
+ * slides keep theirs and the pixmaps of the others are reused.
+ */
+void overview_reloaded(Viewer* viewer)
+{
+        SlideList* list = viewer->list;
+        Overview* overview = &viewer->overview;
+        Thumbnail* old = overview->thumbs;
+        unsigned int old_count = overview->thumb_count;
+        unsigned int i;
+        unsigned int j;
+
+        if (!overview->thumbs)
+                return;
+        overview->thumb_count = list->count;
+        overview->thumbs = calloc(list->count ? list->count : 1, sizeof(Thumbnail));
+        if (!overview->thumbs) {
+                fprintf(stderr, "Error: Failed to allocate memory for thumbnails.\n");
+                exit(1);
+        }
+        for (i = 0; i < old_count; i++) {
+                if (!old[i].valid)
+                        continue;
+                for (j = 0; j < list->count; j++) {
+                        if (overview->thumbs[j].picture == None && list->slides[j]->visible && list->slides[j]->hash == old[i].hash)
+                                break;
+                }
+                if (j < list->count) {
+                        overview->thumbs[j] = old[i];
+                        old[i].picture = None;
+                }
+        }
+        for (i = 0, j = 0; i < old_count; i++) {
+                if (old[i].picture == None)
+                        continue;
+                while (j < list->count && (overview->thumbs[j].picture != None || !list->slides[j]->visible))
+                        j++;
+                if (j < list->count) {
+                        overview->thumbs[j] = old[i];
+                        overview->thumbs[j].valid = false;
+                }
+                else {
+                        free_thumbnail(overview, &old[i]);
+                }
+        }
+        free(old);
+
+        if (overview->selected >= list->visible_count)
+                overview->selected = list->visible_count > 0 ? list->visible_count - 1 : 0;
+        start_proxy_workers(viewer);
+        if (overview->active)
+                select_overview_cell(viewer, 0);
+}
+
+
+void free_thumbnail(Overview* overview, Thumbnail* thumb)
+{
+        if (thumb->picture == None)
+                return;
+        XRenderFreePicture(x_resources.dpy, thumb->picture);
+        XFreePixmap(x_resources.dpy, thumb->pixmap);
+        thumb->picture = None;
+        thumb->pixmap = None;
+        thumb->valid = false;
+        x_resources.live -= 2;
+        x_resource_bytes -= (size_t)overview->thumb_width * overview->thumb_height * 4;
+}
+
+
+void free_overview(Viewer* viewer)
+{
+        Overview* overview = &viewer->overview;
+        unsigned int i;
+
+        stop_proxy_workers(&overview->workers);
+        pthread_mutex_destroy(&overview->workers.lock);
+        if (overview->draw)
+                XftDrawDestroy(overview->draw);
+        for (i = 0; i < overview->thumb_count; i++)
+                free_thumbnail(overview, &overview->thumbs[i]);
+        free(overview->thumbs);
+}
+
+
+/* thumbnails are drawn by the normal renderer at thumbnail size */
+void render_thumbnail(Viewer* viewer, unsigned int slide_idx)
+{
+        Display* dpy = viewer->dpy;
+        int screen = viewer->screen;
+        Overview* overview = &viewer->overview;
+        Thumbnail* thumb = &overview->thumbs[slide_idx];
+        RenderTarget target;
+
+        if (thumb->picture == None) {
+                thumb->pixmap = XCreatePixmap(dpy, viewer->window, overview->thumb_width, overview->thumb_height, DefaultDepth(dpy, screen));
+                thumb->picture = XRenderCreatePicture(dpy, thumb->pixmap, x_resources.format, 0, NULL);
+                XRenderSetPictureFilter(dpy, thumb->picture, FilterBilinear, NULL, 0);
+                x_resources.live += 2;
+                x_resource_bytes += (size_t)overview->thumb_width * overview->thumb_height * 4;
+        }
+        if (overview->draw)
+                XftDrawChange(overview->draw, thumb->pixmap);
+        else
+                overview->draw = XftDrawCreate(dpy, thumb->pixmap, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
+
+        target.window = None;
+        target.drawable = thumb->pixmap;
+        target.draw = overview->draw;
+        target.picture = thumb->picture;
+        target.width = overview->thumb_width;
+        target.height = overview->thumb_height;
+        target.use_proxies = true;
+        target.animate = false;
+        target.step = STEP_ALL;
+        render_slide(*viewer->list->slides[slide_idx], dpy, &target, screen);
+        thumb->hash = viewer->list->slides[slide_idx]->hash;
+        thumb->valid = true;
+}
+
+
+/*
+ * Draws thumbnails for a few milliseconds at a time so input stays
+ * responsive, cells in view first. Slides wait until their images
+ * have been downscaled.
+ */
+void handle_thumb_timer(void* data)
+{
+        Viewer* viewer = data;
+        SlideList* list = viewer->list;
+        Overview* overview = &viewer->overview;
+        double start = now_ms();
+        int cell_width;
+        int cell_height;
+        unsigned int rows;
+        unsigned int first;
+        unsigned int n;
+        bool in_view = false;
+
+        if (!overview->active || list->visible_count == 0)
+                return;
+        overview_cell_size(viewer, &cell_width, &cell_height, &rows);
+        first = overview->first_row * GRID_COLUMNS;
+
+        for (n = 0; n < list->visible_count; n++) {
+                unsigned int cell = (first + n) % list->visible_count;
+                Slide* slide = list->slides[list->visible[cell]];
+                Thumbnail* thumb = &overview->thumbs[list->visible[cell]];
+
+                if ((thumb->valid && thumb->hash == slide->hash) || !slide_proxies_ready(slide))
+                        continue;
+                if (now_ms() - start > THUMB_BUDGET_MS) {
+                        event_loop_arm_timer(overview->timer, 1, 0);
+                        break;
+                }
+                render_thumbnail(viewer, list->visible[cell]);
+                if (cell >= first && cell < first + (rows + 1) * GRID_COLUMNS)
+                        in_view = true;
+        }
+        if (in_view)
+                draw_overview(viewer);
+}
+
+
+bool slide_proxies_ready(Slide* slide)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        if (!slide_proxies_ready(slide->elements[i]->element.slide))
+                                return false;
+                        continue;
+                }
+                box = slide->elements[i]->element.box;
+                for (j = 0; j < box->item_count; j++) {
+                        if (box->items[j].type == ELEMENT_TYPE_IMAGE && box->items[j].image->proxy_state != PROXY_READY)
+                                return false;
+                }
+        }
+        return true;
+}
+
+
+/* small images are drawn as they are, the others get a job */
+void queue_proxies(ProxyWorkers* workers, Slide* slide)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        queue_proxies(workers, slide->elements[i]->element.slide);
+                        continue;
+                }
+                box = slide->elements[i]->element.box;
+                for (j = 0; j < box->item_count; j++) {
+                        Image* image = box->items[j].image;
+
+                        if (box->items[j].type != ELEMENT_TYPE_IMAGE || image->proxy_state != PROXY_NONE)
+                                continue;
+                        if (image->width <= THUMB_PROXY_SIZE && image->height <= THUMB_PROXY_SIZE) {
+                                image->proxy_state = PROXY_READY;
+                                continue;
+                        }
+                        if (workers->job_count == workers->job_capacity) {
+                                workers->job_capacity = workers->job_capacity ? workers->job_capacity * 2 : 16;
+                                workers->jobs = realloc(workers->jobs, workers->job_capacity * sizeof(Image*));
+                                if (!workers->jobs) {
+                                        fprintf(stderr, "Error: Failed to allocate memory for thumbnails.\n");
+                                        exit(1);
+                                }
+                        }
+                        image->proxy_state = PROXY_QUEUED;
+                        retain_image(image);
+                        workers->jobs[workers->job_count++] = image;
+                }
+        }
+}
+
+
+/*
+ * Downscales the images of every visible slide on one thread per
+ * core. The workers hold a reference on their images, so a reload can
+ * not free them, but mapped pixels go away with their deck and
+ * reload_and_redraw stops the workers first.
+ */
+void start_proxy_workers(Viewer* viewer)
+{
+        Overview* overview = &viewer->overview;
+        ProxyWorkers* workers = &overview->workers;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int i;
+
+        if (!overview->thumbs || workers->jobs)
+                return;
+        for (i = 0; i < viewer->list->visible_count; i++)
+                queue_proxies(workers, viewer->list->slides[viewer->list->visible[i]]);
+        if (workers->job_count == 0)
+                return;
+
+        workers->done = malloc(workers->job_count * sizeof(Image*));
+        if (!workers->done) {
+                fprintf(stderr, "Error: Failed to allocate memory for thumbnails.\n");
+                exit(1);
+        }
+        workers->next_job = 0;
+        workers->done_count = 0;
+        workers->done_read = 0;
+        workers->stop = false;
+        workers->thread_count = 0;
+        while (workers->thread_count < PROXY_MAX_WORKERS && (long)workers->thread_count < cpus
+                && workers->thread_count < workers->job_count) {
+                if (pthread_create(&workers->threads[workers->thread_count], NULL, proxy_worker, workers) != 0)
+                        break;
+                workers->thread_count++;
+        }
+        /* without threads the images are scaled right here */
+        if (workers->thread_count == 0)
+                proxy_worker(workers);
+}
+
+
+/* waits for the current jobs, images nobody got to are queued again next time */
+void stop_proxy_workers(ProxyWorkers* workers)
+{
+        unsigned int i;
+
+        if (!workers->jobs)
+                return;
+        pthread_mutex_lock(&workers->lock);
+        workers->stop = true;
+        pthread_mutex_unlock(&workers->lock);
+        for (i = 0; i < workers->thread_count; i++)
+                pthread_join(workers->threads[i], NULL);
+        workers->thread_count = 0;
+
+        while (workers->done_read < workers->done_count)
+                workers->done[workers->done_read++]->proxy_state = PROXY_READY;
+        for (i = 0; i < workers->job_count; i++) {
+                if (workers->jobs[i]->proxy_state == PROXY_QUEUED)
+                        workers->jobs[i]->proxy_state = PROXY_NONE;
+                release_image(workers->jobs[i]);
+        }
+        free(workers->jobs);
+        free(workers->done);
+        workers->jobs = NULL;
+        workers->done = NULL;
+        workers->job_count = 0;
+        workers->job_capacity = 0;
+}
+
+
+void* proxy_worker(void* data)
+{
+        ProxyWorkers* workers = data;
+        Image* image;
+
+        for (;;) {
+                pthread_mutex_lock(&workers->lock);
+                if (workers->stop || workers->next_job >= workers->job_count) {
+                        pthread_mutex_unlock(&workers->lock);
+                        break;
+                }
+                image = workers->jobs[workers->next_job++];
+                pthread_mutex_unlock(&workers->lock);
+
+                downscale_image(image);
+
+                pthread_mutex_lock(&workers->lock);
+                workers->done[workers->done_count++] = image;
+                pthread_mutex_unlock(&workers->lock);
+                event_loop_wake(workers->wakeup_fd);
+        }
+        return NULL;
+}
+
+
+/* box filter down to THUMB_PROXY_SIZE on the longer side */
+void downscale_image(Image* image)
+{
+        int longest = image->width > image->height ? image->width : image->height;
+        int width = (long)image->width * THUMB_PROXY_SIZE / longest;
+        int height = (long)image->height * THUMB_PROXY_SIZE / longest;
+        unsigned char* out;
+        int x;
+        int y;
+
+        if (width < 1)
+                width = 1;
+        if (height < 1)
+                height = 1;
+        wait_for_pixels(image);
+        out = malloc((size_t)width * height * 4);
+        if (!out) {
+                fprintf(stderr, "Error: Failed to allocate memory for thumbnails.\n");
+                exit(1);
+        }
+
+        for (y = 0; y < height; y++) {
+                int y0 = (long)y * image->height / height;
+                int y1 = (long)(y + 1) * image->height / height;
+
+                for (x = 0; x < width; x++) {
+                        int x0 = (long)x * image->width / width;
+                        int x1 = (long)(x + 1) * image->width / width;
+                        unsigned long sum[4] = { 0, 0, 0, 0 };
+                        unsigned long count = (unsigned long)(y1 - y0) * (x1 - x0);
+                        unsigned char* dst = out + ((size_t)y * width + x) * 4;
+                        int sx;
+                        int sy;
+                        int c;
+
+                        for (sy = y0; sy < y1; sy++) {
+                                const unsigned char* src = image->data + ((size_t)sy * image->width + x0) * 4;
+                                for (sx = x0; sx < x1; sx++, src += 4) {
+                                        for (c = 0; c < 4; c++)
+                                                sum[c] += src[c];
+                                }
+                        }
+                        for (c = 0; c < 4; c++)
+                                dst[c] = sum[c] / count;
+                }
+        }
+        image->proxy_data = out;
+        image->proxy_width = width;
+        image->proxy_height = height;
+}
+
+
+/* runs on the main thread after a worker called event_loop_wake */
+void handle_proxies_done(void* data)
+{
+        Viewer* viewer = data;
+        ProxyWorkers* workers = &viewer->overview.workers;
+        bool finished;
+
+        if (!workers->jobs)
+                return;
+        pthread_mutex_lock(&workers->lock);
+        while (workers->done_read < workers->done_count)
+                workers->done[workers->done_read++]->proxy_state = PROXY_READY;
+        finished = workers->done_count == workers->job_count;
+        pthread_mutex_unlock(&workers->lock);
+
+        if (finished)
+                stop_proxy_workers(workers);
+        if (viewer->overview.active)
+                event_loop_arm_timer(viewer->overview.timer, 1, 0);
+}
+
+
+/*
+ * Opens the presenter window, on another monitor when there is one.
+ * It draws from the same images, fonts and layout as the audience
+ * window, slides are rendered into cached pixmaps the size of the
+ * current slide panel and the next slide preview is scaled from those.
+ */
+void open_presenter(Viewer* viewer)
+{
+        Display* dpy = viewer->dpy;
+        int screen = viewer->screen;
+        Presenter* presenter = &viewer->presenter;
+        XSizeHints hints;
+        Atom del_window;
+        int x = 30;
+        int y = 30;
+        int width = viewer->window_width;
+        int height = viewer->window_height;
+
+        if (find_presenter_monitor(dpy, viewer->window, &x, &y, &width, &height) != 0) {
+                x = 30;
+                y = 30;
+        }
+        presenter->window = XCreateSimpleWindow(dpy, RootWindow(dpy, screen), x, y, width, height, 1, 0x000000, 0x202020);
+        hints.flags = USPosition | USSize;
+        hints.x = x;
+        hints.y = y;
+        hints.width = width;
+        hints.height = height;
+        XSetWMNormalHints(dpy, presenter->window, &hints);
+        XStoreName(dpy, presenter->window, "Presenter");
+        del_window = XInternAtom(dpy, "WM_DELETE_WINDOW", 0);
+        XSetWMProtocols(dpy, presenter->window, &del_window, 1);
+        XSelectInput(dpy, presenter->window, ExposureMask | KeyPressMask | StructureNotifyMask | ButtonPressMask);
+        XMapWindow(dpy, presenter->window);
+
+        presenter->target.window = presenter->window;
+        presenter->target.drawable = presenter->window;
+        presenter->target.draw = XftDrawCreate(dpy, presenter->window, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
+        presenter->target.picture = XRenderCreatePicture(dpy, presenter->window, x_resources.format, 0, NULL);
+        presenter->target.use_proxies = false;
+        presenter->target.animate = false;
+        x_resources.live++;
+
+        memset(presenter->slides, 0, sizeof(presenter->slides));
+        presenter->draw = NULL;
+        presenter->slide_width = 0;
+        presenter->slide_height = 0;
+        presenter->dirty = true;
+        presenter->prefetch = false;
+        presenter->start_ms = now_ms();
+        presenter->timer = event_loop_add_timer(&viewer->loop, handle_presenter_timer, viewer);
+        presenter->clock_timer = event_loop_add_timer(&viewer->loop, handle_presenter_clock, viewer);
+        event_loop_arm_timer(presenter->clock_timer, 1000, 1000);
+        presenter->open = true;
+}
+
+
+void close_presenter(Viewer* viewer)
+{
+        Presenter* presenter = &viewer->presenter;
+
+        if (!presenter->open)
+                return;
+        free_presenter_slides(presenter);
+        if (presenter->draw)
+                XftDrawDestroy(presenter->draw);
+        XftDrawDestroy(presenter->target.draw);
+        XRenderFreePicture(viewer->dpy, presenter->target.picture);
+        x_resources.live--;
+        XDestroyWindow(viewer->dpy, presenter->window);
+        event_loop_remove(&viewer->loop, presenter->timer);
+        event_loop_remove(&viewer->loop, presenter->clock_timer);
+        presenter->open = false;
+}
+
+
+void free_presenter_slides(Presenter* presenter)
+{
+        unsigned int i;
+
+        for (i = 0; i < PRESENTER_CACHE_SLOTS; i++)
+                free_cached_slide(&presenter->slides[i], presenter->slide_width, presenter->slide_height);
+}
+
+
+/* the first connected monitor that does not show the audience window */
+int find_presenter_monitor(Display* dpy, Window audience, int* x, int* y, int* width, int* height)
+{
+        XRRScreenResources* screen_res;
+        Window root = DefaultRootWindow(dpy);
+        Window child;
+        int audience_x;
+        int audience_y;
+        int found = -1;
+        int i;
+
+        XTranslateCoordinates(dpy, audience, root, 0, 0, &audience_x, &audience_y, &child);
+        screen_res = XRRGetScreenResources(dpy, root);
+        for (i = 0; i < screen_res->noutput && found != 0; i++) {
+                XRROutputInfo* output_info = XRRGetOutputInfo(dpy, screen_res, screen_res->outputs[i]);
+                XRRCrtcInfo* crtc_info;
+
+                if (output_info->connection != RR_Connected || output_info->crtc == None) {
+                        XRRFreeOutputInfo(output_info);
+                        continue;
+                }
+                crtc_info = XRRGetCrtcInfo(dpy, screen_res, output_info->crtc);
+                if (audience_x < crtc_info->x || audience_x >= (int)(crtc_info->x + crtc_info->width)
+                        || audience_y < crtc_info->y || audience_y >= (int)(crtc_info->y + crtc_info->height)) {
+                        *x = crtc_info->x;
+                        *y = crtc_info->y;
+                        *width = crtc_info->width;
+                        *height = crtc_info->height;
+                        found = 0;
+                }
+                XRRFreeCrtcInfo(crtc_info);
+                XRRFreeOutputInfo(output_info);
+        }
+        XRRFreeScreenResources(screen_res);
+        return found;
+}
+
+
+/* slide index of the slide after the current one, list->count for the end slide */
+unsigned int presenter_next_slide(Viewer* viewer)
+{
+        SlideList* list = viewer->list;
+        unsigned int position;
+
+        if (viewer->slide_idx >= list->count)
+                return list->count;
+        position = list->slides[viewer->slide_idx]->position + 1;
+        return position < list->visible_count ? list->visible[position] : list->count;
+}
+
+
+/* called after every round of events, schedules a redraw when the slides on screen changed */
+void sync_presenter(Viewer* viewer)
+{
+        Presenter* presenter = &viewer->presenter;
+        SlideList* list = viewer->list;
+        unsigned int next = presenter_next_slide(viewer);
+        unsigned long hash = 2166136261UL;
+
+        if (!presenter->open)
+                return;
+        hash = hash_bytes(hash, &viewer->slide_idx, sizeof(viewer->slide_idx));
+        if (viewer->slide_idx < list->count)
+                hash = hash_bytes(hash, &list->slides[viewer->slide_idx]->hash, sizeof(unsigned long));
+        if (next < list->count)
+                hash = hash_bytes(hash, &list->slides[next]->hash, sizeof(unsigned long));
+        /* notes are not part of the slide hash, editing them doesn't relayout the slide */
+        if (viewer->slide_idx < list->count && list->slides[viewer->slide_idx]->notes_length > 0) {
+                Slide* slide = list->slides[viewer->slide_idx];
+                hash = hash_bytes(hash, list->notes + slide->notes_offset, slide->notes_length);
+        }
+        if (hash == presenter->shown_hash && !presenter->dirty)
+                return;
+        presenter->shown_hash = hash;
+        presenter->dirty = true;
+        /* the audience window was flushed already, the presenter draws on the next turn of the loop */
+        event_loop_arm_timer(presenter->timer, 1, 0);
+}
+
+
+void presenter_layout(Viewer* viewer, XRectangle* current, XRectangle* next, XRectangle* clock, XRectangle* notes)
+{
+        RenderTarget* target = &viewer->presenter.target;
+        int audience_width = window_target.width > 0 ? window_target.width : 1;
+        int audience_height = window_target.height > 0 ? window_target.height : 1;
+        int width;
+        int height;
+
+        measure_target(viewer->dpy, target);
+        width = target->width * 3 / 5 - 2 * PRESENTER_MARGIN;
+        height = width * audience_height / audience_width;
+        if (height > target->height * 2 / 3) {
+                height = target->height * 2 / 3;
+                width = height * audience_width / audience_height;
+        }
+        current->x = PRESENTER_MARGIN;
+        current->y = PRESENTER_MARGIN;
+        current->width = width > 1 ? width : 1;
+        current->height = height > 1 ? height : 1;
+
+        width = target->width - current->width - 3 * PRESENTER_MARGIN;
+        next->x = current->x + current->width + PRESENTER_MARGIN;
+        next->y = PRESENTER_MARGIN;
+        next->width = width > 1 ? width : 1;
+        next->height = next->width * audience_height / audience_width > 1 ? next->width * audience_height / audience_width : 1;
+
+        clock->x = next->x;
+        clock->y = next->y + next->height + PRESENTER_MARGIN;
+        clock->width = next->width;
+        clock->height = global_fonts[FONT_HUGE]->height + 2 * global_fonts[FONT_SMALL]->height;
+
+        notes->x = current->x;
+        notes->y = current->y + current->height + PRESENTER_MARGIN;
+        notes->width = current->width;
+        height = target->height - notes->y - PRESENTER_MARGIN;
+        notes->height = height > 1 ? height : 1;
+}
+
+
+/* the cached render of a slide, drawn now when it is not cached */
+CachedSlide* presenter_slide(Viewer* viewer, unsigned int slide_idx)
+{
+        SlideList* list = viewer->list;
+        Presenter* presenter = &viewer->presenter;
+        unsigned int next = presenter_next_slide(viewer);
+        CachedSlide* slot = NULL;
+        unsigned int i;
+
+        for (i = 0; i < PRESENTER_CACHE_SLOTS; i++) {
+                if (cached_slide_matches(&presenter->slides[i], list, slide_idx, STEP_ALL))
+                        return &presenter->slides[i];
+        }
+        /* reuse a slot that holds neither the current nor the next slide */
+        for (i = 0; i < PRESENTER_CACHE_SLOTS && !slot; i++) {
+                CachedSlide* slide = &presenter->slides[i];
+                if (!slide->valid || (slide->slide_idx != viewer->slide_idx && slide->slide_idx != next))
+                        slot = slide;
+        }
+        if (!slot)
+                slot = &presenter->slides[0];
+
+        render_cached_slide(viewer->dpy, viewer->screen, presenter->window, list, slide_idx, STEP_ALL, slot,
+                            presenter->slide_width, presenter->slide_height, &presenter->draw);
+        return slot;
+}
+
+
+/* draws a slide into slot, making its pixmap on first use. draw is moved onto it */
+void render_cached_slide(Display* dpy, int screen, Drawable drawable, SlideList* list, unsigned int slide_idx,
+                         unsigned int step, CachedSlide* slot, int width, int height, XftDraw** draw)
+{
+        RenderTarget target;
+
+        if (slot->picture == None) {
+                slot->pixmap = XCreatePixmap(dpy, drawable, width, height, DefaultDepth(dpy, screen));
+                slot->picture = XRenderCreatePicture(dpy, slot->pixmap, x_resources.format, 0, NULL);
+                XRenderSetPictureFilter(dpy, slot->picture, FilterBilinear, NULL, 0);
+                x_resources.live += 2;
+                x_resource_bytes += (size_t)width * height * 4;
+        }
+        if (*draw)
+                XftDrawChange(*draw, slot->pixmap);
+        else
+                *draw = XftDrawCreate(dpy, slot->pixmap, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
+
+        target.window = None;
+        target.drawable = slot->pixmap;
+        target.draw = *draw;
+        target.picture = slot->picture;
+        target.width = width;
+        target.height = height;
+        target.use_proxies = false;
+        target.animate = false;
+        target.step = step;
+        if (slide_idx < list->count)
+                render_slide(*list->slides[slide_idx], dpy, &target, screen);
+        else
+                render_endslide(dpy, &target, screen);
+        slot->slide_idx = slide_idx;
+        slot->step = slide_step(list, slide_idx, step);
+        slot->hash = slide_idx < list->count ? list->slides[slide_idx]->hash : 0;
+        slot->shown = target.shown;
+        slot->valid = true;
+}
+
+
+bool cached_slide_matches(CachedSlide* slot, SlideList* list, unsigned int slide_idx, unsigned int step)
+{
+        unsigned long hash = slide_idx < list->count ? list->slides[slide_idx]->hash : 0;
+
+        return slot->valid && slot->slide_idx == slide_idx && slot->hash == hash && slot->step == slide_step(list, slide_idx, step);
+}
+
+
+void free_cached_slide(CachedSlide* slot, int width, int height)
+{
+        if (slot->picture == None)
+                return;
+        XRenderFreePicture(x_resources.dpy, slot->picture);
+        XFreePixmap(x_resources.dpy, slot->pixmap);
+        slot->picture = None;
+        slot->pixmap = None;
+        slot->valid = false;
+        x_resources.live -= 2;
+        x_resource_bytes -= (size_t)width * height * 4;
+}
+
+
+void composite_scaled(Display* dpy, Picture src, int src_width, int src_height, Picture dst, XRectangle* rect)
+{
+        XTransform scale;
+
+        memset(&scale, 0, sizeof(scale));
+        scale.matrix[0][0] = XDoubleToFixed((double)src_width / rect->width);
+        scale.matrix[1][1] = XDoubleToFixed((double)src_height / rect->height);
+        scale.matrix[2][2] = XDoubleToFixed(1.0);
+        XRenderSetPictureTransform(dpy, src, &scale);
+        XRenderComposite(dpy, PictOpSrc, src, None, dst, 0, 0, 0, 0, rect->x, rect->y, rect->width, rect->height);
+}
+
+
+void draw_presenter(Viewer* viewer)
+{
+        Display* dpy = viewer->dpy;
+        Presenter* presenter = &viewer->presenter;
+        unsigned int next = presenter_next_slide(viewer);
+        XRectangle current_rect;
+        XRectangle next_rect;
+        XRectangle clock_rect;
+        XRectangle notes_rect;
+        CachedSlide* slide;
+
+        measure_target(dpy, &window_target);
+        presenter_layout(viewer, &current_rect, &next_rect, &clock_rect, &notes_rect);
+        if (current_rect.width != presenter->slide_width || current_rect.height != presenter->slide_height) {
+                free_presenter_slides(presenter);
+                presenter->slide_width = current_rect.width;
+                presenter->slide_height = current_rect.height;
+        }
+
+        clear_target(dpy, &presenter->target, 0x202020);
+        slide = presenter_slide(viewer, viewer->slide_idx);
+        composite_scaled(dpy, slide->picture, presenter->slide_width, presenter->slide_height, presenter->target.picture, &current_rect);
+        slide = presenter_slide(viewer, next);
+        composite_scaled(dpy, slide->picture, presenter->slide_width, presenter->slide_height, presenter->target.picture, &next_rect);
+        draw_presenter_clock(viewer);
+        draw_presenter_notes(viewer, &notes_rect);
+
+        presenter->dirty = false;
+        presenter->prefetch = next < viewer->list->count;
+        if (presenter->prefetch)
+                event_loop_arm_timer(presenter->timer, 1, 0);
+}
+
+
+/* elapsed time and slide number under the next slide preview */
+void draw_presenter_clock(Viewer* viewer)
+{
+        Presenter* presenter = &viewer->presenter;
+        SlideList* list = viewer->list;
+        XRenderColor background = { 0x2020, 0x2020, 0x2020, 0xFFFF };
+        XRectangle current_rect;
+        XRectangle next_rect;
+        XRectangle clock_rect;
+        XRectangle notes_rect;
+        unsigned long seconds = (now_ms() - presenter->start_ms) / 1000;
+        char text[64];
+
+        presenter_layout(viewer, &current_rect, &next_rect, &clock_rect, &notes_rect);
+        XRenderFillRectangle(viewer->dpy, PictOpSrc, presenter->target.picture, &background,
+                             clock_rect.x, clock_rect.y, clock_rect.width, clock_rect.height);
+
+        sprintf(text, "%02lu:%02lu:%02lu", seconds / 3600, seconds / 60 % 60, seconds % 60);
+        XftDrawString8(presenter->target.draw, &color_white, global_fonts[FONT_HUGE], clock_rect.x,
+                       clock_rect.y + global_fonts[FONT_HUGE]->ascent, (XftChar8 *)text, strlen(text));
+        if (viewer->slide_idx < list->count)
+                sprintf(text, "Slide %u of %u", list->slides[viewer->slide_idx]->position + 1, list->visible_count);
+        else
+                sprintf(text, "End of presentation");
+        XftDrawString8(presenter->target.draw, &color_white, global_fonts[FONT_SMALL], clock_rect.x,
+                       clock_rect.y + global_fonts[FONT_HUGE]->height + global_fonts[FONT_SMALL]->ascent,
+                       (XftChar8 *)text, strlen(text));
+}
+
+
+/* the current slide's notes under it, wrapped at spaces and cut off at the bottom */
+void draw_presenter_notes(Viewer* viewer, XRectangle* rect)
+{
+        Presenter* presenter = &viewer->presenter;
+        SlideList* list = viewer->list;
+        XftFont* font = global_fonts[FONT_NORMAL];
+        int y = rect->y + font->ascent;
+        const char* text;
+        const char* end;
+
+        if (viewer->slide_idx >= list->count || list->slides[viewer->slide_idx]->notes_length == 0)
+                return;
+        text = list->notes + list->slides[viewer->slide_idx]->notes_offset;
+        end = text + list->slides[viewer->slide_idx]->notes_length;
+
+        while (text < end && y - font->ascent + font->height <= rect->y + rect->height) {
+                const char* line_end = memchr(text, '\n', end - text);
+                unsigned int len;
+                unsigned int fit = 0;
+                unsigned int space = 0;
+                int width = 0;
+
+                len = line_end ? (unsigned int)(line_end - text) : (unsigned int)(end - text);
+                /* the longest prefix that fits, broken after a word when there is one */
+                while (fit < len) {
+                        int char_len;
+
+                        utf8_char(text + fit, len - fit, &char_len);
+                        width += text_advance(viewer->dpy, font, text + fit, char_len);
+                        if (width > rect->width)
+                                break;
+                        fit += char_len;
+                        if (text[fit - 1] == ' ')
+                                space = fit;
+                }
+                if (fit < len && space > 0) {
+                        fit = space;
+                }
+                else if (fit == 0 && len > 0) {
+                        int char_len;
+
+                        utf8_char(text, len, &char_len);
+                        fit = char_len;
+                }
+
+                draw_utf8(presenter->target.draw, &color_white, font, rect->x, y, text, fit);
+                y += font->height;
+                text += fit;
+                if (fit == len && text < end)
+                        text++;
+        }
+}
+
+
+/* redraws when the slides changed, then renders the slide after next ahead of time */
+void handle_presenter_timer(void* data)
+{
+        Viewer* viewer = data;
+        Presenter* presenter = &viewer->presenter;
+        unsigned int next = presenter_next_slide(viewer);
+
+        if (presenter->dirty) {
+                draw_presenter(viewer);
+        }
+        else if (presenter->prefetch && next < viewer->list->count) {
+                unsigned int position = viewer->list->slides[next]->position + 1;
+
+                presenter->prefetch = false;
+                presenter_slide(viewer, position < viewer->list->visible_count ? viewer->list->visible[position] : viewer->list->count);
+        }
+        XFlush(viewer->dpy);
+}
+
+
+void handle_presenter_clock(void* data)
+{
+        Viewer* viewer = data;
+
+        draw_presenter_clock(viewer);
+        XFlush(viewer->dpy);
+}
+
+
+int get_default_monitor_dimensions(Display* dpy, int* width, int* height)
+{
+        XWindowAttributes attrs;
+        XRRScreenResources* screen_res;
+        XRROutputInfo* output_info;
+        XRRCrtcInfo* crtc_info;
+        Window root;
+        Window temp_window;
+        int i;
+
+        root = DefaultRootWindow(dpy);
+
+        /* create temporary window and map it.
+         * we will use the coordinates of this window to
+         * find out what monitor the window spawns on */
+        temp_window = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
+        XMapWindow(dpy, temp_window);
+        XSync(dpy, False);
+
+        XGetWindowAttributes(dpy, temp_window, &attrs);
+        screen_res = XRRGetScreenResources(dpy, root);
+
+        for (i = 0; i < screen_res->noutput; i++) {
+                output_info = XRRGetOutputInfo(dpy, screen_res, screen_res->outputs[i]);
+                if (output_info->connection == RR_Connected) {
+                        crtc_info = XRRGetCrtcInfo(dpy, screen_res, output_info->crtc);
+                        if ((attrs.x >= (int)crtc_info->x
+                                && attrs.x < (int)(crtc_info->x + crtc_info->width))
+                                && (attrs.y >= (int)crtc_info->y
+                                && attrs.y < (int)(crtc_info->y + crtc_info->height))) {
+
+                                *width = crtc_info->width;
+                                *height = crtc_info->height;
+                                XRRFreeCrtcInfo(crtc_info);
+                                XRRFreeOutputInfo(output_info);
+                                XRRFreeScreenResources(screen_res);
+                                XUnmapWindow(dpy, temp_window);
+                                XDestroyWindow(dpy, temp_window);
+                                return 0;
+                        }
+                        XRRFreeCrtcInfo(crtc_info);
+                }
+                XRRFreeOutputInfo(output_info);
+        }
+        XRRFreeScreenResources(screen_res);
+        XUnmapWindow(dpy, temp_window);
+        XDestroyWindow(dpy, temp_window);
+
+        return -1; /* Couldn't find a monitor */
+}
+
+void change_slide(Display* dpy, Window window, SlideList list, unsigned int* slide_idx, int screen, int amount)
+{
+        unsigned int position;
+        unsigned int step = window_target.step;
+
+        if (list.visible_count == 0) return;
+
+        /* the build steps of a slide come before the slides next to it */
+        if (*slide_idx < list.count && (amount == 1 ? step < list.slides[*slide_idx]->steps : amount == -1 && step > 0)) {
+                end_zoom(dpy, screen, false);
+                window_target.step = step + amount;
+                render_slide_change(list.slides[*slide_idx], step, list.slides[*slide_idx], dpy, &window_target, screen);
+                return;
+        }
+        position = *slide_idx < list.count ? list.slides[*slide_idx]->position : list.visible_count;
+        if (amount < 0 && position < (unsigned int)-amount)
+                return;
+        if (amount > 0 && position >= list.visible_count)
+                return;
+        /* going back lands on the last step */
+        go_to_position(dpy, window, list, slide_idx, screen, position + amount, amount < 0 ? STEP_ALL : 0);
+}
+
+
+/* positions past the last visible slide show the end slide, step is kept to the slide's build steps */
+void go_to_position(Display* dpy, Window window, SlideList list, unsigned int* slide_idx, int screen, unsigned int position, unsigned int step)
+{
+        unsigned int old_idx = *slide_idx;
+        unsigned int old_step = window_target.step;
+
+        end_zoom(dpy, screen, false);
+        *slide_idx = position >= list.visible_count ? list.count : list.visible[position];
+        window_target.step = slide_step(&list, *slide_idx, step);
+        if (!start_transition(dpy, screen, &list, old_idx, old_step, *slide_idx, window_target.step)) {
+                if (*slide_idx >= list.count)
+                        render_endslide(dpy, &window_target, screen);
+                else if (old_idx < list.count)
+                        render_slide_change(list.slides[old_idx], old_step, list.slides[*slide_idx], dpy, &window_target, screen);
+                else
+                        render_slide(*list.slides[*slide_idx], dpy, &window_target, screen);
+        }
+        update_title(dpy, window, list, *slide_idx);
+}
+
+
+/* step, or the last build step of the slide if it has fewer, the end slide has none */
+unsigned int slide_step(SlideList* list, unsigned int slide_idx, unsigned int step)
+{
+        unsigned int steps = slide_idx < list->count ? list->slides[slide_idx]->steps : 0;
+
+        return step < steps ? step : steps;
+}
+
+
+/* a digit starts a slide number, '/' a name, the match is shown in the title */
+void open_prompt(Viewer* viewer, bool by_name, char first)
+{
+        JumpPrompt* prompt = &viewer->prompt;
+
+        prompt->active = true;
+        prompt->by_name = by_name;
+        prompt->len = 0;
+        if (first)
+                prompt->text[prompt->len++] = first;
+        prompt->text[prompt->len] = '\0';
+        update_prompt_title(viewer);
+}
+
+
+/* puts the slide's title back */
+void close_prompt(Viewer* viewer)
+{
+        viewer->prompt.active = false;
+        update_title(viewer->dpy, viewer->window, *viewer->list, viewer->slide_idx);
+}
+
+
+void handle_prompt_key(Viewer* viewer, XKeyEvent* event)
+{
+        JumpPrompt* prompt = &viewer->prompt;
+        SlideList* list = viewer->list;
+        char buf[8];
+        KeySym key;
+        int len = XLookupString(event, buf, sizeof(buf), &key, NULL);
+        int position;
+
+        if (key == XK_Escape) {
+                close_prompt(viewer);
+                return;
+        }
+        if (key == XK_Return || key == XK_KP_Enter) {
+                prompt->active = false;
+                position = find_jump_target(list, prompt);
+                if (position >= 0)
+                        go_to_position(viewer->dpy, viewer->window, *list, &viewer->slide_idx, viewer->screen, position, 0);
+                else
+                        update_title(viewer->dpy, viewer->window, *list, viewer->slide_idx);
+                return;
+        }
+        if (key == XK_BackSpace) {
+                if (prompt->len > 0)
+                        prompt->text[--prompt->len] = '\0';
+        }
+        else if (len == 1 && isprint((unsigned char)buf[0]) && prompt->len + 1 < sizeof(prompt->text)
+                && (prompt->by_name || isdigit((unsigned char)buf[0]))) {
+                prompt->text[prompt->len++] = buf[0];
+                prompt->text[prompt->len] = '\0';
+        }
+        update_prompt_title(viewer);
+}
+
+
+void update_prompt_title(Viewer* viewer)
+{
+        JumpPrompt* prompt = &viewer->prompt;
+        SlideList* list = viewer->list;
+        int position = find_jump_target(list, prompt);
+        const char* match = "no match";
+        char title[192];
+
+        if (position >= 0) {
+                Slide* slide = list->slides[list->visible[position]];
+                match = get_top_text(*slide);
+                if (!match)
+                        match = slide->name ? slide->name : "untitled";
+        }
+        sprintf(title, "Go to %s: %s (%.100s)", prompt->by_name ? "name" : "slide", prompt->text, match);
+        XStoreName(viewer->dpy, viewer->window, title);
+}
+
+
+/* position of the slide the prompt matches or -1 */
+int find_jump_target(SlideList* list, JumpPrompt* prompt)
+{
+        long number;
+
+        if (prompt->by_name)
+                return prompt->len > 0 ? find_slide_position(list, prompt->text) : -1;
+        number = atol(prompt->text);
+        return number >= 1 && number <= (long)list->visible_count ? (int)number - 1 : -1;
+}
+
+void toggle_fullscreen(Display* dpy, Window window, int screen, XEvent e, bool fullscreen)
+{
+        Atom wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
+        Atom wm_state_fullscreen = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
+
+        e.xany.type = ClientMessage;
+        e.xclient.message_type = wm_state;
+        e.xclient.format = 32;
+        e.xclient.window = window;
+        e.xclient.data.l[0] = fullscreen ? 1 : 0;
+        e.xclient.data.l[1] = wm_state_fullscreen;
+        e.xclient.data.l[3] = 0l;
+
+        XSendEvent(dpy, RootWindow(dpy, screen), 0, SubstructureNotifyMask | SubstructureRedirectMask, &e);
+}
+
+
+/* moves to the first visible slide at or after slide_idx, or the last one */
+void skip_templates(SlideList list, unsigned int* slide_idx)
+{
+        unsigned int low = 0;
+        unsigned int high = list.visible_count;
+
+        if (list.visible_count == 0) {
+                *slide_idx = list.count;
+                return;
+        }
+        while (low < high) {
+                unsigned int mid = low + (high - low) / 2;
+                if (list.visible[mid] < *slide_idx)
+                        low = mid + 1;
+                else
+                        high = mid;
+        }
+        *slide_idx = list.visible[low < list.visible_count ? low : list.visible_count - 1];
+}
+
+
+void update_title(Display* dpy, Window window, SlideList list, unsigned int slide_idx)
+{
+        char* title;
+        if (slide_idx >= list.count) {
+                XStoreName(dpy, window, "End of Presentation.");
+                return;
+        }
+        title = get_top_text(*list.slides[slide_idx]);
+        XStoreName(dpy, window, title);
+}
+
+
+char* get_top_text(Slide slide)
+{
+        unsigned int i, j;
+        for (i = 0; i < slide.element_count; i++) {
+                Box* box;
+                if (slide.elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        Slide* found_slide = slide.elements[i]->element.slide;
+                        return get_top_text(*found_slide);
+                }
+                if (slide.elements[i]->type != ELEMENT_TYPE_BOX) {
+                        continue;
+                }
+                box = slide.elements[i]->element.box;
+                for (j = 0; j < box->element_count; j++) {
+                        if (box->elements[j]->type == ELEMENT_TYPE_TEXT) {
+                                return box->elements[j]->element.text->content;
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+
+void render_endslide(Display* dpy, RenderTarget* target, int screen)
+{
+        XGlyphInfo extents;
+        XftFont* font;
+        const char* text = "End of presentation.";
+        double font_size;
+        int x;
+        int y;
+        int text_width;
+        int text_height;
+
+        measure_target(dpy, target);
+        font_size = 0.03 * target->width;
+
+        clear_target(dpy, target, 0x000000);
+        /* redrawn on every resize and expose, so the font comes from the cache slides use */
+        font = text_font(dpy, screen, font_size);
+
+        XftTextExtentsUtf8(dpy, font, (const FcChar8*)text, strlen(text), &extents);
+        text_width = extents.width;
+        text_height = extents.height;
+
+        x = (target->width - text_width) / 2;
+        y = (target->height + text_height) / 2;
+
+        draw_utf8(target->draw, &color_white, font, x, y, text, strlen(text));
+}
+
+
+void render_slide(Slide slide, Display* dpy, RenderTarget* target, int screen)
+{
+        DisplayList scratch;
+        DisplayList* list;
+
+        measure_target(dpy, target);
+        list = slide_display_list(dpy, screen, &slide, target, &scratch);
+        replay_display_list(list, dpy, target, screen, 0, NULL, 0);
+        /* a zoomed image isn't what the list says is there */
+        if (!(target->animate && zoom.item))
+                target->shown = shown_hash(list, target->step);
+        if (list == &scratch) {
+                free(scratch.ops);
+                free(scratch.glyphs);
+        }
+}
+
+
+/*
+ * The slide's list compiled for the target. slide->display is kept for
+ * the slideshow window, other targets only use it when it has their
+ * size. Otherwise they and slides that were never laid out compile into
+ * scratch, so the presenter and thumbnails never make the window's list
+ * compile again.
+ */
+DisplayList* slide_display_list(Display* dpy, int screen, Slide* slide, RenderTarget* target, DisplayList* scratch)
+{
+        DisplayList* list = slide->display;
+
+        if (list && list->width == target->width && list->height == target->height && list->fonts == text_fonts.generation)
+                return list;
+        if (!list || target != &window_target) {
+                memset(scratch, 0, sizeof(DisplayList));
+                list = scratch;
+        }
+        compile_display_list(dpy, screen, slide, target->width, target->height, list);
+        return list;
+}
+
+
+/* text goes over the images, so all of it can be drawn in one request */
+void compile_display_list(Display* dpy, int screen, Slide* slide, int width, int height, DisplayList* list)
+{
+        DrawOp* op;
+        unsigned int i;
+
+        list->op_count = 0;
+        list->glyph_count = 0;
+        op = add_draw_op(list, DRAW_CLEAR);
+        op->rect.width = width;
+        op->rect.height = height;
+        op->color = 0xFFFFFF;
+        add_image_ops(slide, width, height, list);
+        add_text_ops(dpy, screen, slide, width, height, list);
+
+        list->hash = 2166136261UL;
+        list->steps = 0;
+        for (i = 0; i < list->op_count; i++) {
+                op = &list->ops[i];
+                op->hash = hash_bytes(2166136261UL, &op->type, sizeof(op->type));
+                op->hash = hash_bytes(op->hash, &op->rect, sizeof(op->rect));
+                if (op->type == DRAW_CLEAR)
+                        op->hash = hash_bytes(op->hash, &op->color, sizeof(op->color));
+                else if (op->type == DRAW_IMAGE)
+                        op->hash = hash_bytes(op->hash, &op->item->image, sizeof(Image*));
+                else
+                        op->hash = hash_bytes(op->hash, &list->glyphs[op->first], op->count * sizeof(XftGlyphFontSpec));
+                /* ops only differing in their step are the same once drawn, only the list tells them apart */
+                list->hash = hash_bytes(list->hash, &op->hash, sizeof(op->hash));
+                list->hash = hash_bytes(list->hash, &op->step, sizeof(op->step));
+                if (op->step > list->steps)
+                        list->steps = op->step;
+        }
+        list->width = width;
+        list->height = height;
+        list->fonts = text_fonts.generation;
+}
+
+
+void add_image_ops(Slide* slide, int width, int height, DisplayList* list)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        add_image_ops(slide->elements[i]->element.slide, width, height, list);
+                        continue;
+                }
+                if (slide->elements[i]->type != ELEMENT_TYPE_BOX)
+                        continue;
+                box = slide->elements[i]->element.box;
+                for (j = 0; j < box->item_count; j++) {
+                        XRectangle rect;
+                        DrawOp* op;
+
+                        if (box->items[j].type != ELEMENT_TYPE_IMAGE || !item_rect(box, &box->items[j], width, height, &rect))
+                                continue;
+                        op = add_draw_op(list, DRAW_IMAGE);
+                        op->rect = rect;
+                        op->item = &box->items[j];
+                        op->step = box->items[j].step;
+                }
+        }
+}
+
+
+/* one glyph run per box and build step, its rect bounds the ink of the glyphs */
+void add_text_ops(Display* dpy, int screen, Slide* slide, int width, int height, DisplayList* list)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+                XRectangle ink;
+                unsigned int first = list->glyph_count;
+                unsigned int step = 0;
+                int box_x;
+                int box_y;
+                int box_width;
+                int box_height;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        add_text_ops(dpy, screen, slide->elements[i]->element.slide, width, height, list);
+                        continue;
+                }
+                if (slide->elements[i]->type != ELEMENT_TYPE_BOX)
+                        continue;
+                box = slide->elements[i]->element.box;
+                box_x = box->x * width;
+                box_y = box->y * height;
+                box_width = box->width * width;
+                box_height = box->height * height;
+                memset(&ink, 0, sizeof(ink));
+                for (j = 0; j < box->item_count; j++) {
+                        LayoutItem* item = &box->items[j];
+
+                        if (item->type != ELEMENT_TYPE_TEXT)
+                                continue;
+                        if (item->step != step) {
+                                add_glyph_op(list, first, step, &ink);
+                                first = list->glyph_count;
+                                step = item->step;
+                                memset(&ink, 0, sizeof(ink));
+                        }
+                        add_text_glyphs(dpy, text_font(dpy, screen, item->size * width), item->content,
+                                        box_x + item->x * box_width, box_y + item->y * box_height, list, &ink);
+                }
+                add_glyph_op(list, first, step, &ink);
+        }
+}
+
+
+/* ends the run of glyphs from first, if it has any */
+void add_glyph_op(DisplayList* list, unsigned int first, unsigned int step, XRectangle* ink)
+{
+        DrawOp* op;
+
+        if (list->glyph_count == first)
+                return;
+        op = add_draw_op(list, DRAW_GLYPHS);
+        op->rect = *ink;
+        op->first = first;
+        op->count = list->glyph_count - first;
+        op->step = step;
+}
+
+
+DrawOp* add_draw_op(DisplayList* list, DrawOpType type)
+{
+        DrawOp* op;
+
+        if (list->op_count == list->op_capacity) {
+                list->op_capacity = list->op_capacity ? list->op_capacity * 2 : 16;
+                list->ops = realloc(list->ops, list->op_capacity * sizeof(DrawOp));
+                if (!list->ops) {
+                        fprintf(stderr, "Error: Failed to allocate memory for display list.\n");
+                        exit(1);
+                }
+        }
+        op = &list->ops[list->op_count++];
+        memset(op, 0, sizeof(DrawOp));
+        op->type = type;
+        return op;
+}
+
+
+/* appends the glyphs of a line of UTF-8 text starting at x on the baseline y and grows ink over them */
+void add_text_glyphs(Display* dpy, XftFont* font, const char* text, int x, int y, DisplayList* list, XRectangle* ink)
+{
+        int len = strlen(text);
+
+        while (len > 0) {
+                XftGlyphFontSpec* spec;
+                XGlyphInfo extents;
+                int char_len;
+
+                if (list->glyph_count == list->glyph_capacity) {
+                        list->glyph_capacity = list->glyph_capacity ? list->glyph_capacity * 2 : 256;
+                        list->glyphs = realloc(list->glyphs, list->glyph_capacity * sizeof(XftGlyphFontSpec));
+                        if (!list->glyphs) {
+                                fprintf(stderr, "Error: Failed to allocate memory for display list.\n");
+                                exit(1);
+                        }
+                }
+                spec = &list->glyphs[list->glyph_count++];
+                spec->font = font;
+                spec->glyph = XftCharIndex(dpy, font, utf8_char(text, len, &char_len));
+                spec->x = x;
+                spec->y = y;
+                XftGlyphExtents(dpy, font, &spec->glyph, 1, &extents);
+                if (extents.width > 0 && extents.height > 0)
+                        union_rect(ink, x - extents.x, y - extents.y, extents.width, extents.height);
+                x += extents.xOff;
+                text += char_len;
+                len -= char_len;
+        }
+}
+
+
+/* grows rect to cover another one, a rect without width is empty */
+void union_rect(XRectangle* rect, int x, int y, int width, int height)
+{
+        int right = x + width;
+        int bottom = y + height;
+
+        if (rect->width > 0) {
+                if (rect->x < x)
+                        x = rect->x;
+                if (rect->y < y)
+                        y = rect->y;
+                if (rect->x + rect->width > right)
+                        right = rect->x + rect->width;
+                if (rect->y + rect->height > bottom)
+                        bottom = rect->y + rect->height;
+        }
+        rect->x = x;
+        rect->y = y;
+        rect->width = right - x;
+        rect->height = bottom - y;
+}
+
+
+/*
+ * Replays the ops of the build steps from first_step up to the target's
+ * step. With clip only the ops touching its rectangles are replayed,
+ * clipped to them. Runs of glyph ops that follow each other go out in
+ * one request.
+ */
+void replay_display_list(DisplayList* list, Display* dpy, RenderTarget* target, int screen, unsigned int first_step,
+                         XRectangle* clip, int clip_count)
+{
+        XRenderPictureAttributes attrs;
+        XRenderColor fill;
+        unsigned int i;
+        unsigned int j;
+
+        if (clip) {
+                XRenderSetPictureClipRectangles(dpy, target->picture, 0, 0, clip, clip_count);
+                XftDrawSetClipRectangles(target->draw, 0, 0, clip, clip_count);
+        }
+        for (i = 0; i < list->op_count; i = j) {
+                DrawOp* op = &list->ops[i];
+                unsigned int count;
+
+                j = i + 1;
+                if (!replays_op(op, first_step, target->step, clip, clip_count))
+                        continue;
+                switch (op->type) {
+                case DRAW_CLEAR:
+                        if (!clip) {
+                                clear_target(dpy, target, op->color);
+                                break;
+                        }
+                        fill.red = ((op->color >> 16) & 0xFF) * 0x101;
+                        fill.green = ((op->color >> 8) & 0xFF) * 0x101;
+                        fill.blue = (op->color & 0xFF) * 0x101;
+                        fill.alpha = 0xFFFF;
+                        XRenderFillRectangles(dpy, PictOpSrc, target->picture, &fill, clip, clip_count);
+                        break;
+                case DRAW_IMAGE:
+                        if (target->animate && op->item == zoom.item)
+                                render_zoomed_image(dpy, target, screen, &op->rect);
+                        else
+                                render_image(op->item->image, dpy, target, screen, &op->rect);
+                        break;
+                case DRAW_GLYPHS:
+                        count = op->count;
+                        while (j < list->op_count && list->ops[j].type == DRAW_GLYPHS
+                               && replays_op(&list->ops[j], first_step, target->step, clip, clip_count))
+                                count += list->ops[j++].count;
+                        XftDrawGlyphFontSpec(target->draw, &color, &list->glyphs[op->first], count);
+                        break;
+                }
+        }
+        if (clip) {
+                attrs.clip_mask = None;
+                XRenderChangePicture(dpy, target->picture, CPClipMask, &attrs);
+                XftDrawSetClip(target->draw, NULL);
+        }
+        target->damaged = true;
+}
+
+
+bool replays_op(DrawOp* op, unsigned int first_step, unsigned int last_step, XRectangle* clip, int clip_count)
+{
+        return op->step >= first_step && op->step <= last_step && (!clip || rect_touches(&op->rect, clip, clip_count));
+}
+
+
+/* what a target holds after drawing list at step, steps past its last one draw the same */
+unsigned long shown_hash(DisplayList* list, unsigned int step)
+{
+        if (step > list->steps)
+                step = list->steps;
+        return hash_bytes(list->hash, &step, sizeof(step));
+}
+
+
+/*
+ * Draws to at the target's step over from at from_step, which has to be
+ * what the target shows. Only the rectangles of ops that one list has
+ * and the other doesn't are repainted, so boxes the two slides share
+ * stay as they are on screen. A later step of the same slide only draws
+ * the ops it reveals over what is there.
+ */
+void render_slide_change(Slide* from, unsigned int from_step, Slide* to, Display* dpy, RenderTarget* target, int screen)
+{
+        DisplayList* old = from->display;
+        DisplayList* list;
+        DisplayList scratch;
+        XRectangle rects[DIFF_MAX_RECTS];
+        int count;
+
+        measure_target(dpy, target);
+        if (!old || !to->display || shown_hash(old, from_step) != target->shown || old->width != target->width
+            || old->height != target->height || old->fonts != text_fonts.generation) {
+                render_slide(*to, dpy, target, screen);
+                return;
+        }
+        list = slide_display_list(dpy, screen, to, target, &scratch);
+        /* compiling may have closed a font the old list uses */
+        if (old->fonts != text_fonts.generation) {
+                render_slide(*to, dpy, target, screen);
+                return;
+        }
+        if (list == old && target->step > from_step && !reveal_overlaps(list, from_step, target->step)) {
+                replay_display_list(list, dpy, target, screen, from_step + 1, NULL, 0);
+        }
+        else {
+                count = diff_display_lists(old, from_step, list, target->step, rects);
+                if (count > 0)
+                        replay_display_list(list, dpy, target, screen, 0, rects, count);
+        }
+        target->shown = shown_hash(list, target->step);
+}
+
+
+/* true when an op revealed by the steps up to to_step would go under one that is drawn already */
+bool reveal_overlaps(DisplayList* list, unsigned int from_step, unsigned int to_step)
+{
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < list->op_count; i++) {
+                if (list->ops[i].step <= from_step || list->ops[i].step > to_step)
+                        continue;
+                for (j = i + 1; j < list->op_count; j++) {
+                        if (list->ops[j].step <= from_step && rect_touches(&list->ops[i].rect, &list->ops[j].rect, 1))
+                                return true;
+                }
+        }
+        return false;
+}
+
+
+/*
+ * The rectangles to repaint to turn old at old_step into list at step,
+ * merged into one when there are too many. Ops of later steps are not
+ * drawn, so they don't count.
+ */
+int diff_display_lists(DisplayList* old, unsigned int old_step, DisplayList* list, unsigned int step, XRectangle* rects)
+{
+        bool* matched;
+        int count = 0;
+        unsigned int i;
+        unsigned int j;
+
+        matched = calloc(old->op_count ? old->op_count : 1, sizeof(bool));
+        if (!matched) {
+                fprintf(stderr, "Error: Failed to allocate memory for display list.\n");
+                exit(1);
+        }
+        for (i = 0; i < list->op_count; i++) {
+                DrawOp* op = &list->ops[i];
+                bool found = false;
+
+                if (op->step > step)
+                        continue;
+                for (j = 0; j < old->op_count; j++) {
+                        if (!matched[j] && old->ops[j].step <= old_step && old->ops[j].hash == op->hash) {
+                                matched[j] = true;
+                                found = true;
+                                break;
+                        }
+                }
+                if (!found)
+                        add_damage(rects, &count, &op->rect);
+        }
+        for (j = 0; j < old->op_count; j++) {
+                if (old->ops[j].step <= old_step && !matched[j])
+                        add_damage(rects, &count, &old->ops[j].rect);
+        }
+        free(matched);
+        return count;
+}
+
+
+/* adds rect to the damage, past DIFF_MAX_RECTS the damage becomes the box around all of it */
+void add_damage(XRectangle* rects, int* count, XRectangle* rect)
+{
+        int i;
+
+        if (rect->width == 0 || rect->height == 0)
+                return;
+        if (*count < DIFF_MAX_RECTS) {
+                rects[(*count)++] = *rect;
+                return;
+        }
+        for (i = 1; i < *count; i++)
+                union_rect(&rects[0], rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+        union_rect(&rects[0], rect->x, rect->y, rect->width, rect->height);
+        *count = 1;
+}
+
+
+bool rect_touches(XRectangle* rect, XRectangle* rects, int count)
+{
+        int i;
+
+        for (i = 0; i < count; i++) {
+                if (rect->x < rects[i].x + rects[i].width && rects[i].x < rect->x + rect->width
+                    && rect->y < rects[i].y + rects[i].height && rects[i].y < rect->y + rect->height)
+                        return true;
+        }
+        return false;
+}
+
+
+DisplayList* new_display_list(Arena* arena)
+{
+        DisplayList* list = arena_alloc(arena, sizeof(DisplayList));
+
+        memset(list, 0, sizeof(DisplayList));
+        arena_defer(arena, free_display_list, list);
+        return list;
+}
+
+
+void free_display_list(void* ptr)
+{
+        DisplayList* list = ptr;
+
+        free(list->ops);
+        free(list->glyphs);
+}
+
+
+/*
+ * The font for text of size pixels. Opening a font matches it through
+ * fontconfig every time, so fonts stay open and the one used longest
+ * ago is closed when the cache is full. Closing one changes the
+ * generation, which makes display lists holding it compile again.
+ */
+XftFont* text_font(Display* dpy, int screen, double size)
+{
+        TextFont* entry = NULL;
+        unsigned int i;
+
+        text_fonts.uses++;
+        for (i = 0; i < text_fonts.count; i++) {
+                if (text_fonts.fonts[i].size == size) {
+                        text_fonts.fonts[i].used = text_fonts.uses;
+                        return text_fonts.fonts[i].font;
+                }
+        }
+        if (text_fonts.count < TEXT_FONT_CACHE) {
+                entry = &text_fonts.fonts[text_fonts.count++];
+        }
+        else {
+                entry = &text_fonts.fonts[0];
+                for (i = 1; i < text_fonts.count; i++) {
+                        if (text_fonts.fonts[i].used < entry->used)
+                                entry = &text_fonts.fonts[i];
+                }
+                XftFontClose(dpy, entry->font);
+                text_fonts.generation++;
+        }
+        entry->size = size;
+        entry->used = text_fonts.uses;
+        entry->font = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name, XFT_SIZE, XftTypeDouble, size, NULL);
+        if (!entry->font) {
+                fprintf(stderr, "Failed to load font: %s\n", global_font_name);
+                exit(1);
+        }
+        return entry->font;
+}
+
+
+void close_text_fonts(Display* dpy)
+{
+        unsigned int i;
+
+        for (i = 0; i < text_fonts.count; i++)
+                XftFontClose(dpy, text_fonts.fonts[i].font);
+        text_fonts.count = 0;
+        text_fonts.generation++;
+}
+
+
+/* the character at the start of UTF-8 text, a byte that doesn't start a valid sequence is taken as Latin-1 */
+FcChar32 utf8_char(const char* text, int len, int* char_len)
+{
+        const unsigned char* s = (const unsigned char*)text;
+        FcChar32 c;
+        int n;
+        int i;
+
+        if (s[0] < 0x80) {
+                *char_len = 1;
+                return s[0];
+        }
+        if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+                n = 2;
+                c = s[0] & 0x1F;
+        }
+        else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+                n = 3;
+                c = s[0] & 0x0F;
+        }
+        else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+                n = 4;
+                c = s[0] & 0x07;
+        }
+        else {
+                n = 0;
+                c = 0;
+        }
+        for (i = 1; i < n && i < len && (s[i] & 0xC0) == 0x80; i++)
+                c = (c << 6) | (s[i] & 0x3F);
+        /* cut short, overlong, a surrogate or past the last code point */
+        if (n == 0 || i < n || (n == 3 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF)))
+            || (n == 4 && (c < 0x10000 || c > 0x10FFFF))) {
+                *char_len = 1;
+                return s[0];
+        }
+        *char_len = n;
+        return c;
+}
+
+
+/* the width of len bytes of UTF-8 text, measured the way add_text_glyphs places it */
+int text_advance(Display* dpy, XftFont* font, const char* text, int len)
+{
+        int width = 0;
+
+        while (len > 0) {
+                XGlyphInfo extents;
+                FT_UInt glyph;
+                int char_len;
+
+                glyph = XftCharIndex(dpy, font, utf8_char(text, len, &char_len));
+                XftGlyphExtents(dpy, font, &glyph, 1, &extents);
+                width += extents.xOff;
+                text += char_len;
+                len -= char_len;
+        }
+        return width;
+}
+
+
+/* draws len bytes of UTF-8 text on the baseline y, for the text outside slides */
+void draw_utf8(XftDraw* draw, XftColor* text_color, XftFont* font, int x, int y, const char* text, int len)
+{
+        Display* dpy = XftDrawDisplay(draw);
+        XftGlyphSpec specs[64];
+        int count = 0;
+
+        while (len > 0) {
+                XGlyphInfo extents;
+                int char_len;
+
+                specs[count].glyph = XftCharIndex(dpy, font, utf8_char(text, len, &char_len));
+                specs[count].x = x;
+                specs[count].y = y;
+                XftGlyphExtents(dpy, font, &specs[count].glyph, 1, &extents);
+                x += extents.xOff;
+                text += char_len;
+                len -= char_len;
+                if (++count == 64 || len <= 0) {
+                        XftDrawGlyphSpec(draw, text_color, font, specs, count);
+                        count = 0;
+                }
+        }
+}
+
+
+/* the frame an animated image is at, uploading it the first time it is shown */
+Picture animation_picture(Display* dpy, Drawable drawable, int screen, Image* image)
+{
+        GifAnimation* anim = image->anim;
+        GifFrame* frame;
+
+        if (image->picture == None)
+                upload_image(dpy, drawable, screen, image, false);
+        if (image->sequence)
+                return image->sequence->uploaded ? image->sequence->picture : image->picture;
+        frame = &anim->frames[anim->shown];
+        /* ring frames are uploaded as they are decoded, until then the image is the first frame */
+        if (anim->stopped || (!anim->streaming && anim->shown == 0) || (anim->streaming && frame->picture == None))
+                return image->picture;
+        if (frame->picture == None) {
+                frame->picture = upload_pixels(dpy, drawable, screen, frame->data, image->width, image->height, &frame->pixmap);
+                x_resource_bytes += (size_t)image->width * image->height * 4;
+        }
+        return frame->picture;
+}
+
+
+void free_animation_resources(Image* image)
+{
+        GifAnimation* anim = image->anim;
+        ImageSequence* seq = image->sequence;
+        unsigned int i;
+
+        if (seq && seq->picture != None) {
+                XRenderFreePicture(x_resources.dpy, seq->picture);
+                XFreePixmap(x_resources.dpy, seq->pixmap);
+                seq->picture = None;
+                seq->pixmap = None;
+                seq->uploaded = false;
+                x_resources.live -= 2;
+                x_resource_bytes -= (size_t)image->width * image->height * 4;
+        }
+        for (i = 0; anim && i < anim->frame_count; i++) {
+                if (anim->frames[i].picture == None)
+                        continue;
+                XRenderFreePicture(x_resources.dpy, anim->frames[i].picture);
+                XFreePixmap(x_resources.dpy, anim->frames[i].pixmap);
+                anim->frames[i].picture = None;
+                anim->frames[i].pixmap = None;
+                x_resources.live -= 2;
+                x_resource_bytes -= (size_t)image->width * image->height * 4;
+        }
+}
+
+
+/* where an item of a box goes in a window of width by height, false when it has no area */
+bool item_rect(Box* box, LayoutItem* item, int width, int height, XRectangle* rect)
+{
+        int box_x = box->x * width;
+        int box_y = box->y * height;
+        int box_width = box->width * width;
+        int box_height = box->height * height;
+        int item_width = item->rwidth * box_width;
+        int item_height = item->rheight * box_height;
+
+        if (item_width <= 0 || item_height <= 0)
+                return false;
+        rect->x = box_x + item->x * box_width;
+        rect->y = box_y + item->y * box_height;
+        rect->width = item_width;
+        rect->height = item_height;
+        return true;
+}
+
+
+/* the still image on top at x, y in the audience window, or NULL */
+LayoutItem* image_at(Slide* slide, int x, int y, Box** box_return)
+{
+        LayoutItem* found = NULL;
+        unsigned int i;
+        unsigned int j;
+
+        for (i = 0; i < slide->element_count; i++) {
+                Box* box;
+
+                if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
+                        LayoutItem* item = image_at(slide->elements[i]->element.slide, x, y, box_return);
+
+                        if (item)
+                                found = item;
+                        continue;
+                }
+                if (slide->elements[i]->type != ELEMENT_TYPE_BOX)
+                        continue;
+                box = slide->elements[i]->element.box;
+                for (j = 0; j < box->item_count; j++) {
+                        LayoutItem* item = &box->items[j];
+                        XRectangle rect;
+
+                        if (item->type != ELEMENT_TYPE_IMAGE || item->step > window_target.step
+                            || item->image->anim || item->image->sequence)
+                                continue;
+                        if (!item_rect(box, item, window_target.width, window_target.height, &rect))
+                                continue;
+                        if (x >= rect.x && x < rect.x + rect.width && y >= rect.y && y < rect.y + rect.height) {
+                                found = item;
+                                *box_return = box;
+                        }
+                }
+        }
+        return found;
+}
+
+
+/* Ctrl and the wheel zoom the image under the pointer, keeping the pixel under it in place */
+void zoom_at(Viewer* viewer, int x, int y, bool in)
+{
+        Slide* slide = animated_slide(viewer);
+        LayoutItem* item;
+        Image* image;
+        Box* box = NULL;
+        XRectangle rect;
+        double scale;
+        double max_scale;
+        double offset_x;
+        double offset_y;
+
+        if (!slide)
+                return;
+        item = image_at(slide, x, y, &box);
+        if (!item || (item != zoom.item && !in))
+                return;
+        image = item->image;
+        if (!item_rect(box, item, window_target.width, window_target.height, &rect))
+                return;
+        max_scale = (double)ZOOM_MAX_PIXEL * image->width / rect.width;
+        if (item != zoom.item) {
+                if (max_scale <= 1)
+                        return;
+                end_zoom(viewer->dpy, viewer->screen, true);
+                zoom.item = item;
+                zoom.box = box;
+                zoom.scale = 1;
+                zoom.center_x = image->width / 2.0;
+                zoom.center_y = image->height / 2.0;
+        }
 
-        render_slide(*list.slides[*slide_idx], dpy, window, screen);
-        update_title(dpy, window, list, *slide_idx);
+        scale = in ? zoom.scale * ZOOM_STEP : zoom.scale / ZOOM_STEP;
+        if (scale > max_scale)
+                scale = max_scale;
+        if (scale <= 1) {
+                end_zoom(viewer->dpy, viewer->screen, true);
+                return;
+        }
+        offset_x = x - rect.x - rect.width / 2.0;
+        offset_y = y - rect.y - rect.height / 2.0;
+        zoom.center_x += offset_x * image->width / rect.width * (1 / zoom.scale - 1 / scale);
+        zoom.center_y += offset_y * image->height / rect.height * (1 / zoom.scale - 1 / scale);
+        zoom.scale = scale;
+        clamp_zoom(image);
+        zoom.dirty = true;
 }
 
-void toggle_fullscreen(Display* dpy, Window window, int screen, XEvent e, bool fullscreen)
+
+/* keeps the view inside the image */
+void clamp_zoom(Image* image)
 {
-        Atom wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-        Atom wm_state_fullscreen = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
+        double half_width = image->width / (2 * zoom.scale);
+        double half_height = image->height / (2 * zoom.scale);
+
+        if (zoom.center_x < half_width)
+                zoom.center_x = half_width;
+        if (zoom.center_x > image->width - half_width)
+                zoom.center_x = image->width - half_width;
+        if (zoom.center_y < half_height)
+                zoom.center_y = half_height;
+        if (zoom.center_y > image->height - half_height)
+                zoom.center_y = image->height - half_height;
+}
 
-        e.xany.type = ClientMessage;
-        e.xclient.message_type = wm_state;
-        e.xclient.format = 32;
-        e.xclient.window = window;
-        e.xclient.data.l[0] = fullscreen ? 1 : 0;
-        e.xclient.data.l[1] = wm_state_fullscreen;
-        e.xclient.data.l[3] = 0l;
 
-        XSendEvent(dpy, RootWindow(dpy, screen), 0, SubstructureNotifyMask | SubstructureRedirectMask, &e);
+/* true when the press is on the zoomed image, which then follows the pointer until release */
+bool start_pan(int x, int y)
+{
+        XRectangle rect;
+
+        if (!zoom.item || !item_rect(zoom.box, zoom.item, window_target.width, window_target.height, &rect))
+                return false;
+        if (x < rect.x || x >= rect.x + rect.width || y < rect.y || y >= rect.y + rect.height)
+                return false;
+        zoom.dragging = true;
+        zoom.drag_x = x;
+        zoom.drag_y = y;
+        return true;
 }
 
 
-void skip_templates(SlideList list, unsigned int* slide_idx)
+void pan_zoom(int x, int y)
 {
-        if (list.count == 0)
-                return;
-        while (!list.slides[*slide_idx]->visible) {
-                (*slide_idx) ++;
-                if (*slide_idx >= list.count) {
-                        *slide_idx -= 1;
-                        break;
-                }
+        Image* image = zoom.item->image;
+        XRectangle rect;
+
+        if (item_rect(zoom.box, zoom.item, window_target.width, window_target.height, &rect)) {
+                zoom.center_x -= (x - zoom.drag_x) * image->width / (zoom.scale * rect.width);
+                zoom.center_y -= (y - zoom.drag_y) * image->height / (zoom.scale * rect.height);
+                clamp_zoom(image);
+                zoom.dirty = true;
         }
+        zoom.drag_x = x;
+        zoom.drag_y = y;
 }
 
 
-void update_title(Display* dpy, Window window, SlideList list, unsigned int slide_idx)
+/* shows the whole image again, with redraw over the zoomed view, and frees its tiles */
+void end_zoom(Display* dpy, int screen, bool redraw)
 {
-        char* title;
-        if (slide_idx >= list.count) {
-                XStoreName(dpy, window, "End of Presentation.");
+        Image* image;
+        XRectangle rect;
+
+        if (!zoom.item)
                 return;
+        image = zoom.item->image;
+        if (redraw && item_rect(zoom.box, zoom.item, window_target.width, window_target.height, &rect)) {
+                if (image->picture == None)
+                        upload_image(dpy, window_target.drawable, screen, image, false);
+                composite_scaled(dpy, image->picture, image->width, image->height, window_target.picture, &rect);
+                window_target.damaged = true;
         }
-        title = get_top_text(*list.slides[slide_idx]);
-        XStoreName(dpy, window, title);
+        free_zoom_tiles(image);
+        free(zoom.scratch);
+        zoom.scratch = NULL;
+        zoom.item = NULL;
+        zoom.dragging = false;
+        zoom.dirty = false;
 }
 
 
-char* get_top_text(Slide slide)
+/* draws the view once for all the wheel and drag events handled since the last frame */
+void sync_zoom(Viewer* viewer)
 {
-        unsigned int i, j;
-        for (i = 0; i < slide.element_count; i++) {
-                Box* box;
-                if (slide.elements[i]->type == ELEMENT_TYPE_SLIDE) {
-                        Slide* found_slide = slide.elements[i]->element.slide;
-                        return get_top_text(*found_slide);
-                }
-                if (slide.elements[i]->type != ELEMENT_TYPE_BOX) {
-                        continue;
-                }
-                box = slide.elements[i]->element.box;
-                for (j = 0; j < box->element_count; j++) {
-                        if (box->elements[j]->type == ELEMENT_TYPE_TEXT) {
-                                return box->elements[j]->element.text->content;
-                        }
-                }
-        }
+        XRectangle rect;
 
-        return NULL;
+        if (!zoom.dirty)
+                return;
+        zoom.dirty = false;
+        if (animated_slide(viewer) && item_rect(zoom.box, zoom.item, window_target.width, window_target.height, &rect)) {
+                render_zoomed_image(viewer->dpy, &window_target, viewer->screen, &rect);
+                window_target.damaged = true;
+        }
 }
 
 
-void render_endslide(Display* dpy, Window window, int screen)
+/*
+ * Composites the tiles in view over rect, each through a transform
+ * that maps rect's pixels onto the level, so neighbouring tiles meet
+ * exactly wherever the view is.
+ */
+void render_zoomed_image(Display* dpy, RenderTarget* target, int screen, XRectangle* rect)
 {
-        XWindowAttributes attrs;
-        XGlyphInfo extents;
-        XftFont* font;
-        const char* text = "End of presentation.";
-        double font_size;
+        Image* image = zoom.item->image;
+        ZoomLevel* level;
+        unsigned int index = 0;
+        double ratio = image->width / (zoom.scale * rect->width); /* image pixels per screen pixel */
+        double step_x;
+        double step_y;
+        double view_x; /* top left of the view in level pixels */
+        double view_y;
+        int first_x;
+        int first_y;
+        int last_x;
+        int last_y;
         int x;
         int y;
-        int text_width;
-        int text_height;
-
-        XGetWindowAttributes(dpy, window, &attrs);
-        font_size = 0.03 * attrs.width;
-
-        XSetWindowBackground(dpy, window, 0x000000);
-        XClearWindow(dpy, window);
-        font = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name, XFT_SIZE, XftTypeDouble, font_size, NULL);
-
-        XftTextExtents8(dpy, font, (XftChar8 *)text, strlen(text), &extents);
-        text_width = extents.width;
-        text_height = extents.height;
-
-        x = (attrs.width - text_width) / 2;
-        y = (attrs.height + text_height) / 2;
-
-        XftDrawString8(draw, &color_white, font, x, y, (XftChar8 *)text, strlen(text));
-        XftFontClose(dpy, font);
+        XTransform transform;
+
+        while (index + 1 < ZOOM_MAX_LEVELS && ratio >= (double)(2u << index))
+                index++;
+        index = zoom_level(image, index);
+        level = &image->pyramid->levels[index];
+        step_x = image->width / (zoom.scale * rect->width) / (1 << index);
+        step_y = image->height / (zoom.scale * rect->height) / (1 << index);
+        view_x = (zoom.center_x - image->width / (2 * zoom.scale)) / (1 << index);
+        view_y = (zoom.center_y - image->height / (2 * zoom.scale)) / (1 << index);
+        first_x = view_x > 0 ? view_x / ZOOM_TILE_SIZE : 0;
+        first_y = view_y > 0 ? view_y / ZOOM_TILE_SIZE : 0;
+        last_x = (view_x + rect->width * step_x) / ZOOM_TILE_SIZE;
+        last_y = (view_y + rect->height * step_y) / ZOOM_TILE_SIZE;
+        if (last_x > (level->width - 1) / ZOOM_TILE_SIZE)
+                last_x = (level->width - 1) / ZOOM_TILE_SIZE;
+        if (last_y > (level->height - 1) / ZOOM_TILE_SIZE)
+                last_y = (level->height - 1) / ZOOM_TILE_SIZE;
+
+        target->shown = 0;
+        /* tiles are freed with the image's own copy, so it has to be listed */
+        if (image->picture == None)
+                upload_image(dpy, target->drawable, screen, image, false);
+        if (!zoom.scratch) {
+                zoom.scratch = malloc(ZOOM_TILE_BYTES);
+                if (!zoom.scratch) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+        }
+        zoom.draws++;
+
+        memset(&transform, 0, sizeof(transform));
+        transform.matrix[0][0] = XDoubleToFixed(step_x);
+        transform.matrix[1][1] = XDoubleToFixed(step_y);
+        transform.matrix[2][2] = XDoubleToFixed(1.0);
+        for (y = first_y; y <= last_y; y++) {
+                int top = rect->y + floor((y * ZOOM_TILE_SIZE - view_y) / step_y + 0.5);
+                int bottom = rect->y + floor(((y + 1) * ZOOM_TILE_SIZE - view_y) / step_y + 0.5);
+
+                if (top < rect->y)
+                        top = rect->y;
+                if (bottom > rect->y + rect->height)
+                        bottom = rect->y + rect->height;
+                for (x = first_x; x <= last_x; x++) {
+                        int left = rect->x + floor((x * ZOOM_TILE_SIZE - view_x) / step_x + 0.5);
+                        int right = rect->x + floor(((x + 1) * ZOOM_TILE_SIZE - view_x) / step_x + 0.5);
+                        Picture picture;
+
+                        if (left < rect->x)
+                                left = rect->x;
+                        if (right > rect->x + rect->width)
+                                right = rect->x + rect->width;
+                        if (right <= left || bottom <= top)
+                                continue;
+                        picture = zoom_tile(dpy, target->drawable, screen, image, index, x, y);
+                        /* the tile's border pixel comes first */
+                        transform.matrix[0][2] = XDoubleToFixed(view_x - x * ZOOM_TILE_SIZE + (left - rect->x) * step_x + 1);
+                        transform.matrix[1][2] = XDoubleToFixed(view_y - y * ZOOM_TILE_SIZE + (top - rect->y) * step_y + 1);
+                        XRenderSetPictureTransform(dpy, picture, &transform);
+                        XRenderComposite(dpy, PictOpSrc, picture, None, target->picture,
+                                         0, 0, 0, 0, left, top, right - left, bottom - top);
+                }
+        }
 }
 
 
-void render_slide(Slide slide, Display* dpy, Window window, int screen)
+/* the server copy of a tile, uploading it into the least recently drawn one when it isn't there */
+Picture zoom_tile(Display* dpy, Drawable drawable, int screen, Image* image, unsigned int level, int x, int y)
 {
+        ZoomPyramid* pyramid = image->pyramid;
+        ZoomTile* tile = NULL;
         unsigned int i;
-        unsigned int window_width;
-        unsigned int window_height;
-        XWindowAttributes attrs;
 
-        XGetWindowAttributes(dpy, window, &attrs);
-        window_width = attrs.width;
-        window_height = attrs.height;
-
-        XSetWindowBackground(dpy, window, 0xFFFFFF);
-        XClearWindow(dpy, window);
-        for (i = 0; i < slide.element_count; i++) {
-                if (slide.elements[i]->type == ELEMENT_TYPE_BOX) {
-                        Box* b = slide.elements[i]->element.box;
-                        render_box(*b, window_width, window_height, dpy, window, screen);
+        for (i = 0; i < pyramid->tile_count; i++) {
+                tile = &pyramid->tiles[i];
+                if (tile->level == level && tile->x == x && tile->y == y) {
+                        tile->used = zoom.draws;
+                        return tile->picture;
                 }
-                else if (slide.elements[i]->type == ELEMENT_TYPE_SLIDE) {
-                        Slide* found_slide = slide.elements[i]->element.slide;
-                        render_slide(*found_slide, dpy, window, screen);
+        }
+        if (!pyramid->tiles) {
+                pyramid->tiles = malloc(ZOOM_MAX_TILES * sizeof(ZoomTile));
+                if (!pyramid->tiles) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+        }
+        if (pyramid->tile_count < ZOOM_MAX_TILES) {
+                tile = &pyramid->tiles[pyramid->tile_count++];
+                tile->picture = None;
+        }
+        else {
+                /* a tile already drawn this time can be reused too, X keeps requests in order */
+                tile = &pyramid->tiles[0];
+                for (i = 1; i < pyramid->tile_count; i++) {
+                        if (pyramid->tiles[i].used < tile->used)
+                                tile = &pyramid->tiles[i];
                 }
         }
+
+        cut_zoom_tile(&pyramid->levels[level], x, y, zoom.scratch);
+        if (tile->picture == None) {
+                tile->picture = upload_pixels(dpy, drawable, screen, zoom.scratch,
+                                              ZOOM_TILE_SIZE + 2, ZOOM_TILE_SIZE + 2, &tile->pixmap);
+                x_resource_bytes += ZOOM_TILE_BYTES;
+        }
+        else {
+                put_pixels(dpy, tile->pixmap, screen, zoom.scratch, ZOOM_TILE_SIZE + 2, ZOOM_TILE_SIZE + 2);
+        }
+        tile->level = level;
+        tile->x = x;
+        tile->y = y;
+        tile->used = zoom.draws;
+        return tile->picture;
 }
 
 
-void render_box(Box box, unsigned int window_width, unsigned int window_height, Display* dpy, Window window, int screen)
+void free_zoom_tiles(Image* image)
 {
+        ZoomPyramid* pyramid = image->pyramid;
         unsigned int i;
-        int box_x = box.x * window_width;
-        int box_y = box.y * window_height;
-        int box_width = box.width * window_width;
-        int box_height = box.height * window_height;
 
-        for (i = 0; i < box.element_count; i++) {
-                switch(box.elements[i]->type) {
-                case ELEMENT_TYPE_TEXT:
-                        render_text(*(box.elements[i]->element.text), dpy, screen, box_x, box_y, box_width, box_height, window_width);
-                        break;
-                case ELEMENT_TYPE_IMAGE:
-                        render_image(*(box.elements[i]->element.image), dpy, window, screen, box_x, box_y, box_width, box_height);
-                        break;
-                default:
-                        break;
-                }
+        if (!pyramid)
+                return;
+        for (i = 0; i < pyramid->tile_count; i++) {
+                XRenderFreePicture(x_resources.dpy, pyramid->tiles[i].picture);
+                XFreePixmap(x_resources.dpy, pyramid->tiles[i].pixmap);
+                x_resources.live -= 2;
+                x_resource_bytes -= ZOOM_TILE_BYTES;
         }
+        free(pyramid->tiles);
+        pyramid->tiles = NULL;
+        pyramid->tile_count = 0;
 }
 
 
-void render_text(Text text, Display* dpy, int screen, int box_x, int box_y, int box_w, int box_h, int window_width)
+void render_image(Image* image, Display* dpy, RenderTarget* target, int screen, XRectangle* rect)
 {
-        XftFont* font;
-        int text_x = box_x + text.x * box_w;
-        int text_y = box_y + text.y * box_h;
-        double font_size = text.size * window_width;
+        Picture picture;
+        int src_width = image->width;
+        int src_height = image->height;
+
+        if (target->use_proxies && image->proxy_state == PROXY_READY && image->proxy_data) {
+                if (image->proxy_picture == None)
+                        upload_image(dpy, target->drawable, screen, image, true);
+                picture = image->proxy_picture;
+                src_width = image->proxy_width;
+                src_height = image->proxy_height;
+        }
+        else {
+                if (image->picture == None)
+                        upload_image(dpy, target->drawable, screen, image, false);
+                picture = image->picture;
+                if (target->animate && (image->anim || image->sequence))
+                        picture = animation_picture(dpy, target->drawable, screen, image);
+        }
+        composite_scaled(dpy, picture, src_width, src_height, target->picture, rect);
+}
+
 
-        font = XftFontOpen(dpy, screen, XFT_FAMILY, XftTypeString, global_font_name, XFT_SIZE, XftTypeDouble, font_size, NULL);
+/* windows can change size between frames, keep the target in sync */
+void measure_target(Display* dpy, RenderTarget* target)
+{
+        XWindowAttributes attrs;
 
-        XftDrawString8(draw, &color, font, text_x, text_y, (XftChar8 *)text.content, strlen(text.content));
-        XftFontClose(dpy, font);
+        if (target->window == None)
+                return;
+        XGetWindowAttributes(dpy, target->window, &attrs);
+        target->width = attrs.width;
+        target->height = attrs.height;
+        if (target->drawable != target->window)
+                resize_back_buffer(dpy, target);
 }
 
 
-void render_image(Image image, Display* dpy, Window window, int screen, int box_x, int box_y, int box_w, int box_h)
+/* the back buffer follows the window's size and keeps what was drawn so far */
+void resize_back_buffer(Display* dpy, RenderTarget* target)
 {
-        int img_x = box_x + image.x * box_w;
-        int img_y = box_y + image.y * box_h;
-        int img_width = image.rwidth * box_w;
-        int img_height = image.rheight * box_h;
-        int x;
-        int y;
+        int screen = DefaultScreen(dpy);
+        int width;
+        int height;
+        Pixmap back;
+        Picture picture;
 
-        Pixmap pixmap = XCreatePixmap(dpy, window, img_width, img_height, DefaultDepth(dpy, screen));
-        XImage* scaled_ximage = XCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen), ZPixmap, 0, NULL, img_width, img_height, 32, 0);
-        Picture img_pic;
+        if (target->width <= 0 || target->height <= 0) {
+                XWindowAttributes attrs;
 
-        scaled_ximage->data = (char*) malloc(scaled_ximage->bytes_per_line * img_height);
+                XGetWindowAttributes(dpy, target->window, &attrs);
+                target->width = attrs.width;
+                target->height = attrs.height;
+        }
+        width = target->width > 0 ? target->width : 1;
+        height = target->height > 0 ? target->height : 1;
+        if (x_resources.back != None && width == x_resources.back_width && height == x_resources.back_height)
+                return;
 
-        for (y = 0; y < img_height; y++) {
-                for (x = 0; x < img_width; x++) {
-                        int src_x = x * image.width / img_width;
-                        int src_y = y * image.height / img_height;
-                        long pixel = XGetPixel(image.ximage, src_x, src_y);
-                        XPutPixel(scaled_ximage, x, y, pixel);
-                }
+        back = XCreatePixmap(dpy, target->window, width, height, DefaultDepth(dpy, screen));
+        picture = XRenderCreatePicture(dpy, back, x_resources.format, 0, NULL);
+        x_resources.live += 2;
+        x_resource_bytes += (size_t)width * height * 4;
+        if (x_resources.back != None) {
+                XCopyArea(dpy, x_resources.back, back, DefaultGC(dpy, screen), 0, 0,
+                          x_resources.back_width, x_resources.back_height, 0, 0);
+                XRenderFreePicture(dpy, x_resources.back_picture);
+                XFreePixmap(dpy, x_resources.back);
+                x_resources.live -= 2;
+                x_resource_bytes -= (size_t)x_resources.back_width * x_resources.back_height * 4;
         }
+        x_resources.back = back;
+        x_resources.back_picture = picture;
+        x_resources.back_width = width;
+        x_resources.back_height = height;
+        target->drawable = back;
+        target->picture = picture;
+        if (target->draw)
+                XftDrawChange(target->draw, back);
+}
 
-        XPutImage(dpy, pixmap, DefaultGC(dpy, screen), scaled_ximage, 0, 0, 0, 0, img_width, img_height);
-        img_pic = XRenderCreatePicture(dpy, pixmap, image.xrenderformat, 0, NULL);
 
-        XRenderComposite(dpy, PictOpSrc, img_pic, None, image.src, 0, 0, 0, 0, img_x, img_y, img_width, img_height);
+/* pixmaps and back buffers have no background, so they are filled instead of cleared */
+void clear_target(Display* dpy, RenderTarget* target, unsigned long pixel)
+{
+        XRenderColor fill;
 
-        XFreePixmap(dpy, pixmap);
-        XRenderFreePicture(dpy, img_pic);
-        XDestroyImage(scaled_ximage);
+        target->damaged = true;
+        target->shown = 0;
+        if (target->window != None && target->drawable == target->window) {
+                XSetWindowBackground(dpy, target->window, pixel);
+                XClearWindow(dpy, target->window);
+                return;
+        }
+        fill.red = ((pixel >> 16) & 0xFF) * 0x101;
+        fill.green = ((pixel >> 8) & 0xFF) * 0x101;
+        fill.blue = (pixel & 0xFF) * 0x101;
+        fill.alpha = 0xFFFF;
+        XRenderFillRectangle(dpy, PictOpSrc, target->picture, &fill, 0, 0, target->width, target->height);
 }
 
 
-void apply_layout(Slide* slide, Display* dpy, Window window)
+void apply_layout(Arena* arena, Slide* slide, Display* dpy, Window window)
 {
         float total_height = 0;
         int total_hboxes = 0;
@@ -716,19 +6269,21 @@ void apply_layout(Slide* slide, Display* dpy, Window window)
 
         unsigned int i;
 
+        slide->display = new_display_list(arena);
+
         /* calculate default box size */
         for (i = 0; i < slide->element_count; i++) {
                 Box* box;
                 if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
                         Slide* nested_slide = slide->elements[i]->element.slide;
-                        apply_layout(nested_slide, dpy, window);
+                        apply_layout(arena, nested_slide, dpy, window);
                 }
                 else if (slide->elements[i]->type != ELEMENT_TYPE_BOX)
                         continue;
                 box = slide->elements[i]->element.box;
                 if (box->stack_type == STACK_VERTICAL) {
                         box->width = 1.0f;
-                        apply_word_wrap(dpy, window, box);
+                        apply_word_wrap(arena, dpy, window, box);
                         box->height = calculate_vbox_height(dpy, window, box) / 1.0f;
                         total_height += box->height;
                 }
@@ -754,7 +6309,7 @@ void apply_layout(Slide* slide, Display* dpy, Window window)
                                 in_row = true;
                         }
                         box->width = hbox_width;
-                        apply_word_wrap(dpy, window, box);
+                        apply_word_wrap(arena, dpy, window, box);
                 }
                 else if (box->stack_type == STACK_VERTICAL) {
                         in_row = false;
@@ -810,16 +6365,16 @@ void position_elements(Box* box, Display* dpy, Window window)
         padding = (attr.width * padding_percent) / (box->width * attr.width);
         current_y = padding;
 
-        for (i = 0; i < box->element_count; i++) {
-                if (box->elements[i]->type == ELEMENT_TYPE_TEXT) {
-                        Text* text = box->elements[i]->element.text;
+        for (i = 0; i < box->item_count; i++) {
+                if (box->items[i].type == ELEMENT_TYPE_TEXT) {
+                        LayoutItem* text = &box->items[i];
                         float text_width;
                         float line_height;
 
                         text_width = (get_text_width(*text, dpy) / attr.width) / box->width;
                         line_height = get_line_height(*text, box_height_px);
 
-                        if (box->element_count == 1) {
+                        if (box->item_count == 1) {
                                 /* vertically center text if theres only one element */
                                 text->y = 0.5f + (line_height / 2);
                         }
@@ -841,46 +6396,41 @@ void position_elements(Box* box, Display* dpy, Window window)
                         }
 
                 }
-                else if (box->elements[i]->type == ELEMENT_TYPE_IMAGE) {
-                        Image* image = box->elements[i]->element.image;
-                        int screen = DefaultScreen(dpy);
+                else if (box->items[i].type == ELEMENT_TYPE_IMAGE) {
+                        LayoutItem* item = &box->items[i];
+                        Image* image = item->image;
                         float img_scale = 0.9f;
                         float img_aspect_ratio = (float)image->width / image->height;
 
+                        item->rwidth = img_scale;
+                        item->rheight = img_scale / img_aspect_ratio;
 
-                        image->xrenderformat = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, 0));
-                        image->src = XRenderCreatePicture(dpy, window, image->xrenderformat, 0, NULL);
-                        image->ximage = XCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen), ZPixmap, 0, (char*)image->data, image->width, image->height, 32, 0);
+                        item->rheight = item->rheight * box_aspect_ratio;
 
-                        image->rwidth = img_scale;
-                        image->rheight = img_scale / img_aspect_ratio;
-
-                        image->rheight = image->rheight * box_aspect_ratio;
-
-                        if (image->rheight > box->height - current_y) {
-                                image->rheight = box->height - current_y;
-                                image->rwidth = image->rheight * img_aspect_ratio / box_aspect_ratio;
+                        if (item->rheight > box->height - current_y) {
+                                item->rheight = box->height - current_y;
+                                item->rwidth = item->rheight * img_aspect_ratio / box_aspect_ratio;
                         }
 
-                        if (box->element_count == 1) {
+                        if (box->item_count == 1) {
                                 /* vertically center image if theres only one element */
-                                image->y = 0.5f - (image->rheight / 2);
+                                item->y = 0.5f - (item->rheight / 2);
                         }
                         else {
-                                image->y = current_y;
+                                item->y = current_y;
                         }
 
-                        current_y += image->rheight;
+                        current_y += item->rheight;
 
                         switch (box->text_align) {
                         case TEXT_ALIGN_LEFT:
-                                image->x = padding;
+                                item->x = padding;
                                 break;
                         case TEXT_ALIGN_CENTER:
-                                image->x = 0.5f - image->rwidth / 2;
+                                item->x = 0.5f - item->rwidth / 2;
                                 break;
                         case TEXT_ALIGN_RIGHT:
-                                image->x = 1.0f - image->rwidth - padding;
+                                item->x = 1.0f - item->rwidth - padding;
                                 break;
                         }
                 }
@@ -898,42 +6448,74 @@ float get_char_width(const char c, FontSize size, Display* dpy)
 
 float get_strtext_width(char* str, FontSize size, Display* dpy)
 {
-        XGlyphInfo extents;
-        XftTextExtentsUtf8(dpy, global_fonts[size], (FcChar8*) str, strlen(str), &extents);
-        return extents.xOff;
+        return text_advance(dpy, global_fonts[size], str, strlen(str));
 }
 
 
-float get_text_width(Text text, Display* dpy)
+float get_text_width(LayoutItem item, Display* dpy)
 {
-        XGlyphInfo extents;
-        int width = 0;
-        unsigned int i;
-        for (i = 0; i < strlen(text.content); i++) {
-                XftTextExtentsUtf8(dpy, global_fonts[text.font_size], (FcChar8*) &text.content[i], 1, &extents);
-                width += extents.xOff;
-        }
-        return width;
+        return text_advance(dpy, global_fonts[item.font_size], item.content, strlen(item.content));
+}
+
+
+float get_line_height(LayoutItem item, int box_height)
+{
+        return (float) global_fonts[item.font_size]->height / (float)box_height;
+}
+
+
+float get_font_ascent(LayoutItem item, int box_height)
+{
+        return (float)global_fonts[item.font_size]->ascent / (float)box_height;
 }
 
 
-float get_line_height(Text text, int box_height)
+/* (re)starts the box layout from its parsed content, one item per element */
+void init_layout_items(Arena* arena, Box* box)
 {
-        return (float) global_fonts[text.font_size]->height / (float)box_height;
+        unsigned int i;
+
+        box->item_count = 0;
+        box->item_capacity = box->element_count;
+        box->items = box->element_count ? arena_alloc(arena, box->element_count * sizeof(LayoutItem)) : NULL;
+
+        for (i = 0; i < box->element_count; i++) {
+                SlideElement* se = box->elements[i];
+                LayoutItem* item;
+
+                if (se->type != ELEMENT_TYPE_TEXT && se->type != ELEMENT_TYPE_IMAGE)
+                        continue;
+                item = &box->items[box->item_count++];
+                item->type = se->type;
+                item->content = NULL;
+                item->image = NULL;
+                item->step = se->step;
+                if (se->type == ELEMENT_TYPE_TEXT) {
+                        item->font_size = se->element.text->font_size;
+                        item->content = se->element.text->content;
+                }
+                else {
+                        item->image = se->element.image;
+                }
+        }
 }
 
 
-float get_font_ascent(Text text, int box_height)
+void insert_layout_item(Arena* arena, Box* box, LayoutItem item, unsigned int index)
 {
-        return (float)global_fonts[text.font_size]->ascent / (float)box_height;
+        box->items = arena_grow(arena, box->items, sizeof(LayoutItem), box->item_count, &box->item_capacity);
+        memmove(&box->items[index + 1], &box->items[index], (box->item_count - index) * sizeof(LayoutItem));
+        box->items[index] = item;
+        box->item_count++;
 }
 
 
-void apply_word_wrap(Display* dpy, Window window, Box* box)
+void apply_word_wrap(Arena* arena, Display* dpy, Window window, Box* box)
 {
         float current_y = 0.0f;
         float padding_percent = 0.025f;
         float padding = 0.0f;
+        double start = now_ms();
         unsigned int i;
 
         XWindowAttributes attr;
@@ -941,16 +6523,18 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
         padding = (attr.width * padding_percent) / (box->width * attr.width);
         current_y = padding;
 
-        for (i = 0; i < box->element_count; i++) {
-                Text* text;
+        init_layout_items(arena, box);
+
+        for (i = 0; i < box->item_count; i++) {
+                LayoutItem* text;
                 float line_height;
                 float slide_text_width;
 
-                if (box->elements[i]->type != ELEMENT_TYPE_TEXT) {
+                if (box->items[i].type != ELEMENT_TYPE_TEXT) {
                         continue;
                 }
 
-                text = box->elements[i]->element.text;
+                text = &box->items[i];
 
                 switch (text->font_size) {
                 case FONT_HUGE:
@@ -978,7 +6562,7 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
                         float width = 0.0;
                         float max_width = 0.0;
                         float space_width = (get_char_width(' ', text->font_size, dpy) / attr.width) / 1.0f;
-                        char** split_text = split_str(text->content, " ", &split_len);
+                        char** split_text = split_str(arena, text->content, " ", &split_len);
                         char* new_line = NULL;
                         char* next_line = NULL;
                         FontSize fn = text->font_size;
@@ -992,7 +6576,7 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
 
                         if (max_width > box->width) {
                                 fprintf(stderr, "Error: Single word in text is wider than box width. In box: %s\n", box->name);
-                                exit(1);
+                                deck_error();
                         }
 
                         for (j = 0; j < split_len; j++) {
@@ -1008,7 +6592,7 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
                         for (j = 0; j < break_idx; j++)
                                 new_len += strlen(split_text[j]) + 1;
 
-                        new_line = malloc(new_len + 1);
+                        new_line = arena_string(arena, new_len);
                         new_line[0] = '\0';
 
                         for (j = 0; j < break_idx; j++) {
@@ -1016,45 +6600,41 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
                                 strcat(new_line, " ");
                         }
 
-                        free_text(box->elements[i]->element.text);
-                        create_text(&box->elements[i]->element.text, new_line, fn);
+                        text->content = new_line;
 
                         /* create the remaining line of text */
                         for (j = break_idx; j < split_len; j++)
                                 next_len += strlen(split_text[j]) + 1;
 
                         /* If theres a line of text below the current one, the remaining text will get combined with it */
-                        if (i + 1 < box->element_count && box->elements[i+1]->type == ELEMENT_TYPE_TEXT) {
-                                Text* next_text = box->elements[i+1]->element.text;
+                        if (i + 1 < box->item_count && box->items[i+1].type == ELEMENT_TYPE_TEXT) {
+                                LayoutItem* next_text = &box->items[i+1];
                                 next_len += strlen(next_text->content);
-                                next_line = malloc(next_len + 1);
+                                next_line = arena_string(arena, next_len);
                                 next_line[0] = '\0';
                                 for (j = break_idx; j < split_len; j++) {
                                         strcat(next_line, split_text[j]);
                                         strcat(next_line, " ");
                                 }
                                 strcat(next_line, next_text->content);
-                                free_text(box->elements[i+1]->element.text);
-                                create_text(&(box->elements[i+1]->element.text), next_line, fn);
+                                next_text->content = next_line;
+                                next_text->font_size = fn;
                         }
                         else {
-                                SlideElement* se = alloc_slide_element(ELEMENT_TYPE_TEXT);
-                                Text* new_text = NULL;
+                                LayoutItem new_text = *text;
 
-                                next_line = malloc(next_len + 1);
+                                next_line = arena_string(arena, next_len);
                                 next_line[0] = '\0';
                                 for (j = break_idx; j < split_len; j++) {
                                         strcat(next_line, split_text[j]);
                                         strcat(next_line, " ");
                                 }
 
-                                create_text(&new_text, next_line, fn);
-                                se->element.text = new_text;
-                                add_element_to_box_at_index(box, se, i+1);
+                                new_text.content = next_line;
+                                insert_layout_item(arena, box, new_text, i+1);
                         }
 
                         i--;
-                        free_split_str(split_text, split_len);
                         continue;
                 }
 
@@ -1062,6 +6642,7 @@ void apply_word_wrap(Display* dpy, Window window, Box* box)
                 text->y = current_y + get_font_ascent(*text, attr.height);
                 current_y += line_height;
         }
+        bench_wrap_ms += now_ms() - start;
 }
 
 
@@ -1098,16 +6679,16 @@ float calculate_vbox_height(Display* dpy, Window window, Box* box)
         padding = (attr.width * padding_percent) / (box->width * attr.width);
         current_y = padding;
 
-        for (i = 0; i < box->element_count; i++) {
-                if (box->elements[i]->type == ELEMENT_TYPE_TEXT) {
-                        Text* text = box->elements[i]->element.text;
+        for (i = 0; i < box->item_count; i++) {
+                if (box->items[i].type == ELEMENT_TYPE_TEXT) {
+                        LayoutItem* text = &box->items[i];
                         float line_height;
                         line_height = get_line_height(*text, attr.height);
                         text->y = current_y + get_font_ascent(*text, attr.height);
                         current_y += line_height;
                 }
-                else if (box->elements[i]->type == ELEMENT_TYPE_IMAGE) {
-                        Image* image = box->elements[i]->element.image;
+                else if (box->items[i].type == ELEMENT_TYPE_IMAGE) {
+                        Image* image = box->items[i].image;
                         float img_scale = 1.0f;
                         current_y +=  (img_scale * image->height) / image->width;
                 }
@@ -1116,255 +6697,521 @@ float calculate_vbox_height(Display* dpy, Window window, Box* box)
 }
 
 
-Slide* copy_slide(Slide* slide)
+/*
+ * Creates a copy on write instance of a slide for uses:. The instance
+ * gets its own slide and box records (names, geometry, layout) but
+ * borrows every box's element array from the original. The borrowed
+ * arrays are marked with a capacity of zero, so the first define: that
+ * appends to one makes add_element_to_box copy it; texts, images and
+ * strings are never copied.
+ */
+Slide* instantiate_slide(Arena* arena, Slide* slide)
 {
         Slide* new_slide;
         unsigned int i;
-        create_slide(&new_slide, strdup(slide->name), true);
+        create_slide(arena, &new_slide, slide->name, true);
+        new_slide->steps = slide->steps;
         for (i = 0; i < slide->element_count; i++) {
                 if (slide->elements[i]->type == ELEMENT_TYPE_BOX) {
-                        Box* box = copy_box(slide->elements[i]->element.box);
-                        SlideElement* se = alloc_slide_element(ELEMENT_TYPE_BOX);
+                        Box* box = instantiate_box(arena, slide->elements[i]->element.box);
+                        SlideElement* se = alloc_slide_element(arena, ELEMENT_TYPE_BOX);
                         se->element.box = box;
 
-                        add_element_to_slide(new_slide, se);
+                        add_element_to_slide(arena, new_slide, se);
                 }
                 if (slide->elements[i]->type == ELEMENT_TYPE_SLIDE) {
-                        Slide* found_slide = copy_slide(slide->elements[i]->element.slide);
-                        SlideElement* se = alloc_slide_element(ELEMENT_TYPE_SLIDE);
+                        Slide* found_slide = instantiate_slide(arena, slide->elements[i]->element.slide);
+                        SlideElement* se = alloc_slide_element(arena, ELEMENT_TYPE_SLIDE);
                         se->element.slide = found_slide;
 
-                        add_element_to_slide(new_slide, se);
+                        add_element_to_slide(arena, new_slide, se);
                 }
         }
         return new_slide;
 }
 
 
-Box* copy_box(Box* box)
+Box* instantiate_box(Arena* arena, Box* box)
 {
         Box* new_box;
-        unsigned int i;
-        create_box(&new_box, strdup(box->name), box->stack_type, box->text_align);
-        for (i = 0; i < box->element_count; i++) {
-                if (box->elements[i]->type == ELEMENT_TYPE_TEXT) {
-                        Text* text = copy_text(box->elements[i]->element.text);
-                        SlideElement* se = alloc_slide_element(ELEMENT_TYPE_TEXT);
-                        se->element.text = text;
-
-                        add_element_to_box(new_box, se);
-                }
-                if (box->elements[i]->type == ELEMENT_TYPE_IMAGE) {
-                        Image* image = copy_image(box->elements[i]->element.image);
-                        SlideElement* se = alloc_slide_element(ELEMENT_TYPE_IMAGE);
-                        se->element.image = image;
-
-                        add_element_to_box(new_box, se);
-                }
-        }
+        create_box(arena, &new_box, box->name, box->stack_type, box->text_align);
+        new_box->elements = box->elements;
+        new_box->element_count = box->element_count;
         return new_box;
 }
 
 
-Text* copy_text(Text* text)
+Slide* find_slide_by_name(char* name, SlideList list)
 {
-        Text* new_text;
-        create_text(&new_text, strdup(text->content), text->font_size);
-        return new_text;
+        return name_table_get(&list.slide_index, name);
 }
 
 
-Image* copy_image(Image* image)
+/*
+ * Position of the visible slide called name, or else of the first one
+ * in alphabetical order whose name starts with it, -1 if there is none.
+ */
+int find_slide_position(SlideList* list, const char* name)
 {
-        Image* new_image;
-        create_image(&new_image, strdup(image->filename));
-        return new_image;
+        Slide* slide = name_table_get(&list->position_index, name);
+        unsigned int low = 0;
+        unsigned int high = list->named_count;
+
+        if (slide)
+                return slide->position;
+        while (low < high) {
+                unsigned int mid = low + (high - low) / 2;
+                if (strcmp(list->by_name[mid]->name, name) < 0)
+                        low = mid + 1;
+                else
+                        high = mid;
+        }
+        if (low < list->named_count && strncmp(list->by_name[low]->name, name, strlen(name)) == 0)
+                return list->by_name[low]->position;
+        return -1;
 }
 
 
-Slide* find_slide_by_name(char* name, SlideList list)
+void sort_slide_names(SlideList* list)
 {
         unsigned int i;
-        for (i = 0; i < list.count; i++) {
-                Slide* slide = list.slides[i];
-                if (strcmp(slide->name, name) == 0) {
-                        return slide;
-                }
+
+        list->by_name = arena_alloc(&list->arena, (list->visible_count ? list->visible_count : 1) * sizeof(Slide*));
+        list->named_count = 0;
+        for (i = 0; i < list->visible_count; i++) {
+                Slide* slide = list->slides[list->visible[i]];
+                if (slide->name)
+                        list->by_name[list->named_count++] = slide;
         }
-        return NULL;
+        qsort(list->by_name, list->named_count, sizeof(Slide*), compare_slide_names);
 }
 
 
-SlideElement* find_element_by_name(char* name, Slide* slide)
+/* equal names keep presentation order */
+int compare_slide_names(const void* a, const void* b)
 {
-        unsigned int i;
+        const Slide* slide_a = *(Slide* const*)a;
+        const Slide* slide_b = *(Slide* const*)b;
+        int cmp = strcmp(slide_a->name, slide_b->name);
 
+        if (cmp != 0)
+                return cmp;
+        return slide_a->position < slide_b->position ? -1 : slide_a->position > slide_b->position;
+}
+
+
+SlideElement* find_element_by_name(char* name, Slide* slide)
+{
         if (!slide)
                 return NULL;
         if (slide->name && strcmp(slide->name, name) == 0) {
                 fprintf(stderr, "Logic Error : Attempting to access %s inside of %s\n", name, slide->name);
-                exit(1);
+                deck_error();
+        }
+        return name_table_get(&slide->element_index, name);
+}
+
+
+/*
+ * Keeps find_element_by_name in sync as elements are appended.
+ * The first element added under a name wins, which matches the
+ * order a depth first search over the elements would find them in.
+ */
+void index_slide_element(Arena* arena, Slide* slide, SlideElement* element)
+{
+        unsigned int i;
+
+        if (element->type == ELEMENT_TYPE_BOX) {
+                if (element->element.box->name)
+                        name_table_put(arena, &slide->element_index, element->element.box->name, element);
+        }
+        else if (element->type == ELEMENT_TYPE_SLIDE) {
+                Slide* nested = element->element.slide;
+                NameTable* nested_index = &nested->element_index;
+
+                if (nested->name)
+                        name_table_put(arena, &slide->element_index, nested->name, element);
+                for (i = 0; i < nested_index->capacity; i++) {
+                        NameEntry* entry = &nested_index->entries[i];
+                        if (entry->key)
+                                name_table_put(arena, &slide->element_index, entry->key, entry->value);
+                }
+        }
+}
+
+
+/* FNV-1a */
+unsigned long hash_name(const char* str, size_t len)
+{
+        return hash_bytes(2166136261UL, str, len);
+}
+
+
+/* continues an FNV-1a hash over len more bytes */
+unsigned long hash_bytes(unsigned long hash, const void* data, size_t len)
+{
+        const unsigned char* bytes = data;
+        size_t i;
+        for (i = 0; i < len; i++) {
+                hash ^= bytes[i];
+                hash *= 16777619UL;
+        }
+        return hash;
+}
+
+
+void name_table_init(NameTable* table)
+{
+        table->entries = NULL;
+        table->count = 0;
+        table->capacity = 0;
+}
+
+
+/* returns the entry holding name, or the empty entry it would go in */
+NameEntry* name_table_slot(NameTable* table, const char* name, size_t len, unsigned long hash)
+{
+        unsigned int mask = table->capacity - 1;
+        unsigned int i = hash & mask;
+
+        for (;;) {
+                NameEntry* entry = &table->entries[i];
+                if (!entry->key)
+                        return entry;
+                if (entry->hash == hash && (entry->key == name
+                        || (strncmp(entry->key, name, len) == 0 && entry->key[len] == '\0')))
+                        return entry;
+                i = (i + 1) & mask;
+        }
+}
+
+
+void* name_table_get(NameTable* table, const char* name)
+{
+        size_t len = strlen(name);
+        NameEntry* entry;
+
+        if (table->count == 0)
+                return NULL;
+        entry = name_table_slot(table, name, len, hash_name(name, len));
+        return entry->key ? entry->value : NULL;
+}
+
+
+/* adds name -> value unless name is already present */
+bool name_table_put(Arena* arena, NameTable* table, char* name, void* value)
+{
+        size_t len = strlen(name);
+        unsigned long hash = hash_name(name, len);
+        NameEntry* entry;
+
+        if ((table->count + 1) * 4 > table->capacity * 3) {
+                NameEntry* old_entries = table->entries;
+                unsigned int old_capacity = table->capacity;
+                unsigned int i;
+
+                table->capacity = old_capacity ? old_capacity * 2 : 8;
+                table->entries = arena_alloc(arena, table->capacity * sizeof(NameEntry));
+                memset(table->entries, 0, table->capacity * sizeof(NameEntry));
+                for (i = 0; i < old_capacity; i++) {
+                        NameEntry* old = &old_entries[i];
+                        if (old->key)
+                                *name_table_slot(table, old->key, strlen(old->key), old->hash) = *old;
+                }
+        }
+
+        entry = name_table_slot(table, name, len, hash);
+        if (entry->key)
+                return false;
+        entry->key = name;
+        entry->hash = hash;
+        entry->value = value;
+        table->count++;
+        return true;
+}
+
+
+/* returns the single arena copy of str, so equal names share a pointer */
+char* intern(Arena* arena, NameTable* pool, const char* str, size_t len)
+{
+        unsigned long hash = hash_name(str, len);
+        NameEntry* entry;
+        char* name;
+
+        if (pool->count > 0) {
+                entry = name_table_slot(pool, str, len, hash);
+                if (entry->key)
+                        return entry->key;
         }
 
-        for (i = 0; i < slide->element_count; i++) {
-                SlideElement* se = slide->elements[i];
-                if (se->type == ELEMENT_TYPE_BOX && se->element.box->name && strcmp(se->element.box->name, name) == 0) {
-                        return se;
-                }
-                else if (se->type == ELEMENT_TYPE_SLIDE && se->element.slide->name && strcmp(se->element.slide->name, name) == 0) {
-                        return se;
-                }
-                else if (se->type == ELEMENT_TYPE_SLIDE) {
-                        SlideElement* found_element = find_element_by_name(name, se->element.slide);
-                        if (found_element != NULL) {
-                                return found_element;
-                        }
-                }
-        }
-        return NULL;
+        name = arena_string(arena, len);
+        memcpy(name, str, len);
+        name[len] = '\0';
+        name_table_put(arena, pool, name, name);
+        return name;
+}
+
+
+void slide_list_init(SlideList *slide_list)
+{
+        slide_list->slides = NULL;
+        slide_list->count = 0;
+        slide_list->capacity = 0;
+        arena_init(&slide_list->arena);
+        arena_init(&slide_list->layout_arena);
+        name_table_init(&slide_list->names);
+        name_table_init(&slide_list->slide_index);
+        slide_list->visible = NULL;
+        slide_list->visible_count = 0;
+        slide_list->visible_capacity = 0;
+        name_table_init(&slide_list->position_index);
+        slide_list->by_name = NULL;
+        slide_list->named_count = 0;
+        slide_list->notes = NULL;
+        slide_list->notes_size = 0;
+        slide_list->notes_capacity = 0;
+}
+
+
+void slide_list_append(SlideList* slide_list, Slide* slide)
+{
+        slide_list->slides = arena_grow(&slide_list->arena, slide_list->slides, sizeof(Slide*),
+                                        slide_list->count, &slide_list->capacity);
+        slide_list->slides[slide_list->count] = slide;
+        slide_list->count++;
+        if (slide->name)
+                name_table_put(&slide_list->arena, &slide_list->slide_index, slide->name, slide);
+        if (!slide->visible)
+                return;
+
+        slide_list->visible = arena_grow(&slide_list->arena, slide_list->visible, sizeof(unsigned int),
+                                         slide_list->visible_count, &slide_list->visible_capacity);
+        slide->position = slide_list->visible_count;
+        slide_list->visible[slide_list->visible_count++] = slide_list->count - 1;
+        if (slide->name)
+                name_table_put(&slide_list->arena, &slide_list->position_index, slide->name, slide);
+}
+
+
+void slide_list_free(SlideList *slide_list)
+{
+        arena_release(&slide_list->layout_arena);
+        arena_release(&slide_list->arena);
+        slide_list_init(slide_list);
+}
+
+
+void retain_image(Image* image)
+{
+        image->refs++;
+}
+
+
+/* drops one reference, the image goes away with the last one */
+void release_image(void* ptr)
+{
+        Image* image = ptr;
+
+        if (--image->refs > 0)
+                return;
+        free_image_resources(image);
+        free(image->proxy_data);
+        free_animation(image->anim);
+        free_sequence(image->sequence);
+        free_zoom_pyramid(image->pyramid);
+        if (!image->mapped)
+                stbi_image_free(image->data);
+        pixel_bytes -= (size_t)image->width * image->height * 4;
+        free(image);
 }
 
 
-void slide_list_init(SlideList *slide_list)
+/*
+ * Decoded images are shared by filename across slides and across
+ * reloads. The cache holds one reference of its own, images only
+ * referenced by the cache are dropped by prune_image_cache.
+ */
+Image* find_cached_image(const char* filename, struct stat* st)
 {
-        slide_list->slides = NULL;
-        slide_list->count = 0;
+        Image* image = name_table_get(&image_cache.images, filename);
+
+        if (image && image->mtime == st->st_mtime && image->file_size == st->st_size)
+                return image;
+        return NULL;
 }
 
 
-void slide_list_append(SlideList* slide_list, Slide* slide)
+void cache_image(Image* image)
 {
-        slide_list->slides = realloc(slide_list->slides, (slide_list->count + 1) * sizeof(Slide*));
-        if (!slide_list->slides) {
-                fprintf(stderr, "Error reallocating memory for slide list\n");
-                exit(1);
+        NameEntry* entry;
+        size_t len = strlen(image->filename);
+
+        if (image_cache.images.count > 0) {
+                entry = name_table_slot(&image_cache.images, image->filename, len, hash_name(image->filename, len));
+                if (entry->key) {
+                        /* the file changed, the old image lives on until no deck uses it */
+                        release_image(entry->value);
+                        entry->value = image;
+                        retain_image(image);
+                        return;
+                }
         }
-        slide_list->slides[slide_list->count] = slide;
-        slide_list->count++;
+        name_table_put(&image_cache.arena, &image_cache.images,
+                       arena_strdup(&image_cache.arena, image->filename), image);
+        retain_image(image);
 }
 
 
-void slide_list_free(SlideList *slide_list)
+void prune_image_cache(void)
 {
+        NameTable old = image_cache.images;
         unsigned int i;
-        for (i = 0; i < slide_list->count; i++) {
-                free_slide(slide_list->slides[i]);
+
+        name_table_init(&image_cache.images);
+        for (i = 0; i < old.capacity; i++) {
+                Image* image = old.entries[i].value;
+                if (!old.entries[i].key)
+                        continue;
+                if (image->refs == 1)
+                        release_image(image);
+                else
+                        name_table_put(&image_cache.arena, &image_cache.images, old.entries[i].key, image);
         }
-        free(slide_list->slides);
 }
 
 
-void free_slide(Slide* slide)
+void arena_init(Arena* arena)
 {
-        unsigned int element_index;
-
-        free(slide->name);
-
-        for (element_index = 0; element_index < slide->element_count; element_index++) {
-                SlideElement* element = slide->elements[element_index];
-                if (element->type == ELEMENT_TYPE_BOX) {
-                        free_box(element->element.box);
-                }
-                if (element->type == ELEMENT_TYPE_SLIDE) {
-                        free_slide(element->element.slide);
-                }
-                free(element);
-        }
-        free(slide->elements);
-        free(slide);
+        arena->head = NULL;
+        arena->finalizers = NULL;
+        arena->total = 0;
+        arena->used = 0;
+        arena->strings = 0;
 }
 
 
-void free_box(Box* box)
+void* arena_alloc(Arena* arena, size_t size)
 {
-        unsigned int element_index;
+        ArenaBlock* block = arena->head;
+        void* ptr;
+
+        size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+        if (!block || block->size - block->used < size) {
+                size_t block_size = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
 
-        free(box->name);
-        for (element_index = 0; element_index < box->element_count; element_index++) {
-                SlideElement* element = box->elements[element_index];
-                if (element->type == ELEMENT_TYPE_TEXT) {
-                        free_text(element->element.text);
+                block = malloc(sizeof(ArenaBlock) + block_size);
+                if (!block) {
+                        fprintf(stderr, "Error: Failed to allocate memory for arena block.\n");
+                        exit(1);
                 }
-                if (element->type == ELEMENT_TYPE_IMAGE) {
-                        free_image(element->element.image);
+                block->data = (unsigned char*)(block + 1);
+                block->size = block_size;
+                block->used = 0;
+                arena->total += block_size;
+
+                /* oversized blocks go behind the head so the
+                 * remaining space in the current block isn't lost */
+                if (block_size != ARENA_BLOCK_SIZE && arena->head) {
+                        block->next = arena->head->next;
+                        arena->head->next = block;
                 }
-                if (element->type == ELEMENT_TYPE_BOX) {
-                        free_box(element->element.box);
+                else {
+                        block->next = arena->head;
+                        arena->head = block;
                 }
-                free(element);
         }
-        free(box->elements);
-        free(box);
+
+        ptr = block->data + block->used;
+        block->used += size;
+        arena->used += size;
+        return ptr;
 }
 
 
-void free_text(Text* text)
+/*
+ * Makes room for one more element in an arena allocated array.
+ * Capacity doubles so appending n elements copies O(n) in total,
+ * the abandoned arrays are reclaimed with the rest of the arena.
+ */
+void* arena_grow(Arena* arena, void* array, size_t elem_size, unsigned int count, unsigned int* capacity)
 {
-        free(text->content);
-        text->content = NULL;
-        free(text);
-        text = NULL;
+        void* new_array;
+
+        if (array && count < *capacity)
+                return array;
+
+        /* a capacity of zero on a non-null array means it is borrowed */
+        while (*capacity <= count)
+                *capacity = *capacity ? *capacity * 2 : 4;
+        new_array = arena_alloc(arena, *capacity * elem_size);
+        if (array)
+                memcpy(new_array, array, count * elem_size);
+        return new_array;
 }
 
 
-void free_image(Image* image)
+/* room for a string of len chars, counted under strings in the memory report */
+char* arena_string(Arena* arena, size_t len)
 {
-        free(image->filename);
-        image->ximage->data = NULL;
-        XDestroyImage(image->ximage);
-        stbi_image_free(image->data);
-        free(image);
+        arena->strings += len + 1;
+        return arena_alloc(arena, len + 1);
 }
 
 
-void add_element_to_box(Box* box, SlideElement* element)
+char* arena_strdup(Arena* arena, const char* str)
 {
-        if (box->element_count == 0) {
-                box->elements = malloc(sizeof(SlideElement *));
-        }
-        else {
-                box->elements = realloc(box->elements, (box->element_count + 1) * sizeof(SlideElement *));
-        }
+        size_t len = strlen(str);
+        char* new_str = arena_string(arena, len);
+        memcpy(new_str, str, len + 1);
+        return new_str;
+}
 
-        if (box->elements == NULL) {
-                fprintf(stderr, "Error: Failed to allocate memory for box elements.\n");
-                exit(1);
-        }
 
-        box->elements[box->element_count] = element;
-        box->element_count++;
+/* registers cleanup for memory the arena doesn't own (e.g. decoded pixels) */
+void arena_defer(Arena* arena, void (*fn)(void*), void* ptr)
+{
+        ArenaFinalizer* finalizer = arena_alloc(arena, sizeof(ArenaFinalizer));
+        finalizer->fn = fn;
+        finalizer->ptr = ptr;
+        finalizer->next = arena->finalizers;
+        arena->finalizers = finalizer;
 }
 
 
-void add_element_to_box_at_index(Box* box, SlideElement* element, unsigned int index)
+void arena_release(Arena* arena)
 {
-        box->elements = realloc(box->elements, (box->element_count + 1) * sizeof(SlideElement *));
-        if (box->elements == NULL) {
-                fprintf(stderr, "Error: Failed to allocate memory for box element.\n");
-                exit(1);
+        ArenaFinalizer* finalizer;
+        ArenaBlock* block = arena->head;
+
+        for (finalizer = arena->finalizers; finalizer; finalizer = finalizer->next)
+                finalizer->fn(finalizer->ptr);
+
+        while (block) {
+                ArenaBlock* next = block->next;
+                free(block);
+                block = next;
         }
-        memmove(&box->elements[index + 1], &box->elements[index], (box->element_count - index) * sizeof(SlideElement*));
-        box->elements[index] = element;
-        box->element_count ++;
+        arena_init(arena);
 }
 
 
-void add_element_to_slide(Slide* slide, SlideElement* element)
+void add_element_to_box(Arena* arena, Box* box, SlideElement* element)
 {
-        if (slide->element_count == 0) {
-                slide->elements = malloc(sizeof(SlideElement *));
-        }
-        else {
-                slide->elements = realloc(slide->elements, (slide->element_count + 1) * sizeof(SlideElement *));
-        }
+        box->elements = arena_grow(arena, box->elements, sizeof(SlideElement*),
+                                   box->element_count, &box->element_capacity);
+        box->elements[box->element_count] = element;
+        box->element_count++;
+}
 
-        if (slide->elements == NULL) {
-                fprintf(stderr, "Error: Failed to allocate memory for slide elements.\n");
-                exit(1);
-        }
 
+void add_element_to_slide(Arena* arena, Slide* slide, SlideElement* element)
+{
+        slide->elements = arena_grow(arena, slide->elements, sizeof(SlideElement*),
+                                     slide->element_count, &slide->element_capacity);
         slide->elements[slide->element_count] = element;
         slide->element_count++;
+        index_slide_element(arena, slide, element);
 }
 
 
@@ -1372,11 +7219,11 @@ void check_syntax(char** check_args, unsigned int check_len, char* expect, unsig
 {
         unsigned int arg_len;
         unsigned int i;
-        char** types = split_str(expect, " ", &arg_len);
+        char** types = split_str(NULL, expect, " ", &arg_len);
 
         if (check_len - 1 != arg_len) {
                 fprintf(stderr, "Syntax Error on line %d : %s expects %d arguments, but %d were given.\n", line_num, check_args[0], arg_len, check_len - 1);
-                exit(1);
+                goto syntax_error;
         }
 
         for (i = 0; i < arg_len; i++) {
@@ -1384,33 +7231,38 @@ void check_syntax(char** check_args, unsigned int check_len, char* expect, unsig
                 if (strcmp(types[i], "str") == 0) {
                         if (!is_string(check_args[cur])) {
                                 fprintf(stderr, "Syntax Error on line %d : Expected String for argument %d", line_num, i);
-                                exit(1);
+                                goto syntax_error;
                         }
                 }
                 else if (strcmp(types[i], "int") == 0) {
                         bool dummy;
                         if (!is_number(check_args[cur], &dummy)) {
                                 fprintf(stderr, "Syntax Error on line %d : Expected Integer for argument %d", line_num, i);
-                                exit(1);
+                                goto syntax_error;
                         }
                 }
                 else if (strcmp(types[i], "uint") == 0) {
                         bool is_negative = false;
                         if (!is_number(check_args[cur], &is_negative) || is_negative) {
                                 fprintf(stderr, "Syntax Error on line %d : Expected Positive Integer for argument %d", line_num, i);
-                                exit(1);
+                                goto syntax_error;
                         }
                 }
                 else if (strcmp(types[i], "type") == 0) {
                         bool dummy;
                         if (is_number(check_args[cur], &dummy) || is_string(check_args[cur])) {
                                 fprintf(stderr, "Syntax Error on line %d : Expected variable for argument %d", line_num, i);
-                                exit(1);
+                                goto syntax_error;
                         }
                 }
         }
 
         free_split_str(types, arg_len);
+        return;
+
+        syntax_error:
+        free_split_str(types, arg_len);
+        deck_error();
 }
 
 
@@ -1441,74 +7293,698 @@ bool is_string(char* str)
 }
 
 
-char* remove_quotes(const char* str)
+char* remove_quotes(Arena* arena, const char* str)
+{
+        int length = strlen(str);
+        char* new_str = arena_string(arena, length - 2);
+
+        strncpy(new_str, str + 1, length - 2);
+        new_str[length - 2] = '\0';
+
+        return new_str;
+}
+
+
+char* intern_quoted(SlideList* list, const char* str)
+{
+        return intern(&list->arena, &list->names, str + 1, strlen(str) - 2);
+}
+
+
+void swap_rb_channels(unsigned char* img_data, int width, int height)
+{
+        int i;
+        for (i = 0; i < width * height * 4; i += 4) {
+                unsigned char temp = img_data[i];
+                img_data[i] = img_data[i + 2];
+                img_data[i + 2] = temp;
+        }
+}
+
+
+void create_text(Arena* arena, Text** text, char* content, FontSize font_size)
+{
+        (*text) = arena_alloc(arena, sizeof(Text));
+        (*text)->type = ELEMENT_TYPE_TEXT;
+        (*text)->content = content;
+        (*text)->font_size = font_size;
+}
+
+
+/*
+ * Images are shared through image_cache, so a reload only decodes the
+ * files that changed on disk. The Image is malloc'd with its filename
+ * behind it as it can outlive the deck that loaded it.
+ */
+void create_image(Arena* arena, Image** image, char* filename)
+{
+        struct stat st;
+        double start;
+
+        if (stat(filename, &st) != 0) {
+                fprintf(stderr, "Failed to load image: %s\n", filename);
+                deck_error();
+        }
+        (*image) = find_cached_image(filename, &st);
+        if (*image) {
+                retain_image(*image);
+                arena_defer(arena, release_image, *image);
+                return;
+        }
+
+        start = now_ms();
+        (*image) = decode_workers.queueing ? queue_image(filename, &st) : NULL;
+        if (!*image) {
+                (*image) = new_image(filename, &st);
+                (*image)->anim = load_animation(*image);
+        }
+        bench_decode_ms += now_ms() - start;
+        arena_defer(arena, release_image, *image);
+        cache_image(*image);
+}
+
+
+/* decodes filename into an image with one reference, outside the cache */
+Image* new_image(const char* filename, struct stat* st)
+{
+        Image* image = alloc_image(filename, st);
+
+        image->data = load_pixels(filename, &image->width, &image->height, &image->channels);
+        if (image->data == NULL) {
+                fprintf(stderr, "Failed to load image: %s\n", filename);
+                free(image);
+                deck_error();
+        }
+        pixel_bytes += (size_t)image->width * image->height * 4;
+        return image;
+}
+
+
+/* an image of filename without pixels yet */
+Image* alloc_image(const char* filename, struct stat* st)
+{
+        size_t len = strlen(filename);
+        Image* image = malloc(sizeof(Image) + len + 1);
+
+        if (!image) {
+                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                exit(1);
+        }
+        image->type = ELEMENT_TYPE_IMAGE;
+        image->filename = (char*)(image + 1);
+        memcpy(image->filename, filename, len + 1);
+        image->pixmap = None;
+        image->picture = None;
+        image->proxy_state = PROXY_NONE;
+        image->proxy_data = NULL;
+        image->proxy_picture = None;
+        image->proxy_pixmap = None;
+        image->data = NULL;
+        image->mapped = false;
+        image->decode = DECODE_DONE;
+        image->anim = NULL;
+        image->sequence = NULL;
+        image->pyramid = NULL;
+        image->mtime = st->st_mtime;
+        image->file_size = st->st_size;
+        image->refs = 1;
+        return image;
+}
+
+
+void start_decode_workers(void)
+{
+        DecodeWorkers* workers = &decode_workers;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        pthread_mutex_init(&workers->lock, NULL);
+        pthread_cond_init(&workers->wake, NULL);
+        pthread_cond_init(&workers->decoded, NULL);
+        workers->jobs = NULL;
+        workers->job_count = 0;
+        workers->job_capacity = 0;
+        workers->next_job = 0;
+        workers->decode_ms = 0;
+        workers->queueing = true;
+        workers->thread_count = 0;
+        while (workers->thread_count < DECODE_MAX_WORKERS && (long)workers->thread_count < cpus) {
+                if (pthread_create(&workers->threads[workers->thread_count], NULL, decode_worker, workers) != 0)
+                        break;
+                workers->thread_count++;
+        }
+        /* without threads images are decoded as they are parsed */
+        if (workers->thread_count == 0) {
+                workers->queueing = false;
+                pthread_cond_destroy(&workers->decoded);
+                pthread_cond_destroy(&workers->wake);
+                pthread_mutex_destroy(&workers->lock);
+        }
+}
+
+
+/* the deck is parsed, workers stop once the queue is empty */
+void end_decode_queue(void)
+{
+        DecodeWorkers* workers = &decode_workers;
+
+        if (workers->thread_count == 0)
+                return;
+        pthread_mutex_lock(&workers->lock);
+        workers->queueing = false;
+        pthread_cond_broadcast(&workers->wake);
+        pthread_mutex_unlock(&workers->lock);
+}
+
+
+/* waits for every queued image, they all have their pixels afterwards */
+void stop_decode_workers(void)
+{
+        DecodeWorkers* workers = &decode_workers;
+        unsigned int i;
+
+        if (workers->thread_count == 0)
+                return;
+        end_decode_queue();
+        for (i = 0; i < workers->thread_count; i++)
+                pthread_join(workers->threads[i], NULL);
+        workers->thread_count = 0;
+        bench_decode_ms += workers->decode_ms;
+        free(workers->jobs);
+        workers->jobs = NULL;
+        pthread_cond_destroy(&workers->decoded);
+        pthread_cond_destroy(&workers->wake);
+        pthread_mutex_destroy(&workers->lock);
+}
+
+
+void* decode_worker(void* data)
+{
+        DecodeWorkers* workers = data;
+        Image* image;
+        double start;
+
+        pthread_mutex_lock(&workers->lock);
+        for (;;) {
+                /* images someone needed first were decoded by them */
+                while (workers->next_job < workers->job_count && workers->jobs[workers->next_job]->decode != DECODE_QUEUED)
+                        workers->next_job++;
+                if (workers->next_job == workers->job_count) {
+                        if (!workers->queueing)
+                                break;
+                        pthread_cond_wait(&workers->wake, &workers->lock);
+                        continue;
+                }
+                image = workers->jobs[workers->next_job++];
+                image->decode = DECODE_RUNNING;
+                pthread_mutex_unlock(&workers->lock);
+
+                start = now_ms();
+                decode_queued_image(image);
+
+                pthread_mutex_lock(&workers->lock);
+                workers->decode_ms += now_ms() - start;
+                image->decode = DECODE_DONE;
+                pthread_cond_broadcast(&workers->decoded);
+        }
+        pthread_mutex_unlock(&workers->lock);
+        return NULL;
+}
+
+
+/*
+ * Reads only the size of a still image and queues it for the workers.
+ * NULL for files whose size can't be read and for GIFs, which may be
+ * animated, create_image decodes those right away.
+ */
+Image* queue_image(const char* filename, struct stat* st)
+{
+        DecodeWorkers* workers = &decode_workers;
+        unsigned char magic[4];
+        FILE* file = fopen(filename, "rb");
+        Image* image;
+        int width;
+        int height;
+        int channels;
+
+        if (!file)
+                return NULL;
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, "GIF8", sizeof(magic)) == 0
+                || fseek(file, 0, SEEK_SET) != 0 || !stbi_info_from_file(file, &width, &height, &channels)) {
+                fclose(file);
+                return NULL;
+        }
+        fclose(file);
+
+        image = alloc_image(filename, st);
+        image->width = width;
+        image->height = height;
+        image->channels = channels;
+        image->decode = DECODE_QUEUED;
+        pixel_bytes += (size_t)width * height * 4;
+
+        pthread_mutex_lock(&workers->lock);
+        if (workers->job_count == workers->job_capacity) {
+                workers->job_capacity = workers->job_capacity ? workers->job_capacity * 2 : 16;
+                workers->jobs = realloc(workers->jobs, workers->job_capacity * sizeof(Image*));
+                if (!workers->jobs) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+        }
+        workers->jobs[workers->job_count++] = image;
+        pthread_cond_signal(&workers->wake);
+        pthread_mutex_unlock(&workers->lock);
+        return image;
+}
+
+
+/* returns once image has its pixels, decoding it here if no worker has started on it and checking them if they are mapped */
+void wait_for_pixels(Image* image)
+{
+        DecodeWorkers* workers = &decode_workers;
+        double start;
+
+        if (image->mapped) {
+                check_mapped_pixels(image);
+                return;
+        }
+        if (workers->thread_count == 0)
+                return;
+        pthread_mutex_lock(&workers->lock);
+        if (image->decode == DECODE_QUEUED) {
+                image->decode = DECODE_RUNNING;
+                pthread_mutex_unlock(&workers->lock);
+                start = now_ms();
+                decode_queued_image(image);
+                pthread_mutex_lock(&workers->lock);
+                workers->decode_ms += now_ms() - start;
+                image->decode = DECODE_DONE;
+                pthread_cond_broadcast(&workers->decoded);
+        }
+        while (image->decode != DECODE_DONE)
+                pthread_cond_wait(&workers->decoded, &workers->lock);
+        pthread_mutex_unlock(&workers->lock);
+}
+
+
+/* the deck was accepted with this image's size, so failing now is fatal like any unreadable image at startup */
+void decode_queued_image(Image* image)
+{
+        int width;
+        int height;
+        int channels;
+
+        image->data = load_pixels(image->filename, &width, &height, &channels);
+        if (!image->data || width != image->width || height != image->height) {
+                fprintf(stderr, "Failed to load image: %s\n", image->filename);
+                exit(1);
+        }
+}
+
+
+/* decodes a file into BGRA pixels, the order images are uploaded in. NULL if it can't be read */
+unsigned char* load_pixels(const char* filename, int* width, int* height, int* channels)
+{
+        unsigned char* data = stbi_load(filename, width, height, channels, 4);
+
+        if (data)
+                swap_rb_channels(data, *width, *height);
+        return data;
+}
+
+
+/*
+ * The pattern of an imageseq: numbers its files with %d or %0Nd. The
+ * files count from 0, or from 1 when there is no file 0, up to the
+ * first missing number. The first frame is decoded here like any image
+ * and gives the sequence its size, the rest while it plays. Sequences
+ * are not cached, every element plays on its own.
+ */
+void create_image_sequence(Arena* arena, Image** image, char* pattern, unsigned int fps, unsigned int line_num)
+{
+        ImageSequence probe;
+        ImageSequence* seq;
+        char filename[PATH_MAX];
+        char* percent = strchr(pattern, '%');
+        char* end = NULL;
+        struct stat st;
+        double start;
+
+        memset(&probe, 0, sizeof(probe));
+        probe.pattern = pattern;
+        if (percent) {
+                end = percent + 1;
+                if (*end == '0')
+                        probe.digits = strtoul(end, &end, 10);
+        }
+        if (!percent || *end != 'd' || strchr(end, '%') || probe.digits > 9 || strlen(pattern) + 20 >= PATH_MAX) {
+                fprintf(stderr, "Error on line %d : Expected one %%d or %%0Nd in image sequence %s, like frame_%%04d.png\n", line_num, pattern);
+                deck_error();
+        }
+        probe.prefix_len = percent - pattern;
+        probe.suffix = end + 1;
+
+        sequence_filename(&probe, 0, filename);
+        if (stat(filename, &st) != 0) {
+                probe.first = 1;
+                sequence_filename(&probe, 1, filename);
+                if (stat(filename, &st) != 0) {
+                        fprintf(stderr, "Failed to load image sequence: %s\n", pattern);
+                        deck_error();
+                }
+        }
+        start = now_ms();
+        (*image) = new_image(filename, &st);
+        bench_decode_ms += now_ms() - start;
+        arena_defer(arena, release_image, *image);
+
+        for (probe.file_count = 1; ; probe.file_count++) {
+                struct stat frame_st;
+
+                sequence_filename(&probe, probe.first + probe.file_count, filename);
+                if (stat(filename, &frame_st) != 0)
+                        break;
+        }
+        /* one file is a still image */
+        if (probe.file_count < 2)
+                return;
+
+        seq = malloc(sizeof(ImageSequence));
+        if (seq)
+                *seq = probe;
+        if (!seq || !(seq->pattern = malloc(strlen(pattern) + 1))) {
+                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                exit(1);
+        }
+        strcpy(seq->pattern, pattern);
+        seq->suffix = seq->pattern + (probe.suffix - pattern);
+        seq->fps = fps;
+        seq->width = (*image)->width;
+        seq->height = (*image)->height;
+        seq->pixmap = None;
+        seq->picture = None;
+        (*image)->sequence = seq;
+}
+
+
+/* the name of file number, the pattern's number padded with zeros */
+void sequence_filename(ImageSequence* seq, unsigned int number, char* filename)
+{
+        char digits[16];
+        unsigned int len;
+
+        sprintf(digits, "%u", number);
+        memcpy(filename, seq->pattern, seq->prefix_len);
+        filename += seq->prefix_len;
+        for (len = strlen(digits); len < seq->digits; len++)
+                *filename++ = '0';
+        sprintf(filename, "%s%s", digits, seq->suffix);
+}
+
+
+void free_sequence(ImageSequence* seq)
+{
+        unsigned int i;
+
+        if (!seq)
+                return;
+        for (i = 0; i < seq->slot_count; i++)
+                free(seq->slots[i].data);
+        free(seq->slots);
+        free(seq->pattern);
+        pixel_bytes -= seq->bytes;
+        free(seq);
+}
+
+
+/* builds the image's pyramid up to level, returns level or the last one if the image runs out before */
+unsigned int zoom_level(Image* image, unsigned int level)
+{
+        ZoomPyramid* pyramid = image->pyramid;
+
+        if (!pyramid) {
+                pyramid = calloc(1, sizeof(ZoomPyramid));
+                if (!pyramid) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+                wait_for_pixels(image);
+                pyramid->levels[0].data = image->data;
+                pyramid->levels[0].width = image->width;
+                pyramid->levels[0].height = image->height;
+                pyramid->level_count = 1;
+                image->pyramid = pyramid;
+        }
+        while (pyramid->level_count <= level && pyramid->level_count < ZOOM_MAX_LEVELS) {
+                ZoomLevel* last = &pyramid->levels[pyramid->level_count - 1];
+                ZoomLevel* next = &pyramid->levels[pyramid->level_count];
+
+                if (last->width <= ZOOM_TILE_SIZE && last->height <= ZOOM_TILE_SIZE)
+                        break;
+                halve_level(last, next);
+                pyramid->bytes += (size_t)next->width * next->height * 4;
+                pixel_bytes += (size_t)next->width * next->height * 4;
+                pyramid->level_count++;
+        }
+        return level < pyramid->level_count ? level : pyramid->level_count - 1;
+}
+
+
+/* each pixel of next is the mean of two by two of level, the last row and column repeat at odd sizes */
+void halve_level(ZoomLevel* level, ZoomLevel* next)
+{
+        int x;
+        int y;
+        int c;
+
+        next->width = (level->width + 1) / 2;
+        next->height = (level->height + 1) / 2;
+        next->data = malloc((size_t)next->width * next->height * 4);
+        if (!next->data) {
+                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                exit(1);
+        }
+        for (y = 0; y < next->height; y++) {
+                unsigned char* top = level->data + (size_t)2 * y * level->width * 4;
+                unsigned char* bottom = 2 * y + 1 < level->height ? top + (size_t)level->width * 4 : top;
+                unsigned char* out = next->data + (size_t)y * next->width * 4;
+
+                for (x = 0; x < next->width; x++) {
+                        unsigned char* a = top + 8 * x;
+                        unsigned char* b = bottom + 8 * x;
+                        int right = 2 * x + 1 < level->width ? 4 : 0;
+
+                        for (c = 0; c < 4; c++)
+                                out[4 * x + c] = (a[c] + a[right + c] + b[c] + b[right + c] + 2) / 4;
+                }
+        }
+}
+
+
+/* copies tile x, y of level into out with a one pixel border, the level's edges repeat past it */
+void cut_zoom_tile(ZoomLevel* level, int x, int y, unsigned char* out)
+{
+        int size = ZOOM_TILE_SIZE + 2;
+        int left = x * ZOOM_TILE_SIZE - 1;
+        int top = y * ZOOM_TILE_SIZE - 1;
+        int first = left < 0 ? 1 : 0; /* columns before the level */
+        int count = (level->width - left < size ? level->width - left : size) - first;
+        int row;
+        int col;
+
+        for (row = 0; row < size; row++) {
+                int src_y = top + row;
+                unsigned char* src;
+                unsigned char* dst = out + (size_t)row * size * 4;
+
+                if (src_y < 0)
+                        src_y = 0;
+                if (src_y >= level->height)
+                        src_y = level->height - 1;
+                src = level->data + (size_t)src_y * level->width * 4;
+                memcpy(dst + first * 4, src + (size_t)(left + first) * 4, (size_t)count * 4);
+                if (first)
+                        memcpy(dst, src, 4);
+                for (col = first + count; col < size; col++)
+                        memcpy(dst + col * 4, src + (size_t)(level->width - 1) * 4, 4);
+        }
+}
+
+
+void free_zoom_pyramid(ZoomPyramid* pyramid)
 {
-        int length = strlen(str);
-        char* new_str = (char*)malloc(sizeof(char) * (length - 1));
+        unsigned int i;
+
+        if (!pyramid)
+                return;
+        for (i = 1; i < pyramid->level_count; i++)
+                free(pyramid->levels[i].data);
+        free(pyramid->tiles);
+        pixel_bytes -= pyramid->bytes;
+        free(pyramid);
+}
+
+
+/*
+ * Decodes the frames of an animated GIF, the first of which the image
+ * already holds. Returns NULL for other files and GIFs of one frame.
+ */
+GifAnimation* load_animation(Image* image)
+{
+        size_t frame_bytes = (size_t)image->width * image->height * 4;
+        unsigned char magic[4];
+        unsigned char* two_back = NULL;
+        unsigned char* pixels;
+        unsigned int capacity = 0;
+        unsigned int delay_ms;
+        GifAnimation* anim;
+        FILE* file = fopen(image->filename, "rb");
+        long size;
+        unsigned int i;
 
-        if (new_str == NULL) {
+        if (!file)
+                return NULL;
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, "GIF8", sizeof(magic)) != 0
+                || fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || size > INT_MAX) {
+                fclose(file);
                 return NULL;
         }
+        rewind(file);
+        anim = calloc(1, sizeof(GifAnimation));
+        if (anim)
+                anim->file = malloc(size);
+        if (!anim || !anim->file) {
+                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                exit(1);
+        }
+        anim->file_size = fread(anim->file, 1, size, file);
+        fclose(file);
 
-        strncpy(new_str, str + 1, length - 2);
-        new_str[length - 2] = '\0';
-
-        return new_str;
+        start_gif_decoder(anim);
+        while ((pixels = decode_gif_frame(anim, two_back, &delay_ms)) != NULL) {
+                /* the file changed since the image was decoded */
+                if (anim->gif.w != image->width || anim->gif.h != image->height)
+                        break;
+                if ((anim->frame_count + 1) * frame_bytes > GIF_MEMORY_BUDGET) {
+                        anim->streaming = true;
+                        break;
+                }
+                if (anim->frame_count == capacity) {
+                        capacity = capacity ? capacity * 2 : 16;
+                        anim->frames = realloc(anim->frames, capacity * sizeof(GifFrame));
+                        if (!anim->frames) {
+                                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                                exit(1);
+                        }
+                }
+                anim->frames[anim->frame_count].data = malloc(frame_bytes);
+                if (!anim->frames[anim->frame_count].data) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+                memcpy(anim->frames[anim->frame_count].data, pixels, frame_bytes);
+                anim->frames[anim->frame_count].delay_ms = delay_ms;
+                anim->frames[anim->frame_count].pixmap = None;
+                anim->frames[anim->frame_count].picture = None;
+                anim->frame_count++;
+                /* disposing of a frame can mean going back to the one before it */
+                two_back = anim->frame_count >= 2 ? anim->frames[anim->frame_count - 2].data : NULL;
+        }
+        stop_gif_decoder(anim);
+
+        if (anim->streaming) {
+                for (i = 0; i < anim->frame_count; i++)
+                        free(anim->frames[i].data);
+                anim->frames = realloc(anim->frames, GIF_RING_FRAMES * sizeof(GifFrame));
+                anim->scratch = malloc(frame_bytes);
+                if (!anim->frames || !anim->scratch) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+                for (i = 0; i < GIF_RING_FRAMES; i++) {
+                        anim->frames[i].data = malloc(frame_bytes);
+                        if (!anim->frames[i].data) {
+                                fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                                exit(1);
+                        }
+                        anim->frames[i].pixmap = None;
+                        anim->frames[i].picture = None;
+                        anim->frames[i].delay_ms = GIF_DEFAULT_DELAY_MS;
+                }
+                anim->frame_count = GIF_RING_FRAMES;
+                anim->bytes = (GIF_RING_FRAMES + 1) * frame_bytes + anim->file_size;
+        }
+        else if (anim->frame_count < 2) {
+                free_animation(anim);
+                return NULL;
+        }
+        else {
+                free(anim->file);
+                anim->file = NULL;
+                free(anim->frames[0].data);
+                anim->frames[0].data = NULL;
+                for (i = 1; i < anim->frame_count; i++)
+                        swap_rb_channels(anim->frames[i].data, image->width, image->height);
+                anim->bytes = (anim->frame_count - 1) * frame_bytes;
+        }
+        pixel_bytes += anim->bytes;
+        return anim;
 }
 
 
-void swap_rb_channels(unsigned char* img_data, int width, int height)
+void free_animation(GifAnimation* anim)
 {
-        int i;
-        for (i = 0; i < width * height * 4; i += 4) {
-                unsigned char temp = img_data[i];
-                img_data[i] = img_data[i + 2];
-                img_data[i + 2] = temp;
-        }
+        unsigned int i;
+
+        if (!anim)
+                return;
+        stop_gif_decoder(anim);
+        for (i = 0; i < anim->frame_count; i++)
+                free(anim->frames[i].data);
+        free(anim->frames);
+        free(anim->file);
+        free(anim->scratch);
+        pixel_bytes -= anim->bytes;
+        free(anim);
 }
 
 
-void create_text(Text** text, char* content, FontSize font_size)
+/* starts decoding the kept file over from its first frame */
+void start_gif_decoder(GifAnimation* anim)
 {
-        (*text) = malloc(sizeof(Text));
-        if (!*text) {
-                fprintf(stderr, "Error: Failed to allocate memory for text\n");
-                exit(1);
-        }
+        stop_gif_decoder(anim);
+        stbi__start_mem(&anim->ctx, anim->file, anim->file_size);
+        anim->loop_frames = 0;
+}
 
-        (*text)->type = ELEMENT_TYPE_TEXT;
-        (*text)->content = content;
-        (*text)->font_size = font_size;
+
+void stop_gif_decoder(GifAnimation* anim)
+{
+        STBI_FREE(anim->gif.out);
+        STBI_FREE(anim->gif.background);
+        STBI_FREE(anim->gif.history);
+        memset(&anim->gif, 0, sizeof(anim->gif));
 }
 
 
-void create_image(Image** image, char* filename)
+/* the next frame as RGBA, owned by the decoder. NULL at the end of the file or at a broken frame */
+unsigned char* decode_gif_frame(GifAnimation* anim, unsigned char* two_back, unsigned int* delay_ms)
 {
-        (*image) = malloc(sizeof(Image));
-        if (!*image) {
-                fprintf(stderr, "Error: Failed to allocate memory for text\n");
-                exit(1);
-        }
+        int comp;
+        unsigned char* pixels = stbi__gif_load_next(&anim->ctx, &anim->gif, &comp, 4, two_back);
 
-        (*image)->type = ELEMENT_TYPE_IMAGE;
-        (*image)->filename = filename;
-        (*image)->data = stbi_load(filename, &(*image)->width, &(*image)->height, &(*image)->channels, 4);
-        swap_rb_channels((*image)->data, (*image)->width, (*image)->height);
-        if ((*image)->data == NULL) {
-                fprintf(stderr, "Failed to load image: %s\n", filename);
-                exit(1);
-        }
+        if (!pixels || pixels == (unsigned char*)&anim->ctx)
+                return NULL;
+        /* like browsers do, a delay this short means the file didn't set one */
+        *delay_ms = anim->gif.delay < GIF_MIN_DELAY_MS ? GIF_DEFAULT_DELAY_MS : (unsigned int)anim->gif.delay;
+        anim->loop_frames++;
+        return pixels;
 }
 
 
-void create_box(Box** box, char* name, StackType stack, TextAlignmentType alignment)
+void create_box(Arena* arena, Box** box, char* name, StackType stack, TextAlignmentType alignment)
 {
-        (*box) = malloc(sizeof(Box));
-        if (!*box) {
-                fprintf(stderr, "Error: Failed to allocate memory for box\n");
-                exit(1);
-        }
-
+        (*box) = arena_alloc(arena, sizeof(Box));
         (*box)->type = ELEMENT_TYPE_BOX;
         (*box)->name = name;
         (*box)->stack_type = stack;
@@ -1516,34 +7992,37 @@ void create_box(Box** box, char* name, StackType stack, TextAlignmentType alignm
 
         (*box)->elements = NULL;
         (*box)->element_count = 0;
+        (*box)->element_capacity = 0;
+        (*box)->items = NULL;
+        (*box)->item_count = 0;
+        (*box)->item_capacity = 0;
 }
 
 
-void create_slide(Slide** slide, char* name, bool visible)
+void create_slide(Arena* arena, Slide** slide, char* name, bool visible)
 {
-        (*slide) = malloc(sizeof(Slide));
-        if (!*slide) {
-                fprintf(stderr, "Error: Failed to allocate memory for Slide\n");
-                exit(1);
-        }
-
+        (*slide) = arena_alloc(arena, sizeof(Slide));
         (*slide)->type = ELEMENT_TYPE_SLIDE;
         (*slide)->name = name;
         (*slide)->visible = visible;
+        (*slide)->position = 0;
+        (*slide)->notes_offset = 0;
+        (*slide)->notes_length = 0;
+        (*slide)->steps = 0;
+        (*slide)->display = NULL;
 
         (*slide)->elements = NULL;
         (*slide)->element_count = 0;
+        (*slide)->element_capacity = 0;
+        name_table_init(&(*slide)->element_index);
 }
 
 
-SlideElement* alloc_slide_element(ElementType type)
+SlideElement* alloc_slide_element(Arena* arena, ElementType type)
 {
-        SlideElement* se = malloc(sizeof(SlideElement));
-        if (!se) {
-                fprintf(stderr, "Error: Failed to allocate memory for SlideElement.\n");
-                exit(1);
-        }
+        SlideElement* se = arena_alloc(arena, sizeof(SlideElement));
         se->type = type;
+        se->step = 0;
         return se;
 }
 
@@ -1551,13 +8030,16 @@ SlideElement* alloc_slide_element(ElementType type)
  * This function does a bit more than splitting a string by delimiter,
  * it doesn't split text enclosed in quotes, and also leading whitespace
  * is removed from each substring.
+ * With an arena the substrings are allocated from it and must not be
+ * passed to free_split_str.
  */
-char** split_str(char* str, const char* delim, unsigned int* length_return)
+char** split_str(Arena* arena, char* str, const char* delim, unsigned int* length_return)
 {
         char** split_str = NULL;
         bool in_quotes = false;
         bool in_token = false;
-        int len = 0;
+        unsigned int len = 0;
+        unsigned int capacity = 0;
         int start_idx = 0;
         unsigned int i;
 
@@ -1577,16 +8059,22 @@ char** split_str(char* str, const char* delim, unsigned int* length_return)
                         in_token = 0;
                         len++;
 
-                        split_str = realloc(split_str, len * sizeof(char*));
-                        if (split_str == NULL) {
-                                fprintf(stderr, "Error reallocating memory for split string.\n");
-                                exit(1);
+                        if (arena) {
+                                split_str = arena_grow(arena, split_str, sizeof(char*), len - 1, &capacity);
+                                split_str[len - 1] = arena_string(arena, i - start_idx);
                         }
+                        else {
+                                split_str = realloc(split_str, len * sizeof(char*));
+                                if (split_str == NULL) {
+                                        fprintf(stderr, "Error reallocating memory for split string.\n");
+                                        exit(1);
+                                }
 
-                        split_str[len - 1] = malloc(i - start_idx + 1);
-                        if (split_str[len - 1] == NULL) {
-                                fprintf(stderr, "Error allocating memory for split string.\n");
-                                exit(1);
+                                split_str[len - 1] = malloc(i - start_idx + 1);
+                                if (split_str[len - 1] == NULL) {
+                                        fprintf(stderr, "Error allocating memory for split string.\n");
+                                        exit(1);
+                                }
                         }
 
                         memcpy(split_str[len - 1], &str[start_idx], i - start_idx);
@@ -1624,31 +8112,645 @@ void trim_str(char* str)
         *(end + 1) = '\0';
 }
 
+unsigned int* ptr_map_get(PtrMap* map, const void* key)
+{
+        unsigned int i;
+
+        if (map->count == 0)
+                return NULL;
+        i = ((size_t)key >> 4) & (map->capacity - 1);
+        while (map->entries[i].key) {
+                if (map->entries[i].key == key)
+                        return &map->entries[i].value;
+                i = (i + 1) & (map->capacity - 1);
+        }
+        return NULL;
+}
+
+
+void ptr_map_put(Arena* arena, PtrMap* map, const void* key, unsigned int value)
+{
+        unsigned int i;
+
+        if ((map->count + 1) * 4 > map->capacity * 3) {
+                PtrEntry* old_entries = map->entries;
+                unsigned int old_capacity = map->capacity;
+
+                map->capacity = old_capacity ? old_capacity * 2 : 16;
+                map->entries = arena_alloc(arena, map->capacity * sizeof(PtrEntry));
+                memset(map->entries, 0, map->capacity * sizeof(PtrEntry));
+                map->count = 0;
+                for (i = 0; i < old_capacity; i++) {
+                        if (old_entries[i].key)
+                                ptr_map_put(arena, map, old_entries[i].key, old_entries[i].value);
+                }
+        }
+
+        i = ((size_t)key >> 4) & (map->capacity - 1);
+        while (map->entries[i].key && map->entries[i].key != key)
+                i = (i + 1) & (map->capacity - 1);
+        if (!map->entries[i].key)
+                map->count++;
+        map->entries[i].key = key;
+        map->entries[i].value = value;
+}
+
+
+bool is_compiled_deck(const char* filename)
+{
+        char magic[4];
+        FILE* file = fopen(filename, "rb");
+        bool compiled;
+
+        if (!file)
+                return false;
+        compiled = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                && memcmp(magic, ISB_MAGIC, sizeof(magic)) == 0;
+        fclose(file);
+        return compiled;
+}
+
+
+/* Adler-32, start with a sum of 1 and feed data in order */
+uint32_t isb_checksum(uint32_t sum, const unsigned char* data, size_t len)
+{
+        uint32_t a = sum & 0xFFFF;
+        uint32_t b = sum >> 16;
+
+        while (len > 0) {
+                size_t chunk = len < 5552 ? len : 5552;
+                len -= chunk;
+                while (chunk--) {
+                        a += *data++;
+                        b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+        }
+        return (b << 16) | a;
+}
+
+
+uint32_t isb_string(IsbWriter* w, char* str)
+{
+        size_t len;
+        void* offset;
+
+        if (!str)
+                return ISB_NO_STRING;
+
+        /* offsets are stored plus one so that offset 0 isn't NULL */
+        offset = name_table_get(&w->string_offsets, str);
+        if (offset)
+                return (uint32_t)((size_t)offset - 1);
+
+        len = strlen(str);
+        while (w->string_size + len + 1 > w->string_capacity)
+                w->strings = arena_grow(&w->arena, w->strings, 1, w->string_capacity, &w->string_capacity);
+        memcpy(w->strings + w->string_size, str, len + 1);
+        name_table_put(&w->arena, &w->string_offsets, str, (void*)(size_t)(w->string_size + 1));
+        w->string_size += len + 1;
+        return w->string_size - len - 1;
+}
+
+
+void isb_reserve_elements(IsbWriter* w, unsigned int count)
+{
+        if (count == 0)
+                return;
+        while (w->element_count + count > w->element_capacity)
+                w->elements = arena_grow(&w->arena, w->elements, sizeof(IsbElement),
+                                         w->element_capacity, &w->element_capacity);
+        w->element_count += count;
+}
+
+
+void isb_write_slide(IsbWriter* w, Slide* slide, unsigned int index)
+{
+        unsigned int first = w->element_count;
+        unsigned int i;
+
+        isb_reserve_elements(w, slide->element_count);
+        w->slides[index].name = isb_string(w, slide->name);
+        w->slides[index].visible = slide->visible;
+        w->slides[index].first_element = first;
+        w->slides[index].element_count = slide->element_count;
+        w->slides[index].notes_offset = slide->notes_offset;
+        w->slides[index].notes_length = slide->notes_length;
+        w->slides[index].steps = slide->steps;
+
+        for (i = 0; i < slide->element_count; i++) {
+                SlideElement* se = slide->elements[i];
+                IsbElement el;
+
+                el.type = se->type;
+                el.font_size = 0;
+                el.step = 0;
+                if (se->type == ELEMENT_TYPE_BOX) {
+                        el.value = isb_write_box(w, se->element.box);
+                }
+                else {
+                        el.value = w->slide_count;
+                        w->slides = arena_grow(&w->arena, w->slides, sizeof(IsbSlide), w->slide_count, &w->slide_capacity);
+                        w->slide_count++;
+                        isb_write_slide(w, se->element.slide, el.value);
+                }
+                w->elements[first + i] = el;
+        }
+}
+
+
+/* boxes that borrow the same element array share one element run */
+unsigned int isb_write_box(IsbWriter* w, Box* box)
+{
+        unsigned int index = w->box_count;
+        unsigned int* run = box->elements ? ptr_map_get(&w->element_runs, box->elements) : NULL;
+        unsigned int first;
+        unsigned int i;
+
+        w->boxes = arena_grow(&w->arena, w->boxes, sizeof(IsbBox), w->box_count, &w->box_capacity);
+        w->box_count++;
+
+        if (run) {
+                first = *run;
+        }
+        else {
+                first = w->element_count;
+                isb_reserve_elements(w, box->element_count);
+                for (i = 0; i < box->element_count; i++) {
+                        SlideElement* se = box->elements[i];
+                        IsbElement el;
+
+                        el.type = se->type;
+                        el.font_size = 0;
+                        el.step = se->step;
+                        if (se->type == ELEMENT_TYPE_TEXT) {
+                                el.value = isb_string(w, se->element.text->content);
+                                el.font_size = se->element.text->font_size;
+                        }
+                        else {
+                                unsigned int* image_index = ptr_map_get(&w->image_indices, se->element.image);
+                                if (image_index) {
+                                        el.value = *image_index;
+                                }
+                                else {
+                                        el.value = w->image_count;
+                                        w->images = arena_grow(&w->arena, w->images, sizeof(Image*), w->image_count, &w->image_capacity);
+                                        w->images[w->image_count++] = se->element.image;
+                                        ptr_map_put(&w->arena, &w->image_indices, se->element.image, el.value);
+                                }
+                        }
+                        w->elements[first + i] = el;
+                }
+                if (box->elements)
+                        ptr_map_put(&w->arena, &w->element_runs, box->elements, first);
+        }
+
+        w->boxes[index].name = isb_string(w, box->name);
+        w->boxes[index].stack_type = box->stack_type;
+        w->boxes[index].text_align = box->text_align;
+        w->boxes[index].first_element = first;
+        w->boxes[index].element_count = box->element_count;
+        return index;
+}
+
+
+/*
+ * Writes the parsed and template expanded deck, with every image
+ * already decoded, so loading it skips parsing and decoding entirely.
+ */
+void write_compiled_deck(const char* filename, SlideList* list)
+{
+        static const unsigned char zeros[ISB_ALIGN];
+        IsbWriter w;
+        IsbHeader header;
+        IsbImage* images;
+        FILE* file;
+        unsigned long size;
+        unsigned long pixels_size = 0;
+        unsigned int i;
+
+        memset(&w, 0, sizeof(w));
+        memset(&header, 0, sizeof(header));
+        arena_init(&w.arena);
+
+        w.slide_count = list->count;
+        w.slides = arena_grow(&w.arena, NULL, sizeof(IsbSlide), list->count, &w.slide_capacity);
+        for (i = 0; i < list->count; i++)
+                isb_write_slide(&w, list->slides[i], i);
+        header.notes = list->notes_size > 0 ? isb_string(&w, list->notes) : ISB_NO_STRING;
+
+        images = arena_alloc(&w.arena, (w.image_count + 1) * sizeof(IsbImage));
+        for (i = 0; i < w.image_count; i++) {
+                Image* image = w.images[i];
+                images[i].filename = isb_string(&w, image->filename);
+                images[i].width = image->width;
+                images[i].height = image->height;
+                images[i].channels = image->channels;
+                images[i].pixels = pixels_size;
+                /* pixels of a deck compiled from a compiled deck are checked before they are copied */
+                wait_for_pixels(image);
+                images[i].checksum = isb_checksum(1, image->data, (size_t)image->width * image->height * 4);
+                pixels_size += ((unsigned long)image->width * image->height * 4 + ISB_ALIGN - 1) & ~(unsigned long)(ISB_ALIGN - 1);
+        }
+
+        memcpy(header.magic, ISB_MAGIC, sizeof(header.magic));
+        header.version = ISB_VERSION;
+        header.flags = ISB_FLAG_PIXELS;
+        header.header_size = sizeof(IsbHeader);
+        header.top_slide_count = list->count;
+        header.slide_count = w.slide_count;
+        header.box_count = w.box_count;
+        header.element_count = w.element_count;
+        header.image_count = w.image_count;
+        header.string_size = w.string_size;
+
+        size = sizeof(IsbHeader);
+        header.slides_offset = size;
+        size += (unsigned long)w.slide_count * sizeof(IsbSlide);
+        header.boxes_offset = size;
+        size += (unsigned long)w.box_count * sizeof(IsbBox);
+        header.elements_offset = size;
+        size += (unsigned long)w.element_count * sizeof(IsbElement);
+        header.images_offset = size;
+        size += (unsigned long)w.image_count * sizeof(IsbImage);
+        header.strings_offset = size;
+        size += w.string_size;
+        size = (size + ISB_ALIGN - 1) & ~(unsigned long)(ISB_ALIGN - 1);
+        header.pixels_offset = size;
+        header.pixels_size = pixels_size;
+        size += pixels_size;
+
+        if (size > 0xFFFFFFFFul) {
+                fprintf(stderr, "Error: Compiled deck would exceed 4 GiB: %s\n", filename);
+                exit(1);
+        }
+        header.file_size = size;
+
+        /* the tables are contiguous in the file, so they are summed in order */
+        header.tables_checksum = isb_checksum(1, (unsigned char*)w.slides, w.slide_count * sizeof(IsbSlide));
+        header.tables_checksum = isb_checksum(header.tables_checksum, (unsigned char*)w.boxes, w.box_count * sizeof(IsbBox));
+        header.tables_checksum = isb_checksum(header.tables_checksum, (unsigned char*)w.elements, w.element_count * sizeof(IsbElement));
+        header.tables_checksum = isb_checksum(header.tables_checksum, (unsigned char*)images, w.image_count * sizeof(IsbImage));
+        header.tables_checksum = isb_checksum(header.tables_checksum, (unsigned char*)w.strings, w.string_size);
+
+        header.header_checksum = isb_checksum(1, (unsigned char*)&header, offsetof(IsbHeader, header_checksum));
+
+        file = fopen(filename, "wb");
+        if (!file) {
+                fprintf(stderr, "Error opening file: %s\n", filename);
+                exit(1);
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(w.slides, sizeof(IsbSlide), w.slide_count, file);
+        fwrite(w.boxes, sizeof(IsbBox), w.box_count, file);
+        fwrite(w.elements, sizeof(IsbElement), w.element_count, file);
+        fwrite(images, sizeof(IsbImage), w.image_count, file);
+        fwrite(w.strings, 1, w.string_size, file);
+        fwrite(zeros, 1, header.pixels_offset - header.strings_offset - w.string_size, file);
+        for (i = 0; i < w.image_count; i++) {
+                size_t len = (size_t)w.images[i]->width * w.images[i]->height * 4;
+                fwrite(w.images[i]->data, 1, len, file);
+                fwrite(zeros, 1, (ISB_ALIGN - len % ISB_ALIGN) % ISB_ALIGN, file);
+        }
+        if (ferror(file) || fclose(file) != 0) {
+                fprintf(stderr, "Error writing compiled deck: %s\n", filename);
+                exit(1);
+        }
+
+        arena_release(&w.arena);
+}
+
+
+void isb_error(const char* filename, const char* msg)
+{
+        fprintf(stderr, "Error loading compiled deck %s: %s\n", filename, msg);
+        deck_error();
+}
+
+
+const char* isb_get_string(const char* filename, const char* strings, const IsbHeader* header, uint32_t offset)
+{
+        if (offset == ISB_NO_STRING)
+                return NULL;
+        if (offset >= header->string_size)
+                isb_error(filename, "string out of range");
+        return strings + offset;
+}
+
+
+/* pixels of a compiled deck are checked on first use, a corrupt image is fatal like one that can't be decoded */
+void check_mapped_pixels(Image* image)
+{
+        if (!image->mapped)
+                return;
+        /* thumbnail workers downscale mapped images too */
+        pthread_mutex_lock(&pixel_check_lock);
+        if (!image->checked) {
+                if (isb_checksum(1, image->data, (size_t)image->width * image->height * 4) != image->checksum) {
+                        fprintf(stderr, "Error: Pixel checksum mismatch in compiled deck for image: %s\n", image->filename);
+                        exit(1);
+                }
+                image->checked = true;
+        }
+        pthread_mutex_unlock(&pixel_check_lock);
+}
+
+
+void unmap_compiled_deck(void* ptr)
+{
+        IsbMapping* mapping = ptr;
+        munmap(mapping->addr, mapping->size);
+}
+
+
+/*
+ * Maps a deck written by write_compiled_deck. Names, text and pixels
+ * are used in place from the mapping, only the small node structs are
+ * allocated. Every index and offset is checked before it is followed.
+ */
+void load_compiled_deck(const char* filename, SlideList* list)
+{
+        Arena* arena = &list->arena;
+        IsbMapping* mapping;
+        const unsigned char* base;
+        const IsbHeader* header;
+        const IsbSlide* isb_slides;
+        const IsbBox* isb_boxes;
+        const IsbElement* isb_elements;
+        const IsbImage* isb_images;
+        const char* strings;
+        Slide* slides;
+        Box* boxes;
+        SlideElement* elements;
+        Text* texts;
+        Image** images;
+        SlideElement*** box_runs;
+        uint32_t* box_run_counts;
+        struct stat st;
+        uint32_t sum;
+        unsigned int i;
+        unsigned int j;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+                fprintf(stderr, "Error opening file: %s\n", filename);
+                if (fd >= 0)
+                        close(fd);
+                deck_error();
+        }
+        if ((unsigned long)st.st_size < sizeof(IsbHeader)) {
+                close(fd);
+                isb_error(filename, "truncated header");
+        }
+
+        mapping = arena_alloc(arena, sizeof(IsbMapping));
+        mapping->size = st.st_size;
+        mapping->addr = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping->addr == MAP_FAILED)
+                isb_error(filename, "mmap failed");
+        arena_defer(arena, unmap_compiled_deck, mapping);
+
+        base = mapping->addr;
+        header = (const IsbHeader*)base;
+
+        if (memcmp(header->magic, ISB_MAGIC, sizeof(header->magic)) != 0)
+                isb_error(filename, "bad magic");
+        if (header->version != ISB_VERSION)
+                isb_error(filename, "unsupported version, recompile the deck");
+        if (header->header_size != sizeof(IsbHeader) || header->file_size != mapping->size)
+                isb_error(filename, "size mismatch");
+        if (isb_checksum(1, base, offsetof(IsbHeader, header_checksum)) != header->header_checksum)
+                isb_error(filename, "header checksum mismatch");
+
+        if (header->slides_offset != sizeof(IsbHeader)
+                || header->slide_count > mapping->size / sizeof(IsbSlide)
+                || header->box_count > mapping->size / sizeof(IsbBox)
+                || header->element_count > mapping->size / sizeof(IsbElement)
+                || header->image_count > mapping->size / sizeof(IsbImage)
+                || header->boxes_offset != header->slides_offset + header->slide_count * sizeof(IsbSlide)
+                || header->elements_offset != header->boxes_offset + header->box_count * sizeof(IsbBox)
+                || header->images_offset != header->elements_offset + header->element_count * sizeof(IsbElement)
+                || header->strings_offset != header->images_offset + header->image_count * sizeof(IsbImage)
+                || header->pixels_offset < header->strings_offset + header->string_size
+                || header->pixels_offset > mapping->size
+                || header->pixels_size != mapping->size - header->pixels_offset
+                || header->pixels_offset % ISB_ALIGN != 0
+                || header->top_slide_count > header->slide_count)
+                isb_error(filename, "corrupt section table");
+
+        sum = isb_checksum(1, base + header->slides_offset, header->strings_offset + header->string_size - header->slides_offset);
+        if (sum != header->tables_checksum)
+                isb_error(filename, "table checksum mismatch");
+
+        isb_slides = (const IsbSlide*)(base + header->slides_offset);
+        isb_boxes = (const IsbBox*)(base + header->boxes_offset);
+        isb_elements = (const IsbElement*)(base + header->elements_offset);
+        isb_images = (const IsbImage*)(base + header->images_offset);
+        strings = (const char*)(base + header->strings_offset);
+        if (header->string_size > 0 && strings[header->string_size - 1] != '\0')
+                isb_error(filename, "unterminated string table");
+
+        /* the notes stay in the mapping, a capacity of zero marks them borrowed */
+        list->notes = (char*)isb_get_string(filename, strings, header, header->notes);
+        list->notes_size = list->notes ? strlen(list->notes) : 0;
+        list->notes_capacity = 0;
+
+        slides = arena_alloc(arena, (header->slide_count + 1) * sizeof(Slide));
+        boxes = arena_alloc(arena, (header->box_count + 1) * sizeof(Box));
+        elements = arena_alloc(arena, (header->element_count + 1) * sizeof(SlideElement));
+        texts = arena_alloc(arena, (header->element_count + 1) * sizeof(Text));
+        images = arena_alloc(arena, (header->image_count + 1) * sizeof(Image*));
+        box_runs = arena_alloc(arena, (header->element_count + 1) * sizeof(SlideElement**));
+        memset(box_runs, 0, (header->element_count + 1) * sizeof(SlideElement**));
+        box_run_counts = arena_alloc(arena, (header->element_count + 1) * sizeof(uint32_t));
+
+        for (i = 0; i < header->image_count; i++) {
+                const IsbImage* isb_image = &isb_images[i];
+                char* image_name = (char*)isb_get_string(filename, strings, header, isb_image->filename);
+
+                if (!image_name)
+                        isb_error(filename, "image without filename");
+                if (!(header->flags & ISB_FLAG_PIXELS)) {
+                        create_image(arena, &images[i], image_name);
+                        continue;
+                }
+                if (isb_image->pixels > header->pixels_size
+                        || (unsigned long)isb_image->width * isb_image->height * 4 > header->pixels_size - isb_image->pixels)
+                        isb_error(filename, "image pixels out of range");
+
+                images[i] = malloc(sizeof(Image));
+                if (!images[i]) {
+                        fprintf(stderr, "Error: Failed to allocate memory for image.\n");
+                        exit(1);
+                }
+                images[i]->type = ELEMENT_TYPE_IMAGE;
+                images[i]->filename = image_name;
+                images[i]->pixmap = None;
+                images[i]->picture = None;
+                images[i]->proxy_state = PROXY_NONE;
+                images[i]->proxy_data = NULL;
+                images[i]->proxy_picture = None;
+                images[i]->proxy_pixmap = None;
+                images[i]->data = (unsigned char*)(base + header->pixels_offset + isb_image->pixels);
+                images[i]->width = isb_image->width;
+                images[i]->height = isb_image->height;
+                images[i]->channels = isb_image->channels;
+                images[i]->refs = 1;
+                images[i]->mapped = true;
+                /* summing the pixels now would read every page of the mapping before the first frame */
+                images[i]->checked = false;
+                images[i]->checksum = isb_image->checksum;
+                images[i]->decode = DECODE_DONE;
+                images[i]->anim = NULL;
+                images[i]->sequence = NULL;
+                images[i]->pyramid = NULL;
+                pixel_bytes += (size_t)images[i]->width * images[i]->height * 4;
+                arena_defer(arena, release_image, images[i]);
+        }
+
+        for (i = 0; i < header->element_count; i++) {
+                const IsbElement* el = &isb_elements[i];
+                SlideElement* se = &elements[i];
+
+                se->type = el->type;
+                se->step = el->step;
+                switch (el->type) {
+                case ELEMENT_TYPE_SLIDE:
+                        /* children always come after their parent, which rules out cycles */
+                        if (el->value < header->top_slide_count || el->value >= header->slide_count)
+                                isb_error(filename, "slide index out of range");
+                        se->element.slide = &slides[el->value];
+                        break;
+                case ELEMENT_TYPE_BOX:
+                        if (el->value >= header->box_count)
+                                isb_error(filename, "box index out of range");
+                        se->element.box = &boxes[el->value];
+                        break;
+                case ELEMENT_TYPE_TEXT:
+                        if (el->font_size > FONT_HUGE)
+                                isb_error(filename, "bad font size");
+                        texts[i].type = ELEMENT_TYPE_TEXT;
+                        texts[i].font_size = el->font_size;
+                        texts[i].content = (char*)isb_get_string(filename, strings, header, el->value);
+                        if (!texts[i].content)
+                                isb_error(filename, "text without content");
+                        se->element.text = &texts[i];
+                        break;
+                case ELEMENT_TYPE_IMAGE:
+                        if (el->value >= header->image_count)
+                                isb_error(filename, "image index out of range");
+                        se->element.image = images[el->value];
+                        break;
+                default:
+                        isb_error(filename, "bad element type");
+                }
+        }
+
+        for (i = 0; i < header->box_count; i++) {
+                const IsbBox* isb_box = &isb_boxes[i];
+                Box* box = &boxes[i];
+
+                if (isb_box->first_element > header->element_count
+                        || isb_box->element_count > header->element_count - isb_box->first_element
+                        || isb_box->stack_type > STACK_VERTICAL
+                        || isb_box->text_align > TEXT_ALIGN_RIGHT)
+                        isb_error(filename, "corrupt box");
+
+                box->type = ELEMENT_TYPE_BOX;
+                box->name = (char*)isb_get_string(filename, strings, header, isb_box->name);
+                box->stack_type = isb_box->stack_type;
+                box->text_align = isb_box->text_align;
+                box->element_count = isb_box->element_count;
+                box->element_capacity = 0;
+                box->items = NULL;
+                box->item_count = 0;
+                box->item_capacity = 0;
+
+                /* boxes sharing a run share the element array, just as they did before compiling */
+                box->elements = NULL;
+                if (isb_box->element_count == 0)
+                        continue;
+                box->elements = box_runs[isb_box->first_element];
+                if (box->elements) {
+                        if (box_run_counts[isb_box->first_element] != isb_box->element_count)
+                                isb_error(filename, "boxes share a run of different lengths");
+                        continue;
+                }
+                box->elements = arena_alloc(arena, isb_box->element_count * sizeof(SlideElement*));
+                for (j = 0; j < isb_box->element_count; j++) {
+                        SlideElement* se = &elements[isb_box->first_element + j];
+                        if (se->type != ELEMENT_TYPE_TEXT && se->type != ELEMENT_TYPE_IMAGE)
+                                isb_error(filename, "box holds a non text or image element");
+                        box->elements[j] = se;
+                }
+                box_runs[isb_box->first_element] = box->elements;
+                box_run_counts[isb_box->first_element] = isb_box->element_count;
+        }
+
+        for (i = 0; i < header->slide_count; i++) {
+                const IsbSlide* isb_slide = &isb_slides[i];
+                Slide* slide = &slides[i];
+
+                if (isb_slide->first_element > header->element_count
+                        || isb_slide->element_count > header->element_count - isb_slide->first_element
+                        || isb_slide->notes_offset > list->notes_size
+                        || isb_slide->notes_length > list->notes_size - isb_slide->notes_offset)
+                        isb_error(filename, "corrupt slide");
+
+                slide->type = ELEMENT_TYPE_SLIDE;
+                slide->name = (char*)isb_get_string(filename, strings, header, isb_slide->name);
+                if (!slide->name)
+                        isb_error(filename, "slide without name");
+                slide->visible = isb_slide->visible != 0;
+                slide->notes_offset = isb_slide->notes_offset;
+                slide->notes_length = isb_slide->notes_length;
+                slide->steps = isb_slide->steps;
+                slide->display = NULL;
+                slide->element_count = isb_slide->element_count;
+                slide->element_capacity = isb_slide->element_count;
+                slide->elements = arena_alloc(arena, (isb_slide->element_count + 1) * sizeof(SlideElement*));
+                name_table_init(&slide->element_index);
+                for (j = 0; j < isb_slide->element_count; j++) {
+                        SlideElement* se = &elements[isb_slide->first_element + j];
+                        if (se->type != ELEMENT_TYPE_BOX && se->type != ELEMENT_TYPE_SLIDE)
+                                isb_error(filename, "slide holds a non box or slide element");
+                        if (se->type == ELEMENT_TYPE_SLIDE && se->element.slide <= slide)
+                                isb_error(filename, "slide refers back to itself");
+                        slide->elements[j] = se;
+                }
+        }
+
+        for (i = 0; i < header->top_slide_count; i++)
+                slide_list_append(list, &slides[i]);
+}
 /* Handler functions */
 
-void handle_slide(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_slide(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str";
         (void) current_box;
         (void) list;
         check_syntax(args, argc, expected, line_num);
 
-        create_slide(current_slide, remove_quotes(args[1]), true);
+        create_slide(&list->arena, current_slide, intern_quoted(list, args[1]), true);
 }
 
 
-void handle_template(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_template(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str";
         (void) current_box;
         (void) list;
         check_syntax(args, argc, expected, line_num);
 
-        create_slide(current_slide, remove_quotes(args[1]), false);
+        create_slide(&list->arena, current_slide, intern_quoted(list, args[1]), false);
 }
 
 
-void handle_box(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_box(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str type type";
         Box* box = NULL;
@@ -1656,7 +8758,6 @@ void handle_box(SlideList list, Slide** current_slide, Box** current_box, char**
         StackType stack_type;
         TextAlignmentType text_align;
         (void) current_box;
-        (void) list;
 
         check_syntax(args, argc, expected, line_num);
 
@@ -1668,6 +8769,7 @@ void handle_box(SlideList list, Slide** current_slide, Box** current_box, char**
         }
         else {
                 fprintf(stderr, "Syntax Error on line %d : Expected 'stack-horizontal' or 'stack-vertical' for argument 2 but found %s\n", line_num, args[2]);
+                deck_error();
         }
 
         if (strcmp(args[3], "align-left") == 0) {
@@ -1681,18 +8783,19 @@ void handle_box(SlideList list, Slide** current_slide, Box** current_box, char**
         }
         else {
                 fprintf(stderr, "Syntax Error on line %d : Expected 'align-left', 'align-right', or 'align-center' for argument 3 but found %s\n", line_num, args[3]);
+                deck_error();
         }
 
-        create_box(&box, remove_quotes(args[1]), stack_type, text_align);
+        create_box(&list->arena, &box, intern_quoted(list, args[1]), stack_type, text_align);
 
-        se = alloc_slide_element(ELEMENT_TYPE_BOX);
+        se = alloc_slide_element(&list->arena, ELEMENT_TYPE_BOX);
         se->element.box = box;
 
-        add_element_to_slide(*current_slide, se);
+        add_element_to_slide(&list->arena, *current_slide, se);
 }
 
 
-void handle_uses(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_uses(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str";
         Slide* slide;
@@ -1701,32 +8804,31 @@ void handle_uses(SlideList list, Slide** current_slide, Box** current_box, char*
         char* name;
         (void) current_box;
         check_syntax(args, argc, expected, line_num);
-        name = remove_quotes(args[1]);
+        name = remove_quotes(&list->arena, args[1]);
 
-        found_slide = find_slide_by_name(name, list);
+        found_slide = find_slide_by_name(name, *list);
         if (found_slide == NULL) {
                 fprintf(stderr, "Error on line %d : Couldn't find slide or template with name: %s\n", line_num, name);
-                exit(1);
+                deck_error();
         }
-        slide = copy_slide(found_slide);
+        slide = instantiate_slide(&list->arena, found_slide);
 
-        se = alloc_slide_element(ELEMENT_TYPE_SLIDE);
+        se = alloc_slide_element(&list->arena, ELEMENT_TYPE_SLIDE);
         se->element.slide = slide;
 
-        add_element_to_slide(*current_slide, se);
-
-        free(name);
+        add_element_to_slide(&list->arena, *current_slide, se);
+        /* pauses after it come after its own */
+        if (slide->steps > (*current_slide)->steps)
+                (*current_slide)->steps = slide->steps;
 }
 
 
-void handle_text(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_text(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "type str";
         SlideElement* se = NULL;
         Text* text = NULL;
         FontSize font_size;
-        (void) current_slide;
-        (void) list;
         check_syntax(args, argc, expected, line_num);
 
         if (strcmp(args[1], "huge") == 0) {
@@ -1743,64 +8845,106 @@ void handle_text(SlideList list, Slide** current_slide, Box** current_box, char*
         }
         else {
                 fprintf(stderr, "Syntax Error on line %d : Expected 'title', 'normal', or 'small' for argument 1 but found %s\n", line_num, args[1]);
-                exit(1);
+                deck_error();
         }
 
-        create_text(&text, remove_quotes(args[2]), font_size);
+        create_text(&list->arena, &text, remove_quotes(&list->arena, args[2]), font_size);
 
-        se = alloc_slide_element(ELEMENT_TYPE_TEXT);
+        se = alloc_slide_element(&list->arena, ELEMENT_TYPE_TEXT);
         se->element.text = text;
 
         if (*current_box == NULL) {
                 fprintf(stderr, "Logic Error on line %d : Attempting to add text to non-box object.\n", line_num);
-                exit(1);
+                deck_error();
         }
-        add_element_to_box(*current_box, se);
+        se->step = (*current_slide)->steps;
+        add_element_to_box(&list->arena, *current_box, se);
 }
 
 
-void handle_image(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_image(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str";
         SlideElement* se = NULL;
         Image* image = NULL;
-        (void) current_slide;
-        (void) list;
         check_syntax(args, argc, expected, line_num);
-        create_image(&image, remove_quotes(args[1]));
+        create_image(&list->arena, &image, remove_quotes(&list->arena, args[1]));
 
-        se = alloc_slide_element(ELEMENT_TYPE_IMAGE);
+        se = alloc_slide_element(&list->arena, ELEMENT_TYPE_IMAGE);
         se->element.image = image;
 
         if (*current_box == NULL) {
                 fprintf(stderr, "Logic Error on line %d : Attempting to add text to non-box object.\n", line_num);
-                exit(1);
+                deck_error();
+        }
+        se->step = (*current_slide)->steps;
+        add_element_to_box(&list->arena, *current_box, se);
+}
+
+
+void handle_imageseq(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+{
+        char expected[] = "str uint";
+        SlideElement* se = NULL;
+        Image* image = NULL;
+        unsigned int fps;
+        check_syntax(args, argc, expected, line_num);
+
+        fps = atoi(args[2]);
+        if (fps == 0 || fps > SEQUENCE_MAX_FPS) {
+                fprintf(stderr, "Syntax Error on line %d : Expected a frame rate from 1 to %d for argument 2 but found %s\n", line_num, SEQUENCE_MAX_FPS, args[2]);
+                deck_error();
+        }
+        if (*current_box == NULL) {
+                fprintf(stderr, "Logic Error on line %d : Attempting to add an image sequence to non-box object.\n", line_num);
+                deck_error();
         }
-        add_element_to_box(*current_box, se);
+        create_image_sequence(&list->arena, &image, remove_quotes(&list->arena, args[1]), fps, line_num);
+
+        se = alloc_slide_element(&list->arena, ELEMENT_TYPE_IMAGE);
+        se->element.image = image;
+        se->step = (*current_slide)->steps;
+        add_element_to_box(&list->arena, *current_box, se);
 }
 
 
-void handle_define(SlideList list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+void handle_define(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
 {
         char expected[] = "str";
         char* name;
         SlideElement* se;
         (void) current_box;
-        (void) list;
 
         check_syntax(args, argc, expected, line_num);
-        name = remove_quotes(args[1]);
+        name = remove_quotes(&list->arena, args[1]);
         se = find_element_by_name(name, *current_slide);
-        free(name);
 
         if (se == NULL) {
                 fprintf(stderr, "Logic Error on line %d : Trying to define nonexistent element '%s'.\n", line_num, args[1]);
-                exit(1);
+                deck_error();
         }
         if (se->type != ELEMENT_TYPE_BOX) {
                 fprintf(stderr, "Logic Error on line %d : Trying to define non-box element '%s'.\n", line_num, args[1]);
-                exit(1);
+                deck_error();
         }
 
         *current_box = se->element.box;
 }
+
+
+/* what follows in the slide, in any box, appears one click later */
+void handle_pause(SlideList* list, Slide** current_slide, Box** current_box, char** args, unsigned int argc, unsigned int line_num)
+{
+        (void) list;
+        (void) args;
+
+        if (argc != 1) {
+                fprintf(stderr, "Syntax Error on line %d : pause expects 0 arguments, but %d were given.\n", line_num, argc - 1);
+                deck_error();
+        }
+        if (*current_box == NULL) {
+                fprintf(stderr, "Logic Error on line %d : pause must be inside a define block.\n", line_num);
+                deck_error();
+        }
+        (*current_slide)->steps++;
+}